@@ -49,6 +49,7 @@ uint8_t primary_hd_no = 0;
 uint8_t logic_hd_no = 0;
 
 struct list partition_list; //分区队列
+struct partition *swap_part; //第一个交换分区，没有时为NULL
 
 // 16字节大小的结构体，用来存放分区表项
 struct partition_table_entry
@@ -249,6 +250,23 @@ static void identify_disk(struct disk *hd)
     printk("        capacity: %dMB\n", sectors * 512 / 1024 / 1024);
 }
 
+/*
+ * @brief 登记扫描到的分区，交换分区单独记下，不加入分区队列，文件系统不会在上面建立
+ * @param part 分区指针
+ * @param fs_type 分区类型
+ */
+static void partition_add(struct partition *part, uint8_t fs_type)
+{
+    if (fs_type != PART_TYPE_SWAP)
+    {
+        list_append(&partition_list, &part->part_tag);
+    }
+    else if (swap_part == NULL)
+    {
+        swap_part = part;
+    }
+}
+
 /*
  * @brief 扫描硬盘hd中地址为ext_lba的扇区中的所有分区
  * @param hd 硬盘指针
@@ -287,8 +305,8 @@ static void partition_scan(struct disk *hd, uint32_t ext_lba)
                 hd->prim_parts[primary_hd_no].start_lba = ext_lba + part_table->start_lba;
                 hd->prim_parts[primary_hd_no].sec_cnt = part_table->sec_cnt;
                 hd->prim_parts[primary_hd_no].my_disk = hd;
-                list_append(&partition_list, &hd->prim_parts[primary_hd_no].part_tag);
                 sprintf(hd->prim_parts[primary_hd_no].name, "%s%d", hd->name, primary_hd_no + 1);
+                partition_add(&hd->prim_parts[primary_hd_no], part_table->fs_type);
 
                 primary_hd_no++;
                 ASSERT(primary_hd_no < 4); //0 1 2 3 四个
@@ -299,8 +317,8 @@ static void partition_scan(struct disk *hd, uint32_t ext_lba)
                 hd->logic_parts[logic_hd_no].start_lba = ext_lba + part_table->start_lba;
                 hd->logic_parts[logic_hd_no].sec_cnt = part_table->sec_cnt;
                 hd->logic_parts[logic_hd_no].my_disk = hd;
-                list_append(&partition_list, &hd->logic_parts[logic_hd_no].part_tag);
                 sprintf(hd->logic_parts[logic_hd_no].name, "%s%d", hd->name, logic_hd_no + 5);
+                partition_add(&hd->logic_parts[logic_hd_no], part_table->fs_type);
 
                 logic_hd_no++;
                 if (logic_hd_no >= 8)
@@ -527,5 +545,10 @@ void ide_init()
     printk("\n    all partition info:\n");
     /* 打印所有分区信息 */
     list_traversal(&partition_list, partition_info, (int)NULL);
+    if (swap_part != NULL)
+    {
+        printk("    swap partition:\n");
+        partition_info(&swap_part->part_tag, (int)NULL);
+    }
     printk("ide init done!\n");
 }
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include "sync.h"
 #include "super_block.h"
 
+#define PART_TYPE_SWAP 0x82 //交换分区的分区类型，不建立文件系统，只用作换出页的存储
+
 // * @brief 分区结构体
 struct partition
 {
@@ -52,4 +54,5 @@ void intr_hd_handler(uint8_t irq_no);
 extern uint8_t channel_cnt;
 extern struct ide_channel channels[];
 extern struct list partition_list;
+extern struct partition *swap_part;
 void ide_write(struct disk *hd, uint32_t lba, void *buf, uint32_t sec_cnt);
\ No newline at end of file
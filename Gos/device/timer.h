@@ -1,4 +1,7 @@
 #pragma once
 #include "stdint.h"
+
+extern uint32_t ticks;
+
 void timer_init(void);
 void mtime_sleep(uint32_t seconds);
\ No newline at end of file
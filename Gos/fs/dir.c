@@ -10,7 +10,9 @@
 #include "string.h"
 #include "interrupt.h"
 #include "super_block.h"
+#include "slab.h"
 struct dir root_dir;
+struct kmem_cache *dir_cache; //已打开目录的缓存
 
 /**
  * @brief 打开根目录
@@ -30,7 +32,7 @@ void open_root_dir(struct partition *part)
  */
 struct dir *dir_open(struct partition *part, uint32_t inode_no)
 {
-    struct dir *pdir = (struct dir *)sys_malloc(sizeof(struct dir));
+    struct dir *pdir = (struct dir *)kmem_cache_alloc(dir_cache);
     pdir->inode = inode_open(part, inode_no);
     pdir->dir_pos = 0;
     return pdir;
@@ -121,7 +123,7 @@ void dir_close(struct dir *dir)
         return;
     }
     inode_close(dir->inode);
-    sys_free(dir);
+    kmem_cache_free(dir_cache, dir);
 }
 
 /**
@@ -25,6 +25,7 @@ struct dir_entry
 };
 
 extern struct dir root_dir;
+extern struct kmem_cache *dir_cache;
 
 void create_dir_entry(char *filename, uint32_t inode_no, uint8_t file_type, struct dir_entry *pdir_e);
 void dir_close(struct dir *dir);
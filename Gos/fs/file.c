@@ -9,6 +9,8 @@
 #include "string.h"
 #include "thread.h"
 #include "global.h"
+#include "slab.h"
+#include "filemap.h"
 
 struct file file_table[MAX_FILE_OPEN];
 
@@ -153,7 +155,7 @@ int32_t file_create(struct dir *parent_dir, char *file_name, uint8_t flag)
         return -1;
     }
 
-    struct inode *new_file_inode = (struct inode *)sys_malloc(sizeof(struct inode));
+    struct inode *new_file_inode = (struct inode *)kmem_cache_alloc(inode_cache);
     if (new_file_inode == NULL)
     {
         //失败了就回滚
@@ -221,7 +223,7 @@ roll_back_step:
     case 3:
         memset(&file_table[fd_idx], 0, sizeof(struct file));
     case 2:
-        sys_free(new_file_inode);
+        kmem_cache_free(inode_cache, new_file_inode);
     case 1:
         bitmap_set(&current_partition->inode_bitmap, inode_no, 0);
         break;
@@ -536,6 +538,8 @@ int32_t file_write(struct file *file, const void *buf, uint32_t count)
 
         memcpy(io_buf + sec_off_bytes, src, chunk_size);
         ide_write(current_partition->my_disk, sec_lba, io_buf, 1);
+        //文件正被映射时，页缓存中的这个扇区也要更新
+        file_map_sector_update(current_partition, file->fd_inode->inode_no, sec_idx, sec_lba, io_buf);
         printk("file write at lba: 0x%x about 0x%x bytes\n", sec_lba, chunk_size);
 
         src += chunk_size;                        //放入下一个待写入的数据
@@ -0,0 +1,263 @@
+#include "filemap.h"
+#include "fs.h"
+#include "inode.h"
+#include "file.h"
+#include "ide.h"
+#include "memory.h"
+#include "global.h"
+#include "debug.h"
+#include "string.h"
+#include "slab.h"
+#include "interrupt.h"
+
+/*
+ * 文件页在第一次被访问时直接从磁盘读入映射给进程的页框，不经过中间缓冲区。
+ * 页缓存只在文件被映射期间存在，最后一个映射它的区域消失时释放所有缓存的页框。
+ * 通过write写入的扇区同步更新已经缓存的文件页，共享映射的修改在msync或munmap之后才写回磁盘
+ */
+
+static struct kmem_cache *file_map_cache; //file_map对象缓存
+static struct list file_maps;             //所有正在被映射的文件
+static struct lock file_map_lock;         //查找、建立和释放文件映射时持有
+
+/**
+ * @brief 初始化文件映射模块
+ */
+void file_map_init(void)
+{
+    file_map_cache = kmem_cache_create("file_map", sizeof(struct file_map), NULL);
+    list_init(&file_maps);
+    lock_init(&file_map_lock);
+}
+
+/**
+ * @brief 查找正在被映射的文件
+ * @param part 分区
+ * @param inode_no inode编号
+ * @return 找到返回文件映射，否则返回NULL
+ * @note 调用者已持有file_map_lock
+ */
+static struct file_map *file_map_find(struct partition *part, uint32_t inode_no)
+{
+    struct list_elem *elem = file_maps.head.next;
+    while (elem != &file_maps.tail)
+    {
+        struct file_map *fmap = elem2entry(struct file_map, map_tag, elem);
+        if (fmap->part == part && fmap->inode->inode_no == inode_no)
+        {
+            return fmap;
+        }
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+/**
+ * @brief 得到当前任务文件描述符fd对应文件的映射，并增加一个引用
+ * @param fd 文件描述符
+ * @param pgoff 映射起始的文件页号
+ * @param pg_cnt 映射的页数
+ * @param writable 输出文件是否以可写方式打开
+ * @return 成功返回文件映射；fd不是可读的已打开文件、映射超出文件末尾所在的页或内存不足时返回NULL
+ * @note 同一文件的所有映射共享一个file_map，因而共享其中缓存的页框
+ */
+struct file_map *file_map_get(int32_t fd, uint32_t pgoff, uint32_t pg_cnt, bool *writable)
+{
+    struct file *file = fd2file(fd);
+    if (file == NULL || file->fd_flag & O_WRONLY)
+    {
+        return NULL;
+    }
+    struct partition *part = current_partition;
+    struct inode *inode = file->fd_inode;
+    uint32_t file_pages = DIV_ROUND_UP(inode->inode_size, PG_SIZE);
+    if (pgoff > file_pages || pg_cnt > file_pages - pgoff)
+    {
+        return NULL;
+    }
+    *writable = (file->fd_flag & O_RDWR) != 0;
+
+    get_lock(&file_map_lock);
+    struct file_map *fmap = file_map_find(part, inode->inode_no);
+    if (fmap == NULL)
+    {
+        fmap = kmem_cache_alloc(file_map_cache);
+        if (fmap == NULL)
+        {
+            abandon_lock(&file_map_lock);
+            return NULL;
+        }
+        memset(fmap, 0, sizeof(struct file_map));
+        fmap->part = part;
+        //映射期间即使文件被关闭，inode也要留在内存中
+        fmap->inode = inode_open(part, inode->inode_no);
+        lock_init(&fmap->lock);
+        list_append(&file_maps, &fmap->map_tag);
+    }
+    fmap->ref_cnt++;
+
+    //文件在两次映射之间可能变长，每次都重新读入数据块的扇区号
+    memcpy(fmap->sectors, inode->inode_sectors, 12 * sizeof(uint32_t));
+    if (inode->inode_sectors[12] != 0)
+    {
+        ide_read(part->my_disk, inode->inode_sectors[12], fmap->sectors + 12, 1);
+    }
+    abandon_lock(&file_map_lock);
+    return fmap;
+}
+
+/**
+ * @brief 增加文件映射的引用，用于区域被拆分或复制
+ * @param fmap 文件映射
+ */
+void file_map_dup(struct file_map *fmap)
+{
+    get_lock(&file_map_lock);
+    ASSERT(fmap->ref_cnt > 0);
+    fmap->ref_cnt++;
+    abandon_lock(&file_map_lock);
+}
+
+/**
+ * @brief 减少文件映射的引用，为0时释放缓存的页框并关闭inode
+ * @param fmap 文件映射
+ * @note 仍被页表项引用的页框要等页表项解除映射时才真正释放
+ */
+void file_map_put(struct file_map *fmap)
+{
+    get_lock(&file_map_lock);
+    ASSERT(fmap->ref_cnt > 0);
+    if (--fmap->ref_cnt == 0)
+    {
+        list_remove(&fmap->map_tag);
+        uint32_t pg_idx;
+        for (pg_idx = 0; pg_idx < FILE_MAP_PAGES; pg_idx++)
+        {
+            if (fmap->pages[pg_idx] != 0)
+            {
+                pfree(fmap->pages[pg_idx]);
+            }
+        }
+        inode_close(fmap->inode);
+        kmem_cache_free(file_map_cache, fmap);
+    }
+    abandon_lock(&file_map_lock);
+}
+
+/**
+ * @brief 判断文件是否正在被映射
+ * @param part 分区
+ * @param inode_no inode编号
+ * @return 是返回true
+ */
+bool file_map_busy(struct partition *part, uint32_t inode_no)
+{
+    get_lock(&file_map_lock);
+    bool busy = file_map_find(part, inode_no) != NULL;
+    abandon_lock(&file_map_lock);
+    return busy;
+}
+
+/**
+ * @brief 在文件的第pg_idx页和buf之间传输数据
+ * @param fmap 文件映射
+ * @param pg_idx 文件中的页号
+ * @param buf 一页大小的缓冲区
+ * @param write 为true时把buf写入文件，否则从文件读入buf
+ * @note 只传输文件大小以内、已经分配了数据块的扇区，扇区号连续的数据块合并成一次磁盘操作
+ */
+static void file_map_io(struct file_map *fmap, uint32_t pg_idx, void *buf, bool write)
+{
+    ASSERT(pg_idx < FILE_MAP_PAGES);
+    uint32_t sec_start = pg_idx * FILE_MAP_PAGE_SECTORS;
+    uint32_t sec_end = DIV_ROUND_UP(fmap->inode->inode_size, BLOCK_SIZE);
+    if (sec_end > sec_start + FILE_MAP_PAGE_SECTORS)
+    {
+        sec_end = sec_start + FILE_MAP_PAGE_SECTORS;
+    }
+
+    uint32_t sec_idx = sec_start;
+    while (sec_idx < sec_end)
+    {
+        uint32_t lba = fmap->sectors[sec_idx];
+        if (lba == 0)
+        {
+            sec_idx++;
+            continue;
+        }
+
+        uint32_t sec_cnt = 1;
+        while (sec_idx + sec_cnt < sec_end && fmap->sectors[sec_idx + sec_cnt] == lba + sec_cnt)
+        {
+            sec_cnt++;
+        }
+        uint8_t *sec_buf = (uint8_t *)buf + (sec_idx - sec_start) * BLOCK_SIZE;
+        if (write)
+        {
+            ide_write(fmap->part->my_disk, lba, sec_buf, sec_cnt);
+        }
+        else
+        {
+            ide_read(fmap->part->my_disk, lba, sec_buf, sec_cnt);
+        }
+        sec_idx += sec_cnt;
+    }
+}
+
+/**
+ * @brief 把文件的第pg_idx页读入buf
+ * @param fmap 文件映射
+ * @param pg_idx 文件中的页号
+ * @param buf 一页大小、内容为0的缓冲区，文件末尾之后的部分保持为0
+ */
+void file_map_read(struct file_map *fmap, uint32_t pg_idx, void *buf)
+{
+    file_map_io(fmap, pg_idx, buf, false);
+}
+
+/**
+ * @brief 把buf写回文件的第pg_idx页，不会改变文件大小
+ * @param fmap 文件映射
+ * @param pg_idx 文件中的页号
+ * @param buf 一页大小的缓冲区
+ */
+void file_map_write(struct file_map *fmap, uint32_t pg_idx, void *buf)
+{
+    file_map_io(fmap, pg_idx, buf, true);
+}
+
+/**
+ * @brief write写入文件的一个扇区后，更新这个文件的映射
+ * @param part 分区
+ * @param inode_no inode编号
+ * @param sec_idx 文件中的扇区号
+ * @param sec_lba 扇区的地址
+ * @param buf 扇区的新内容
+ * @note 新分配的扇区记入扇区号表，已缓存的页同步这个扇区的内容，
+ *       否则msync或munmap写回旧的缓存页时会覆盖write写入的数据
+ */
+void file_map_sector_update(struct partition *part, uint32_t inode_no, uint32_t sec_idx, uint32_t sec_lba, const void *buf)
+{
+    ASSERT(sec_idx < FILE_MAP_SECTORS);
+    get_lock(&file_map_lock);
+    struct file_map *fmap = file_map_find(part, inode_no);
+    if (fmap == NULL)
+    {
+        abandon_lock(&file_map_lock);
+        return;
+    }
+
+    get_lock(&fmap->lock);
+    fmap->sectors[sec_idx] = sec_lba;
+    uint32_t pg_phyaddr = fmap->pages[sec_idx / FILE_MAP_PAGE_SECTORS];
+    if (pg_phyaddr != 0)
+    {
+        enum intr_status old_status = intr_disable();
+        uint8_t *page = kmap(KMAP_COPY, pg_phyaddr);
+        memcpy(page + (sec_idx % FILE_MAP_PAGE_SECTORS) * BLOCK_SIZE, buf, BLOCK_SIZE);
+        kunmap(KMAP_COPY);
+        intr_set_status(old_status);
+    }
+    abandon_lock(&fmap->lock);
+    abandon_lock(&file_map_lock);
+}
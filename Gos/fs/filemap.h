@@ -0,0 +1,32 @@
+//文件映射的页缓存，映射同一文件的进程共享其中的页框
+#pragma once
+#include "stdint.h"
+#include "list.h"
+#include "sync.h"
+
+struct partition;
+
+#define FILE_MAP_SECTORS 140                                          //文件最多的数据块数，12个直接块加128个间接块
+#define FILE_MAP_PAGE_SECTORS 8                                       //每页包含的数据块数
+#define FILE_MAP_PAGES (FILE_MAP_SECTORS / FILE_MAP_PAGE_SECTORS + 1) //文件最多占用的页数
+
+//一个正在被映射的文件，以(分区, inode编号)区分
+struct file_map
+{
+    struct partition *part;             //文件所在分区
+    struct inode *inode;                //文件的inode，映射期间保持打开
+    uint32_t ref_cnt;                   //引用它的虚拟内存区域数
+    uint32_t sectors[FILE_MAP_SECTORS]; //各数据块的扇区号，建立映射时从inode读入
+    uint32_t pages[FILE_MAP_PAGES];     //已缓存的文件页的物理地址，为0表示还没有读入
+    struct lock lock;                   //读入和写回文件页时持有
+    struct list_elem map_tag;           //在所有文件映射的链表中的节点
+};
+
+void file_map_init(void);
+struct file_map *file_map_get(int32_t fd, uint32_t pgoff, uint32_t pg_cnt, bool *writable);
+void file_map_dup(struct file_map *fmap);
+void file_map_put(struct file_map *fmap);
+bool file_map_busy(struct partition *part, uint32_t inode_no);
+void file_map_read(struct file_map *fmap, uint32_t pg_idx, void *buf);
+void file_map_write(struct file_map *fmap, uint32_t pg_idx, void *buf);
+void file_map_sector_update(struct partition *part, uint32_t inode_no, uint32_t sec_idx, uint32_t sec_lba, const void *buf);
@@ -14,6 +14,8 @@
 #include "console.h"
 #include "ioqueue.h"
 #include "keyboard.h"
+#include "slab.h"
+#include "filemap.h"
 
 struct partition *current_partition; //默认情况下操作的是哪个分区
 
@@ -191,6 +193,14 @@ static bool mount_partition(struct list_elem *pelem, int arg)
         //硬盘上读入块位图到分区的block_bitmap.bits
         ide_read(hd, super_block_buf->block_bitmap_lba, current_partition->block_bitmap.bits, super_block_buf->block_bitmap_sects);
 
+        //块位图很大，建立摘要以便分配时跳过已满的区域
+        uint32_t *block_summary = (uint32_t *)sys_malloc(BITMAP_SUMMARY_LEN(current_partition->block_bitmap.btmp_bytes_len) * 4);
+        if (block_summary == NULL)
+        {
+            PANIC("alloc memory failed!\n");
+        }
+        bitmap_summary_init(&current_partition->block_bitmap, block_summary);
+
         //# 2.硬盘中读入inode位图到内存
         current_partition->inode_bitmap.bits = (uint8_t *)sys_malloc(super_block_buf->inode_bitmap_sects * SECTOR_SIZE);
         if (current_partition->inode_bitmap.bits == NULL)
@@ -225,6 +235,13 @@ void filesystem_init()
     {
         PANIC("alloc memory failed!\n");
     }
+
+    //已打开的inode和目录在内核中被所有任务共享，使用专门的缓存
+    inode_cache = kmem_cache_create("inode", sizeof(struct inode), NULL);
+    dir_cache = kmem_cache_create("dir", sizeof(struct dir), NULL);
+    shrinker_register(&inode_shrinker);
+    file_map_init();
+
     printk("searching file system...\n");
     while (channel_no < channel_cnt)
     {
@@ -519,6 +536,25 @@ static uint32_t fd_local2global(uint32_t local_fd)
     return (uint32_t)global_fd;
 }
 
+/**
+ * @brief 得到当前任务的文件描述符fd对应的文件表项
+ * @param fd 文件描述符
+ * @return 文件表项，fd不是已打开的普通文件时返回NULL
+ */
+struct file *fd2file(int32_t fd)
+{
+    if (fd <= stderr_no || fd >= MAX_FILES_OPEN_PER_PROC)
+    {
+        return NULL;
+    }
+    int32_t global_fd = running_thread()->fd_table[fd];
+    if (global_fd < 0 || global_fd >= MAX_FILE_OPEN || file_table[global_fd].fd_inode == NULL)
+    {
+        return NULL;
+    }
+    return &file_table[global_fd];
+}
+
 /**
  * @brief 关闭文件描述符fd指向的文件
  * 
@@ -671,6 +707,12 @@ int32_t sys_unlink(const char *pathname)
         printk("file %s has opened, please unlink it after it be closed!\n", pathname);
         return -1;
     }
+    if (file_map_busy(current_partition, inode_no))
+    {
+        dir_close(searched_record.parent_dir);
+        printk("file %s has mapped, please unlink it after it be unmapped!\n", pathname);
+        return -1;
+    }
     ASSERT(file_idx == MAX_FILE_OPEN);
 
     //# 3.为delete_dir_entry申请缓冲区
@@ -55,6 +55,7 @@ char *path_parse(char *pathname, char *name_store);
 int32_t sys_open(const char *pathname, uint8_t flags);
 int32_t path_depth_cnt(char *pathname);
 int32_t sys_close(int32_t fd);
+struct file *fd2file(int32_t fd);
 int32_t sys_write(int32_t fd, const void *buf, uint32_t count);
 int32_t sys_read(int32_t fd, void *buf, uint32_t count);
 
@@ -9,6 +9,7 @@
 #include "stdio-kernel.h"
 #include "string.h"
 #include "super_block.h"
+#include "slab.h"
 
 //存储inode在磁盘中位置
 struct inode_position
@@ -18,6 +19,10 @@ struct inode_position
     uint32_t off_size; //inode在所在扇区内的字节偏移量
 };
 
+struct kmem_cache *inode_cache; //已打开inode的缓存
+
+static uint32_t inode_unused_cnt = 0; //引用计数为0、仍留在open_inodes中缓存的inode数
+
 /**
  * @brief 获取inode所在的扇区和扇区内的偏移量
  * @param part 扇区地址
@@ -105,6 +110,8 @@ void inode_sync(struct partition *part, struct inode *inode, void *io_buf)
 struct inode *inode_open(struct partition *part, uint32_t inode_no)
 {
     //# 1.遍历链表，找到inode节点号之后返回
+    //关中断，以免找到的缓存inode在增加引用计数之前被收缩器释放
+    enum intr_status old_status = intr_disable();
     struct list_elem *elem = part->open_inodes.head.next;
     struct inode *inode_found;
     while (elem != &part->open_inodes.tail)
@@ -112,23 +119,24 @@ struct inode *inode_open(struct partition *part, uint32_t inode_no)
         inode_found = elem2entry(struct inode, inode_tag, elem);
         if (inode_found->inode_no == inode_no)
         {
-            inode_found->inode_open_cnts++;
+            //引用计数为0的是缓存着的inode，重新打开不用读磁盘
+            if (inode_found->inode_open_cnts++ == 0)
+            {
+                inode_unused_cnt--;
+            }
+            intr_set_status(old_status);
             return inode_found;
         }
         elem = elem->next;
     }
+    intr_set_status(old_status);
 
     //# 2.在内存中没有，那就去磁盘中打开
     struct inode_position inode_pos;
     inode_locate(part, inode_no, &inode_pos);
 
-    struct task_struct *current_thread = running_thread();
-    uint32_t *current_pagedir_back = current_thread->pgdir;
-    current_thread->pgdir = NULL;
-
-    //分配内存空间,因为pgdir=NULL，所以inode实际上是在内核内存池被分配
-    inode_found = (struct inode *)sys_malloc(sizeof(struct inode));
-    current_thread->pgdir = current_pagedir_back;
+    //inode要被所有任务共享，从内核的inode缓存中分配
+    inode_found = (struct inode *)kmem_cache_alloc(inode_cache);
 
     char *inode_buf;
     if (inode_pos.two_sec)
@@ -156,7 +164,7 @@ struct inode *inode_open(struct partition *part, uint32_t inode_no)
 /**
  * @brief 关闭inode或者减少inode打开次数
  * @param inode 待关闭的inode
- * @note 引用计数，为0才真正关闭
+ * @note 引用计数为0时仍留在open_inodes中缓存，内存紧张时才由收缩器释放
  * @note 必须为原子操作
  */
 void inode_close(struct inode *inode)
@@ -165,16 +173,67 @@ void inode_close(struct inode *inode)
 
     if (--inode->inode_open_cnts == 0)
     {
-        list_remove(&inode->inode_tag);
-        struct task_struct *current_thread = running_thread();
-        uint32_t *current_pgdir_back = current_thread->pgdir;
-        current_thread->pgdir = NULL;
-        sys_free(inode);
-        current_thread->pgdir = current_pgdir_back;
+        inode_unused_cnt++;
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 缓存着的inode数
+ * @return inode数
+ */
+static uint32_t inode_shrink_count(void)
+{
+    return inode_unused_cnt;
+}
+
+/**
+ * @brief 释放至多nr个缓存着的inode，从链表尾部最早打开的开始
+ * @param nr 最多释放的inode数
+ * @return 实际释放的inode数
+ * @note 调用者可能持有内核内存池的锁，inode_cache的锁被别人持有时直接放弃
+ */
+static uint32_t inode_shrink_scan(uint32_t nr)
+{
+    struct partition *part = current_partition;
+    if (part == NULL || !try_get_lock(&inode_cache->lock))
+    {
+        return 0;
+    }
+    if (nr > SHRINK_BATCH)
+    {
+        nr = SHRINK_BATCH;
+    }
+
+    //先关中断摘下要释放的inode，释放时可能等待内存池的锁，不能边遍历边释放
+    struct inode *victims[SHRINK_BATCH];
+    uint32_t victim_cnt = 0;
+    enum intr_status old_status = intr_disable();
+    struct list_elem *elem = part->open_inodes.tail.prev;
+    while (elem != &part->open_inodes.head && victim_cnt < nr)
+    {
+        struct inode *inode = elem2entry(struct inode, inode_tag, elem);
+        elem = elem->prev;
+        if (inode->inode_open_cnts == 0)
+        {
+            list_remove(&inode->inode_tag);
+            inode_unused_cnt--;
+            victims[victim_cnt++] = inode;
+        }
     }
     intr_set_status(old_status);
+
+    uint32_t victim_idx;
+    for (victim_idx = 0; victim_idx < victim_cnt; victim_idx++)
+    {
+        kmem_cache_free(inode_cache, victims[victim_idx]);
+    }
+    abandon_lock(&inode_cache->lock);
+    return victim_cnt;
 }
 
+struct shrinker inode_shrinker = {"inode", inode_shrink_count, inode_shrink_scan, SHRINK_PRIO_INODE, {NULL, NULL}};
+
 /**
  * @brief 初始化new_inode
  * @param inode_no inode节点号
@@ -300,5 +359,14 @@ void inode_release(struct partition *part, uint32_t inode_no)
     inode_delete(part, inode_no, io_buf);
     sys_free(io_buf);
 
+    //inode编号可能马上被重新分配，已回收的inode不能留在缓存中
+    enum intr_status old_status = intr_disable();
     inode_close(delete_inode);
+    if (delete_inode->inode_open_cnts == 0)
+    {
+        list_remove(&delete_inode->inode_tag);
+        inode_unused_cnt--;
+        kmem_cache_free(inode_cache, delete_inode);
+    }
+    intr_set_status(old_status);
 }
@@ -19,6 +19,9 @@ struct inode
     struct list_elem inode_tag; //在list链表中的标志位,这个list表示已打开的inode列表
 };
 
+extern struct kmem_cache *inode_cache;
+extern struct shrinker inode_shrinker;
+
 void inode_init(uint32_t inode_no, struct inode *new_inode);
 void inode_close(struct inode *inode);
 struct inode *inode_open(struct partition *part, uint32_t inode_no);
@@ -0,0 +1,591 @@
+#include "bench.h"
+#include "memory.h"
+#include "bitmap.h"
+#include "global.h"
+#include "debug.h"
+#include "string.h"
+#include "interrupt.h"
+#include "timer.h"
+#include "stdio-kernel.h"
+#include "thread.h"
+#include "process.h"
+#include "fork.h"
+
+/*
+ * 每个测试在内核中直接调用被测的接口，用时间戳计数器计时，结果用printk输出。
+ * 时间戳计数器的频率在第一次使用时按时钟中断校准，换算出每秒的操作数
+ */
+
+#define BENCH_CALIBRATE_TICKS 10 //校准时间戳计数器频率时等待的时钟中断数，即100ms
+
+typedef int32_t bench_func(uint32_t arg);
+
+//一个测试
+struct bench_case
+{
+    const char *name; //bench命令中的名称
+    bench_func *run;  //测试函数，参数为0时使用默认值
+    const char *help; //参数和说明
+};
+
+static uint32_t tsc_khz; //时间戳计数器的频率，单位kHz，为0表示还没有校准
+
+/**
+ * @brief 得到时间戳计数器的频率，第一次调用时用时钟中断校准
+ * @return 频率，单位kHz
+ */
+static uint32_t bench_tsc_khz(void)
+{
+    if (tsc_khz != 0)
+    {
+        return tsc_khz;
+    }
+    //系统调用中可能是关中断的，校准期间打开中断让ticks增长
+    enum intr_status old_status = intr_enable();
+    volatile uint32_t *tick = &ticks;
+    uint32_t start_tick = *tick;
+    while (*tick == start_tick)
+        ;
+    uint64_t start = rdtsc();
+    start_tick = *tick;
+    while (*tick - start_tick < BENCH_CALIBRATE_TICKS)
+        ;
+    uint64_t cycles = rdtsc() - start;
+    intr_set_status(old_status);
+
+    //BENCH_CALIBRATE_TICKS个时钟中断即BENCH_CALIBRATE_TICKS * 10毫秒
+    tsc_khz = div64_32(cycles, BENCH_CALIBRATE_TICKS * 10);
+    return tsc_khz;
+}
+
+/**
+ * @brief 输出一项测试结果
+ * @param what 测试项
+ * @param ops 完成的操作数
+ * @param cycles 总共用去的时钟周期数
+ */
+static void bench_report(const char *what, uint32_t ops, uint64_t cycles)
+{
+    uint32_t per_op = div64_32(cycles, ops);
+    uint32_t per_sec = per_op == 0 ? 0 : div64_32((uint64_t)bench_tsc_khz() * 1000, per_op);
+    printk("%s: %d ops, %d cycles/op, %d ops/s\n", what, ops, per_op, per_sec);
+}
+
+/**
+ * @brief hz测试，输出时间戳计数器的频率
+ * @param arg 不使用
+ * @return 频率，单位kHz
+ */
+static int32_t bench_hz(uint32_t arg UNUSED)
+{
+    uint32_t khz = bench_tsc_khz();
+    printk("tsc: %d kHz\n", khz);
+    return khz;
+}
+
+/**
+ * @brief 按原来位图内存池的做法逐页分配和释放，与伙伴系统对比
+ * @param frames 存放分配结果的一页缓冲区
+ * @param pg_cnt 页数
+ * @return 成功返回0，内存不足返回-1
+ * @note 位图和内核内存池一样大，先按内核内存池当前已用的页数从低端占满，模拟原来palloc时位图的状态；
+ *       分配就是bitmap_scan找一位再bitmap_set置1，释放是置0，不涉及页框本身
+ */
+static int32_t bench_page_bitmap(uint32_t *frames, uint32_t pg_cnt)
+{
+    uint32_t info_pages = DIV_ROUND_UP(sizeof(struct mem_info), PG_SIZE);
+    struct mem_info *info = get_kernel_pages(info_pages);
+    if (info == NULL)
+    {
+        return -1;
+    }
+    sys_meminfo(info);
+    uint32_t total_pages = info->kernel_pool.total_pages;
+    uint32_t used_pages = total_pages - info->kernel_pool.free_pages;
+    free_kernel_pages(info, info_pages);
+
+    struct bitmap pool_bitmap;
+    uint32_t bitmap_pages = DIV_ROUND_UP(DIV_ROUND_UP(total_pages, 8), PG_SIZE);
+    pool_bitmap.btmp_bytes_len = DIV_ROUND_UP(total_pages, 8);
+    pool_bitmap.bits = get_kernel_pages(bitmap_pages);
+    pool_bitmap.summary = NULL;
+    if (pool_bitmap.bits == NULL)
+    {
+        return -1;
+    }
+    bitmap_init(&pool_bitmap);
+    uint32_t bit_idx;
+    for (bit_idx = 0; bit_idx < used_pages; bit_idx++)
+    {
+        bitmap_set(&pool_bitmap, bit_idx, 1);
+    }
+
+    uint32_t idx;
+    uint64_t start = rdtsc();
+    for (idx = 0; idx < pg_cnt; idx++)
+    {
+        int32_t free_idx = bitmap_scan(&pool_bitmap, 1);
+        if (free_idx == -1)
+        {
+            break;
+        }
+        bitmap_set(&pool_bitmap, free_idx, 1);
+        frames[idx] = free_idx;
+    }
+    uint64_t alloc_cycles = rdtsc() - start;
+    uint32_t got = idx;
+
+    start = rdtsc();
+    for (idx = 0; idx < got; idx++)
+    {
+        bitmap_set(&pool_bitmap, frames[idx], 0);
+    }
+    uint64_t free_cycles = rdtsc() - start;
+    free_kernel_pages(pool_bitmap.bits, bitmap_pages);
+
+    if (got < pg_cnt)
+    {
+        printk("page: bitmap full after %d pages\n", got);
+        return -1;
+    }
+    printk("bitmap of %d pages, %d used, per page:\n", total_pages, used_pages);
+    bench_report("    alloc", got, alloc_cycles);
+    bench_report("    free", got, free_cycles);
+    return 0;
+}
+
+/**
+ * @brief page测试，伙伴系统逐页分配和释放内核页框的速度，再按16页的块分配和释放，
+ *        最后按原来位图内存池的做法逐页分配和释放作为对比
+ * @param arg 页数，默认1024，不超过1024
+ * @return 成功返回0，内存不足返回-1
+ */
+static int32_t bench_page(uint32_t arg)
+{
+    uint32_t pg_cnt = arg == 0 || arg > PG_SIZE / sizeof(uint32_t) ? PG_SIZE / sizeof(uint32_t) : arg;
+    uint32_t *frames = get_kernel_pages(1);
+    if (frames == NULL)
+    {
+        return -1;
+    }
+
+    uint32_t order;
+    for (order = 0; order <= 4; order += 4)
+    {
+        uint32_t blk_cnt = pg_cnt >> order;
+        uint32_t idx;
+        uint64_t start = rdtsc();
+        for (idx = 0; idx < blk_cnt; idx++)
+        {
+            frames[idx] = (uint32_t)palloc_order(PF_KERNEL, order);
+            if (frames[idx] == 0)
+            {
+                break;
+            }
+        }
+        uint64_t alloc_cycles = rdtsc() - start;
+        uint32_t got = idx;
+
+        start = rdtsc();
+        for (idx = 0; idx < got; idx++)
+        {
+            pfree(frames[idx]);
+        }
+        uint64_t free_cycles = rdtsc() - start;
+
+        if (got < blk_cnt)
+        {
+            printk("page: out of memory after %d blocks\n", got);
+            free_kernel_pages(frames, 1);
+            return -1;
+        }
+        //按页计数，order为4时每次操作16页
+        printk("order %d blocks, per page:\n", order);
+        bench_report("    alloc", got << order, alloc_cycles);
+        bench_report("    free", got << order, free_cycles);
+    }
+    int32_t ret = bench_page_bitmap(frames, pg_cnt);
+    free_kernel_pages(frames, 1);
+    return ret;
+}
+
+/**
+ * @brief 输出内核堆虚拟地址的碎片情况
+ * @param when 统计的时机
+ * @param info 用来取统计的缓冲区
+ */
+static void kva_report(const char *when, struct mem_info *info)
+{
+    sys_meminfo(info);
+    printk("%s: free pages %d, extents %d, largest %d\n", when, info->kva_free_pages, info->kva_extent_cnt,
+           info->kva_largest_pages);
+}
+
+/**
+ * @brief kva测试，交替释放1~8页的区间制造碎片，测量碎片化前后分配和释放内核虚拟地址的速度
+ * @param arg 区间数，默认256，不超过512
+ * @return 成功返回0，虚拟地址不足返回-1
+ * @note 只分配虚拟地址，不涉及页框和页表
+ */
+static int32_t bench_kva(uint32_t arg)
+{
+    //前半页存放各区间的地址，mem_info放不进内核栈，放在第二页
+    uint32_t range_cnt = arg == 0 || arg > PG_SIZE / 2 / sizeof(void *) ? 256 : arg;
+    void **ranges = get_kernel_pages(1 + DIV_ROUND_UP(sizeof(struct mem_info), PG_SIZE));
+    if (ranges == NULL)
+    {
+        return -1;
+    }
+    struct mem_info *info = (struct mem_info *)((uint32_t)ranges + PG_SIZE);
+    kva_report("before", info);
+
+    //# 1.依次分配1~8页的区间
+    uint32_t idx;
+    uint64_t start = rdtsc();
+    for (idx = 0; idx < range_cnt; idx++)
+    {
+        ranges[idx] = kernel_vaddr_get(idx % 8 + 1);
+        if (ranges[idx] == NULL)
+        {
+            break;
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+    int32_t ret = 0;
+    if (idx < range_cnt)
+    {
+        printk("kva: out of kernel vaddr after %d ranges\n", idx);
+        range_cnt = idx;
+        ret = -1;
+    }
+    bench_report("alloc 1~8 pages", range_cnt, cycles);
+
+    //# 2.释放下标为奇数的区间，留下许多小空洞
+    for (idx = 1; idx < range_cnt; idx += 2)
+    {
+        kernel_vaddr_put(ranges[idx], idx % 8 + 1);
+        ranges[idx] = NULL;
+    }
+    kva_report("fragmented", info);
+
+    //# 3.碎片化后再分配空洞放不下的16页区间
+    uint32_t big_cnt = 0;
+    start = rdtsc();
+    for (idx = 1; idx < range_cnt; idx += 2)
+    {
+        ranges[idx] = kernel_vaddr_get(16);
+        if (ranges[idx] == NULL)
+        {
+            break;
+        }
+        big_cnt++;
+    }
+    cycles = rdtsc() - start;
+    bench_report("alloc 16 pages when fragmented", big_cnt, cycles);
+
+    //# 4.全部释放，相邻区间合并回去
+    start = rdtsc();
+    for (idx = 0; idx < range_cnt; idx++)
+    {
+        if (ranges[idx] != NULL)
+        {
+            kernel_vaddr_put(ranges[idx], idx % 2 == 1 ? 16 : idx % 8 + 1);
+        }
+    }
+    cycles = rdtsc() - start;
+    bench_report("free and merge", range_cnt, cycles);
+    kva_report("after", info);
+
+    free_kernel_pages(ranges, 1 + DIV_ROUND_UP(sizeof(struct mem_info), PG_SIZE));
+    return ret;
+}
+
+/**
+ * @brief map测试，反复申请和释放1、16、512页的内核页，测量批量建立和解除映射的开销
+ * @param arg 每种页数重复的次数，默认64
+ * @return 成功返回0，内存不足返回-1
+ */
+static int32_t bench_map(uint32_t arg)
+{
+    static const uint32_t map_pages[] = {1, 16, 512};
+    uint32_t rounds = arg == 0 ? 64 : arg;
+    uint32_t case_idx;
+    for (case_idx = 0; case_idx < sizeof(map_pages) / sizeof(map_pages[0]); case_idx++)
+    {
+        uint32_t pg_cnt = map_pages[case_idx];
+        uint64_t map_cycles = 0, unmap_cycles = 0;
+        uint32_t round;
+        for (round = 0; round < rounds; round++)
+        {
+            uint64_t start = rdtsc();
+            void *vaddr = get_kernel_pages(pg_cnt);
+            uint64_t mapped = rdtsc();
+            if (vaddr == NULL)
+            {
+                printk("map: out of memory for %d pages\n", pg_cnt);
+                return -1;
+            }
+            free_kernel_pages(vaddr, pg_cnt);
+            unmap_cycles += rdtsc() - mapped;
+            map_cycles += mapped - start;
+        }
+        //按页计数，看每页平摊的开销
+        printk("%d pages per call, per page:\n", pg_cnt);
+        bench_report("    map", rounds * pg_cnt, map_cycles);
+        bench_report("    unmap", rounds * pg_cnt, unmap_cycles);
+    }
+    return 0;
+}
+
+/**
+ * @brief pingpong测试，反复申请并立即释放同一规格的一个内存块
+ * @param arg 每种大小重复的次数，默认10000
+ * @return 成功返回0，内存不足返回-1
+ * @note 在调用者的堆中分配：64字节走私有缓存，1500和5000字节是中等规格，
+ *       arena变空后被保留，下一次申请不必重新申请页框
+ */
+static int32_t bench_pingpong(uint32_t arg)
+{
+    static const uint32_t sizes[] = {64, 1500, 5000};
+    uint32_t rounds = arg == 0 ? 10000 : arg;
+    uint32_t size_idx;
+    for (size_idx = 0; size_idx < sizeof(sizes) / sizeof(sizes[0]); size_idx++)
+    {
+        uint32_t round;
+        uint64_t start = rdtsc();
+        for (round = 0; round < rounds; round++)
+        {
+            void *block = sys_malloc(sizes[size_idx]);
+            if (block == NULL)
+            {
+                printk("pingpong: out of memory for %d bytes\n", sizes[size_idx]);
+                return -1;
+            }
+            sys_free(block);
+        }
+        uint64_t cycles = rdtsc() - start;
+        printk("%d bytes ", sizes[size_idx]);
+        bench_report("malloc+free", rounds, cycles);
+    }
+    return 0;
+}
+
+#define SCAN_MAX_CHUNKS 64 //scan测试最多使用的4MB块数，即256MB
+
+static volatile uint32_t scan_sink; //scan测试的累加结果，防止读操作被优化掉
+
+/**
+ * @brief 按顺序读取各个4MB块中的每个字，直到总共读完mb MB，内存不够时循环读取
+ * @param chunks 各块的起始地址
+ * @param chunk_cnt 块数
+ * @param mb 要读取的总MB数，是4的倍数
+ * @return 用去的时钟周期数
+ */
+static uint64_t scan_chunks(void **chunks, uint32_t chunk_cnt, uint32_t mb)
+{
+    uint32_t sum = 0, scanned = 0;
+    uint64_t start = rdtsc();
+    while (scanned < mb)
+    {
+        uint32_t chunk_idx;
+        for (chunk_idx = 0; chunk_idx < chunk_cnt && scanned < mb; chunk_idx++)
+        {
+            const uint32_t *word = chunks[chunk_idx];
+            const uint32_t *end = word + LARGE_PAGE_SIZE / sizeof(uint32_t);
+            while (word < end)
+            {
+                sum += *word++;
+            }
+            scanned += LARGE_PAGE_SIZE / (1024 * 1024);
+        }
+    }
+    uint64_t cycles = rdtsc() - start;
+    scan_sink = sum;
+    return cycles;
+}
+
+/**
+ * @brief scan测试，分别用4MB大页和4KB页映射的缓冲区顺序读取，比较TLB缺失带来的差别
+ * @param arg 读取的MB数，默认64，向上取整到4的倍数
+ * @return 成功返回0，一个4MB块也分配不到时返回-1
+ * @note 缓冲区按4MB分块申请，内存池放不下全部数据时分到几块就循环读几块，
+ *       两种方式使用相同的块数；每种方式先读一遍预热，第二遍计时
+ */
+static int32_t bench_scan(uint32_t arg)
+{
+    uint32_t mb = arg == 0 ? 64 : DIV_ROUND_UP(arg, 4) * 4;
+    uint32_t want = mb / 4 > SCAN_MAX_CHUNKS ? SCAN_MAX_CHUNKS : mb / 4;
+    uint32_t chunk_pages = LARGE_PAGE_SIZE / PG_SIZE;
+    void *chunks[SCAN_MAX_CHUNKS];
+
+    //# 1.大页：每块一个页目录项
+    uint32_t chunk_cnt;
+    for (chunk_cnt = 0; chunk_cnt < want; chunk_cnt++)
+    {
+        chunks[chunk_cnt] = get_large_pages(1, false);
+        if (chunks[chunk_cnt] == NULL)
+        {
+            break;
+        }
+    }
+    if (chunk_cnt == 0)
+    {
+        printk("scan: no 4MB large page available\n");
+        return -1;
+    }
+    printk("scan %d MB over %d chunks of 4MB, per MB:\n", mb, chunk_cnt);
+    scan_chunks(chunks, chunk_cnt, mb);
+    bench_report("    4MB pages", mb, scan_chunks(chunks, chunk_cnt, mb));
+    uint32_t chunk_idx;
+    for (chunk_idx = 0; chunk_idx < chunk_cnt; chunk_idx++)
+    {
+        free_large_pages(chunks[chunk_idx], 1);
+    }
+
+    //# 2.普通页：同样的块数，每块1024个页表项
+    for (chunk_idx = 0; chunk_idx < chunk_cnt; chunk_idx++)
+    {
+        chunks[chunk_idx] = get_kernel_pages(chunk_pages);
+        if (chunks[chunk_idx] == NULL)
+        {
+            break;
+        }
+    }
+    int32_t ret = 0;
+    if (chunk_idx < chunk_cnt)
+    {
+        printk("scan: out of memory after %d chunks of 4KB pages\n", chunk_idx);
+        ret = -1;
+    }
+    else
+    {
+        scan_chunks(chunks, chunk_cnt, mb);
+        bench_report("    4KB pages", mb, scan_chunks(chunks, chunk_cnt, mb));
+    }
+    while (chunk_idx > 0)
+    {
+        free_kernel_pages(chunks[--chunk_idx], chunk_pages);
+    }
+    return ret;
+}
+
+/**
+ * @brief forkcopy设置，选择fork的复制方式，供shell中的fork测试对比
+ * @param arg 为1时fork立即复制私有页，为0时恢复写时复制
+ * @return 0
+ */
+static int32_t bench_forkcopy(uint32_t arg)
+{
+    fork_eager_copy = arg == 1;
+    printk("fork: %s\n", fork_eager_copy ? "eager copy" : "copy on write");
+    return 0;
+}
+
+static struct task_struct *kswitch_threads[2]; //kswitch测试互相让出CPU的两个内核线程，第一次测试时创建，之后一直保留
+static struct task_struct *kswitch_waiter;     //等待本轮测试结束的任务
+static uint32_t kswitch_rounds;                //本轮每个线程让出CPU的次数
+static uint32_t kswitch_running;               //本轮还没有结束的线程数
+
+/**
+ * @brief kswitch测试的内核线程，平时阻塞，被唤醒后让出CPU kswitch_rounds次，最后一个结束的线程唤醒等待者
+ * @param arg 不使用
+ * @note 内核线程不能退出，所以一直循环；递减计数、唤醒等待者和再次阻塞在同一段关中断的区间内完成
+ */
+static void kswitch_thread(void *arg UNUSED)
+{
+    intr_disable();
+    while (1)
+    {
+        thread_block(TASK_BLOCKED);
+        intr_enable();
+        uint32_t round;
+        for (round = 0; round < kswitch_rounds; round++)
+        {
+            thread_yield();
+        }
+        intr_disable();
+        if (--kswitch_running == 0)
+        {
+            thread_unblock(kswitch_waiter);
+        }
+    }
+}
+
+/**
+ * @brief kswitch测试，两个内核线程互相让出CPU，测量内核线程之间切换的开销
+ * @param arg 每个线程让出CPU的次数，默认10000
+ * @return 0
+ * @note 内核线程沿用上一个任务的页目录，切换时不应重新加载CR3，同时输出CR3加载和省去的次数；
+ *       就绪队列中的其他任务也会插进来运行，结果是上限
+ */
+static int32_t bench_kswitch(uint32_t arg)
+{
+    uint32_t idx;
+    if (kswitch_threads[0] == NULL)
+    {
+        for (idx = 0; idx < 2; idx++)
+        {
+            kswitch_threads[idx] = thread_start("kswitch", default_prio, kswitch_thread, NULL);
+        }
+    }
+    //等两个线程都阻塞之后才能唤醒它们
+    for (idx = 0; idx < 2; idx++)
+    {
+        while (kswitch_threads[idx]->task_status != TASK_BLOCKED)
+        {
+            thread_yield();
+        }
+    }
+
+    uint32_t load_cnt, skip_cnt, load_end, skip_end;
+    enum intr_status old_status = intr_disable();
+    kswitch_rounds = arg == 0 ? 10000 : arg;
+    kswitch_running = 2;
+    kswitch_waiter = running_thread();
+    page_dir_switch_stat(&load_cnt, &skip_cnt);
+    uint64_t start = rdtsc();
+    thread_unblock(kswitch_threads[0]);
+    thread_unblock(kswitch_threads[1]);
+    thread_block(TASK_BLOCKED);
+    uint64_t cycles = rdtsc() - start;
+    page_dir_switch_stat(&load_end, &skip_end);
+    intr_set_status(old_status);
+
+    bench_report("kernel thread switch", kswitch_rounds * 2, cycles);
+    printk("cr3 loads %d, skips %d\n", load_end - load_cnt, skip_end - skip_cnt);
+    return 0;
+}
+
+static struct bench_case bench_cases[] = {
+    {"hz", bench_hz, "tsc frequency in kHz"},
+    {"page", bench_page, "[pages] buddy vs bitmap alloc/free pages per second"},
+    {"kva", bench_kva, "[ranges] kernel vaddr alloc/free and fragmentation"},
+    {"map", bench_map, "[rounds] map/unmap 1, 16 and 512 kernel pages"},
+    {"pingpong", bench_pingpong, "[rounds] malloc and free one block repeatedly"},
+    {"scan", bench_scan, "[MB] sequential read with 4MB pages vs 4KB pages"},
+    {"forkcopy", bench_forkcopy, "[1|0] fork copies private pages eagerly or on write"},
+    {"kswitch", bench_kswitch, "[rounds] context switch between two kernel threads"},
+};
+
+/**
+ * @brief 运行名为name的测试，bench系统调用的实现
+ * @param name 测试名称，为NULL或找不到时列出所有测试
+ * @param arg 测试的参数，为0时使用默认值
+ * @return 测试的返回值，找不到测试时返回-1
+ */
+int32_t sys_bench(const char *name, uint32_t arg)
+{
+    uint32_t idx;
+    for (idx = 0; name != NULL && idx < sizeof(bench_cases) / sizeof(bench_cases[0]); idx++)
+    {
+        if (!strcmp(name, bench_cases[idx].name))
+        {
+            return bench_cases[idx].run(arg);
+        }
+    }
+    for (idx = 0; idx < sizeof(bench_cases) / sizeof(bench_cases[0]); idx++)
+    {
+        printk("    %s  %s\n", bench_cases[idx].name, bench_cases[idx].help);
+    }
+    return -1;
+}
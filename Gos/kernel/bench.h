@@ -0,0 +1,37 @@
+//内存管理和任务切换的微基准测试，由shell的bench命令通过bench系统调用运行
+#pragma once
+#include "stdint.h"
+
+/**
+ * @brief 读取CPU的时间戳计数器
+ * @return 上电以来的时钟周期数
+ */
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc"
+                 : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * @brief 64位数除以32位数，不依赖libgcc的64位除法
+ * @param n 被除数
+ * @param d 除数，不为0
+ * @return 商，超过32位时返回0xffffffff
+ */
+static inline uint32_t div64_32(uint64_t n, uint32_t d)
+{
+    uint32_t hi = (uint32_t)(n >> 32);
+    uint32_t q, r;
+    if (hi >= d)
+    {
+        return 0xffffffff;
+    }
+    asm("divl %4"
+        : "=a"(q), "=d"(r)
+        : "a"((uint32_t)n), "d"(hi), "rm"(d));
+    return q;
+}
+
+int32_t sys_bench(const char *name, uint32_t arg);
@@ -3,11 +3,14 @@
 #include "interrupt.h"
 #include "timer.h"
 #include "memory.h"
+#include "vma.h"
+#include "shm.h"
 #include "console.h"
 #include "keyboard.h"
 #include "syscall-init.h"
 #include "ide.h"
 #include "fs.h"
+#include "swap.h"
 /*
  * @brief 初始化所有模块
  */
@@ -16,7 +19,10 @@ void init_all()
     put_str("init Gos's all begin,please wait...\n");
     idt_init();        //初始化中断
     mem_init();        // 初始化内存管理系统
+    vma_init();        //初始化用户虚拟内存区域
+    shm_init();        //初始化共享内存段
     thread_init();     // 初始化线程相关结构
+    reclaim_init();    //启动内核缓存的后台回收
     timer_init();      //初始化时钟
     console_init();    //初始化终端
     keyboard_init();   //键盘驱动初始化
@@ -24,5 +30,6 @@ void init_all()
     syscall_init();    //初始化系统调用
     intr_enable();     // 后面的ide_init需要打开中断
     ide_init();        //初始化硬盘
+    swap_init();       //初始化交换分区
     filesystem_init(); //初始化文件系统
 }
\ No newline at end of file
@@ -0,0 +1,336 @@
+#include "kvaddr.h"
+#include "global.h"
+#include "debug.h"
+
+#define PG_SIZE 4096
+
+/*
+ * 空闲区间总是合并到最大，相邻两个区间之间至少隔着一个已分配的页，
+ * 所以n页的地址空间最多有n / 2 + 1个空闲区间，节点池按这个数量准备，不会用完
+ */
+
+static struct rb_root kva_addr_root;      //按地址排序的空闲区间
+static struct rb_root kva_size_root;      //按(页数, 地址)排序的空闲区间
+static struct kva_extent *kva_free_nodes; //未使用的节点，借用addr_rb.parent串成单链表
+static struct kva_stat kva_stats;         //碎片情况统计
+
+/**
+ * @brief 管理pg_cnt页的地址空间最多需要的节点数
+ * @param pg_cnt 地址空间的页数
+ * @return 节点数
+ */
+uint32_t kva_node_cnt(uint32_t pg_cnt)
+{
+    return pg_cnt / 2 + 1;
+}
+
+/**
+ * @brief 从节点池中取一个节点
+ */
+static struct kva_extent *kva_node_get(void)
+{
+    struct kva_extent *ext = kva_free_nodes;
+    ASSERT(ext != NULL);
+    kva_free_nodes = (struct kva_extent *)ext->addr_rb.parent;
+    return ext;
+}
+
+/**
+ * @brief 把节点还给节点池
+ */
+static void kva_node_put(struct kva_extent *ext)
+{
+    ext->addr_rb.parent = (struct rb_node *)kva_free_nodes;
+    kva_free_nodes = ext;
+}
+
+/**
+ * @brief 按(页数, 地址)比较两个区间
+ * @return a排在b前面返回true
+ */
+static bool kva_size_less(struct kva_extent *a, struct kva_extent *b)
+{
+    return a->pg_cnt < b->pg_cnt || (a->pg_cnt == b->pg_cnt && a->start < b->start);
+}
+
+/**
+ * @brief 把区间挂入按大小排序的树
+ */
+static void kva_size_insert(struct kva_extent *ext)
+{
+    struct rb_node **link = &kva_size_root.node;
+    struct rb_node *parent = NULL;
+    while (*link != NULL)
+    {
+        parent = *link;
+        if (kva_size_less(ext, rb_entry(struct kva_extent, size_rb, parent)))
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+        }
+    }
+    rb_link_node(&ext->size_rb, parent, link);
+    rb_insert_color(&ext->size_rb, &kva_size_root);
+}
+
+/**
+ * @brief 把区间挂入按地址排序的树
+ */
+static void kva_addr_insert(struct kva_extent *ext)
+{
+    struct rb_node **link = &kva_addr_root.node;
+    struct rb_node *parent = NULL;
+    while (*link != NULL)
+    {
+        parent = *link;
+        struct kva_extent *cur = rb_entry(struct kva_extent, addr_rb, parent);
+        if (ext->start < cur->start)
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+        }
+    }
+    rb_link_node(&ext->addr_rb, parent, link);
+    rb_insert_color(&ext->addr_rb, &kva_addr_root);
+}
+
+/**
+ * @brief 新建区间并挂入两棵树
+ */
+static void kva_extent_add(uint32_t start, uint32_t pg_cnt)
+{
+    struct kva_extent *ext = kva_node_get();
+    ext->start = start;
+    ext->pg_cnt = pg_cnt;
+    kva_addr_insert(ext);
+    kva_size_insert(ext);
+    kva_stats.extent_cnt++;
+}
+
+/**
+ * @brief 把区间从两棵树中摘下并回收节点
+ */
+static void kva_extent_del(struct kva_extent *ext)
+{
+    rb_erase(&ext->addr_rb, &kva_addr_root);
+    rb_erase(&ext->size_rb, &kva_size_root);
+    kva_node_put(ext);
+    kva_stats.extent_cnt--;
+}
+
+/**
+ * @brief 修改区间的大小，地址顺序不变，只需在按大小排序的树中重新定位
+ */
+static void kva_extent_resize(struct kva_extent *ext, uint32_t start, uint32_t pg_cnt)
+{
+    rb_erase(&ext->size_rb, &kva_size_root);
+    ext->start = start;
+    ext->pg_cnt = pg_cnt;
+    kva_size_insert(ext);
+}
+
+/**
+ * @brief 查找起始地址不大于vaddr的最后一个区间
+ * @return 找到返回区间，否则返回NULL
+ */
+static struct kva_extent *kva_find_prev(uint32_t vaddr)
+{
+    struct rb_node *node = kva_addr_root.node;
+    struct kva_extent *prev = NULL;
+    while (node != NULL)
+    {
+        struct kva_extent *ext = rb_entry(struct kva_extent, addr_rb, node);
+        if (ext->start <= vaddr)
+        {
+            prev = ext;
+            node = node->right;
+        }
+        else
+        {
+            node = node->left;
+        }
+    }
+    return prev;
+}
+
+/**
+ * @brief 更新最大空闲区间的统计
+ */
+static void kva_update_largest(void)
+{
+    struct rb_node *last = rb_last(&kva_size_root);
+    if (last == NULL)
+    {
+        kva_stats.largest_pages = 0;
+        return;
+    }
+    struct kva_extent *largest = rb_entry(struct kva_extent, size_rb, last);
+    kva_stats.largest_pages = largest->pg_cnt;
+}
+
+/**
+ * @brief 初始化内核虚拟地址分配器，开始时整个地址空间是一个空闲区间
+ * @param start 地址空间的起始地址
+ * @param pg_cnt 地址空间的页数
+ * @param nodes 节点池
+ * @param node_cnt 节点池的节点数，不能少于kva_node_cnt(pg_cnt)
+ */
+void kva_init(uint32_t start, uint32_t pg_cnt, struct kva_extent *nodes, uint32_t node_cnt)
+{
+    ASSERT(node_cnt >= kva_node_cnt(pg_cnt));
+    rb_root_init(&kva_addr_root);
+    rb_root_init(&kva_size_root);
+    kva_free_nodes = NULL;
+    while (node_cnt > 0)
+    {
+        kva_node_put(&nodes[--node_cnt]);
+    }
+
+    kva_stats.free_pages = 0;
+    kva_stats.extent_cnt = 0;
+    if (pg_cnt > 0)
+    {
+        kva_extent_add(start, pg_cnt);
+        kva_stats.free_pages = pg_cnt;
+    }
+    kva_update_largest();
+}
+
+/**
+ * @brief 分配连续pg_cnt页的内核虚拟地址
+ * @param pg_cnt 页数
+ * @return 成功返回起始地址，失败返回0
+ * @note 最佳适配，从能满足要求的最小区间的开头切下
+ */
+uint32_t kva_alloc(uint32_t pg_cnt)
+{
+    struct rb_node *node = kva_size_root.node;
+    struct kva_extent *best = NULL;
+    while (node != NULL)
+    {
+        struct kva_extent *ext = rb_entry(struct kva_extent, size_rb, node);
+        if (ext->pg_cnt >= pg_cnt)
+        {
+            best = ext;
+            node = node->left;
+        }
+        else
+        {
+            node = node->right;
+        }
+    }
+    if (pg_cnt == 0 || best == NULL)
+    {
+        return 0;
+    }
+
+    uint32_t vaddr = best->start;
+    if (best->pg_cnt == pg_cnt)
+    {
+        kva_extent_del(best);
+    }
+    else
+    {
+        kva_extent_resize(best, best->start + pg_cnt * PG_SIZE, best->pg_cnt - pg_cnt);
+    }
+    kva_stats.free_pages -= pg_cnt;
+    kva_update_largest();
+    return vaddr;
+}
+
+/**
+ * @brief 把指定的[vaddr, vaddr + pg_cnt * PG_SIZE)标记为已分配
+ * @param vaddr 起始地址，页对齐
+ * @param pg_cnt 页数
+ * @return 这段地址全部空闲返回true，否则什么也不做返回false
+ */
+bool kva_reserve(uint32_t vaddr, uint32_t pg_cnt)
+{
+    struct kva_extent *ext = kva_find_prev(vaddr);
+    uint32_t end = vaddr + pg_cnt * PG_SIZE;
+    if (pg_cnt == 0 || ext == NULL || ext->start + ext->pg_cnt * PG_SIZE < end)
+    {
+        return false;
+    }
+
+    uint32_t ext_end = ext->start + ext->pg_cnt * PG_SIZE;
+    if (ext->start == vaddr && ext_end == end)
+    {
+        kva_extent_del(ext);
+    }
+    else if (ext->start == vaddr)
+    {
+        kva_extent_resize(ext, end, (ext_end - end) / PG_SIZE);
+    }
+    else
+    {
+        //保留前半段，后面剩下的另建一个区间
+        kva_extent_resize(ext, ext->start, (vaddr - ext->start) / PG_SIZE);
+        if (ext_end > end)
+        {
+            kva_extent_add(end, (ext_end - end) / PG_SIZE);
+        }
+    }
+    kva_stats.free_pages -= pg_cnt;
+    kva_update_largest();
+    return true;
+}
+
+/**
+ * @brief 释放[vaddr, vaddr + pg_cnt * PG_SIZE)，与前后相邻的空闲区间合并
+ * @param vaddr 起始地址，页对齐
+ * @param pg_cnt 页数
+ */
+void kva_free(uint32_t vaddr, uint32_t pg_cnt)
+{
+    if (pg_cnt == 0)
+    {
+        return;
+    }
+    uint32_t end = vaddr + pg_cnt * PG_SIZE;
+    struct kva_extent *prev = kva_find_prev(vaddr);
+    struct rb_node *next_node = prev == NULL ? rb_first(&kva_addr_root) : rb_next(&prev->addr_rb);
+    struct kva_extent *next = next_node == NULL ? NULL : rb_entry(struct kva_extent, addr_rb, next_node);
+
+    //不允许重复释放
+    ASSERT(prev == NULL || prev->start + prev->pg_cnt * PG_SIZE <= vaddr);
+    ASSERT(next == NULL || end <= next->start);
+
+    bool merge_prev = prev != NULL && prev->start + prev->pg_cnt * PG_SIZE == vaddr;
+    bool merge_next = next != NULL && next->start == end;
+    if (merge_prev && merge_next)
+    {
+        uint32_t total = prev->pg_cnt + pg_cnt + next->pg_cnt;
+        kva_extent_del(next);
+        kva_extent_resize(prev, prev->start, total);
+    }
+    else if (merge_prev)
+    {
+        kva_extent_resize(prev, prev->start, prev->pg_cnt + pg_cnt);
+    }
+    else if (merge_next)
+    {
+        kva_extent_resize(next, vaddr, next->pg_cnt + pg_cnt);
+    }
+    else
+    {
+        kva_extent_add(vaddr, pg_cnt);
+    }
+    kva_stats.free_pages += pg_cnt;
+    kva_update_largest();
+}
+
+/**
+ * @brief 得到内核虚拟地址的碎片情况
+ * @param stat 输出的统计信息
+ */
+void kva_get_stat(struct kva_stat *stat)
+{
+    *stat = kva_stats;
+}
@@ -0,0 +1,29 @@
+//内核堆虚拟地址的分配，空闲地址按连续区间管理
+#pragma once
+#include "stdint.h"
+#include "global.h"
+#include "rbtree.h"
+
+//一段连续的空闲内核虚拟地址[start, start + pg_cnt * PG_SIZE)
+struct kva_extent
+{
+    uint32_t start;         //起始地址
+    uint32_t pg_cnt;        //页数
+    struct rb_node addr_rb; //按地址排序的树中的节点，用于合并
+    struct rb_node size_rb; //按(页数, 地址)排序的树中的节点，用于最佳适配
+};
+
+//碎片情况统计
+struct kva_stat
+{
+    uint32_t free_pages;    //空闲页总数
+    uint32_t extent_cnt;    //空闲区间数量
+    uint32_t largest_pages; //最大空闲区间的页数
+};
+
+uint32_t kva_node_cnt(uint32_t pg_cnt);
+void kva_init(uint32_t start, uint32_t pg_cnt, struct kva_extent *nodes, uint32_t node_cnt);
+uint32_t kva_alloc(uint32_t pg_cnt);
+bool kva_reserve(uint32_t vaddr, uint32_t pg_cnt);
+void kva_free(uint32_t vaddr, uint32_t pg_cnt);
+void kva_get_stat(struct kva_stat *stat);
@@ -31,9 +31,12 @@ void init(void)
 {
     uint32_t ret_pid = fork();
     if (ret_pid)
-    { // 父进程
+    { // 父进程，回收所有退出的子进程，包括过继过来的孤儿进程
+        int32_t status;
         while (1)
-            ;
+        {
+            wait(&status);
+        }
     }
     else
     { // 子进程
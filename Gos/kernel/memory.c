@@ -8,731 +8,3007 @@
 #include "sync.h"
 #include "stdio.h" //TODO delete
 #include "interrupt.h"
+#include "vma.h"
+#include "kvaddr.h"
+#include "process.h"
+#include "filemap.h"
+#include "swap.h"
+#include "slab.h"
+#include "wait_exit.h"
 
 #define PG_SIZE 4096 //定义页大小
 
 /*
- * 0xc009f000为内核主线程栈顶，0xc009e000是内核主线程的pcb
- * 一个页框大小的位图可表示128MB的内存，位图位置安排在地址0xc009a000
- * 0xc009a000~0xc009b000这样的空间大小称之为一个页框，总共4096字节，其中每一位可以
- * 表示4k大小的一个页。每字节可以表示32k大小，4096字节可以表示128MB的空间。
- * 像这样的页框到0xc009e00总共有4个，所以可以表示512MB的空间
+ * 0xc0000000表示内核开始的1G虚拟空间，由于低端1M空间有他用，
+ * 所以从0xc0100000开始，最前面依次存放页框描述符数组frame_table和内核虚拟地址分配器的节点池
  */
-#define MEM_BITMAP_BASE 0xc009a000
+#define K_HEAP_START 0xc0100000
 
 /*
- * 0xc0000000表示内核开始的1G虚拟空间，由于低端1M空间有他用，
- * 所以从0xc0100000开始
+ * 内核空间的最后一段是直接映射区，物理地址phy映射在DIRECT_MAP_START + phy，
+ * 访问任意地址空间的页框和页表都不用切换CR3或者临时映射；
+ * 最后一个页目录项指向页目录自身，直接映射区只能到0xffc00000为止，更高的物理内存通过临时映射窗口访问
  */
-#define K_HEAP_START 0xc0100000
+#define DIRECT_MAP_START 0xe0000000
+#define DIRECT_MAP_SIZE (0xffc00000 - DIRECT_MAP_START)
+
+#define K_HEAP_END DIRECT_MAP_START //内核堆在直接映射区之前结束
+
+#define LARGE_PAGE_ORDER 10       //一个大页在伙伴系统中的阶
+#define KERNEL_PGDIR_PHY 0x100000 //内核页目录的物理地址，其后依次是loader为第768~1022个页目录项建好的页表
+#define CR4_PSE 0x10             //CR4的PSE位，打开后页目录项才能映射4MB大页
+#define CPUID_PSE 0x8            //cpuid功能1的edx中表示支持PSE的位
+#define CR4_PGE 0x80             //CR4的PGE位，打开后页表项的G位才生效
+#define CPUID_PGE 0x2000         //cpuid功能1的edx中表示支持PGE的位
+
+//loader通过BIOS中断0x15的0xe820子功能得到的地址范围描述符ARDS
+#define MEM_TOTAL_ADDR 0xb00 //loader计算的内存容量
+#define ARDS_BUF_ADDR 0xb0a  //ARDS数组
+#define ARDS_NR_ADDR 0xbfe   //ARDS数量，e820失败时为0
+#define ARDS_MAX 12          //loader的缓冲区最多容纳的ARDS数量
+#define ARDS_TYPE_USABLE 1   //可被操作系统使用的内存
 
 #define PDE_IDX(addr) ((addr & 0xffc00000) >> 22)
 #define PTE_IDX(addr) ((addr & 0x003ff000) >> 12)
 
+#define TLB_FLUSH_ALL_PAGES 32 //一次解除映射超过这么多页时，重新加载CR3比逐页invlpg更快
+
 //内存池结构
 struct pool
 {
-    struct bitmap pool_bitmap; //用于管理物理内存
-    uint32_t phy_addr_start;   //管理的物理内存的起始地址
-    uint32_t pool_size;        //本内存池字节容量
-    struct lock lock;          //申请内存时互斥
+    uint32_t phy_addr_start;                    //管理的物理内存的起始地址
+    uint32_t pool_size;                         //本内存池字节容量
+    struct lock lock;                           //申请内存时互斥
+    struct list free_area[BUDDY_MAX_ORDER + 1]; //伙伴系统各阶空闲块链表
+    uint32_t free_pages;                        //空闲页框数
+    uint32_t total_pages;                       //当前归本池所有的页框数，含借入的、不含借出的
+    uint32_t reserve_pages;                     //水位线，空闲页低于此值时不再借给另一个池
+    uint32_t borrow_cnt;                        //向另一个池借入的次数
+    uint32_t peak_used;                         //使用页框数的峰值
+    uint32_t large_cnt;                         //按页分配的大内存块数
+    uint32_t large_pages;                       //大内存块占用的页数
+
+    struct list zero_list; //预先清零的页框，不在伙伴系统中，存取时关中断
+    uint32_t zero_cnt;     //zero_list中的页框数
+    uint32_t zero_hit;     //需要清零的分配直接拿到清零页框的次数
+    uint32_t zero_miss;    //需要清零的分配只能自己清零的次数
 };
 
-struct arena
+//地址范围描述符
+struct ards
 {
-    struct mem_block_desc *desc; //与此arena关联的mem_block_desc，其实也就是元信息啦
-    uint32_t cnt;                //mem_block数量
-    bool large;                  //大于1024是大请求，其cnt就表示的是页框数
+    uint32_t base_low;
+    uint32_t base_high;
+    uint32_t length_low;
+    uint32_t length_high;
+    uint32_t type;
 };
 
-struct mem_block_desc k_block_descs[MEM_DESC_CNT]; //定义7种内存块规格
-
-struct pool kernel_pool, user_pool; //生成内核内存池和用户内存池
-struct virtual_addr kernel_vaddr;   //用来给内核分配虚拟地址
-
-/**
- * @brief 初始化内存池
- * @param all_mem 内存容量
- */
-static void mem_pool_init(uint32_t all_mem)
+//一段可用的物理内存[start, end)，页对齐
+struct mem_range
 {
-    put_str("memory pool init start...\n");
-    put_str("    total memory:");
-    put_int(all_mem);
-    put_str("\n");
-    //页表大小 = 1页的页目录表+第0和第769页目录项指向同一个页表+第769~1022目录项指向254个页表，
-    //供256个页框
-    uint32_t page_table_size = PG_SIZE * 256;       //记录内核所用的页目录项和页表所占用的字节大小
-    uint32_t used_mem = page_table_size + 0x100000; //总共使用的内存
-    uint32_t free_mem = all_mem - used_mem;
-    uint16_t all_free_pages = free_mem / PG_SIZE; //剩余多少页
-
-    //计算内核和用户分别所剩的空间大小
-    uint16_t kernel_free_pages = all_free_pages / 2;
-    uint16_t user_free_pages = all_free_pages - kernel_free_pages;
-
-    //kernel bitmap的长度，以字节为单位
-    uint32_t kbm_length = kernel_free_pages / 8;
-    //user bitmap长度，以字节为单位
-    uint32_t ubm_length = user_free_pages / 8;
+    uint32_t start;
+    uint32_t end;
+};
 
-    //内核内存池起始地址
-    uint32_t kp_start = used_mem;
-    //用户内存池起始地址
-    uint32_t up_start = kp_start + kernel_free_pages * PG_SIZE;
+struct arena
+{
+    struct mem_block_desc *desc; //与此arena关联的mem_block_desc，其实也就是元信息啦
+    uint32_t cnt;                //mem_block数量
+    bool large;                  //超过最大规格是大请求，其cnt就表示的是页框数
+};
 
-    kernel_pool.phy_addr_start = kp_start;
-    kernel_pool.pool_size = kernel_free_pages * PG_SIZE;
-    kernel_pool.pool_bitmap.btmp_bytes_len = kbm_length;
+struct mem_block_desc k_block_descs[MEM_DESC_CNT]; //内核堆的各种内存块规格
 
-    user_pool.phy_addr_start = up_start;
-    user_pool.pool_size = user_free_pages * PG_SIZE;
-    user_pool.pool_bitmap.btmp_bytes_len = ubm_length;
+//中等规格arena的布局{页数, 块数}，块大小取能把arena均分成这么多块的最大16字节倍数，
+//这样arena尾部几乎没有浪费，规格之间大约按1.3倍递增：1520 2032 2720 4080 5456 8176 10912 16368
+static const uint8_t medium_layout[MEM_MEDIUM_DESC_CNT][2] = {
+    {3, 8}, {2, 4}, {2, 3}, {2, 2}, {4, 3}, {4, 2}, {8, 3}, {8, 2}};
 
-    kernel_pool.pool_bitmap.bits = (void *)MEM_BITMAP_BASE;
-    user_pool.pool_bitmap.bits = (void *)(MEM_BITMAP_BASE + kbm_length);
+struct pool kernel_pool, user_pool; //生成内核内存池和用户内存池
 
-    //输出内存池信息
-    put_str("    kernel_pool_bitmap_start:");
-    put_int((int)kernel_pool.pool_bitmap.bits);
-    put_str(" kernel_pool_phy_addr_start:");
-    put_int(kernel_pool.phy_addr_start);
-    put_str("\n");
-    put_str("    user_pool_bitmap_start:");
-    put_int((int)user_pool.pool_bitmap.bits);
-    put_str(" user_pool_phy_addr_start:");
-    put_int(user_pool.phy_addr_start);
-    put_str("\n");
+static uint32_t kmap_vaddr_start; //临时映射窗口的起始虚拟地址
+static uint32_t direct_map_end;   //物理地址低于此值的页框都在直接映射区中
+static struct list pgdir_list;    //所有进程的页目录，以页目录所在页框描述符的free_elem串起来
+static bool pse_enabled = false;  //CPU支持4MB大页并已打开CR4的PSE位
+static uint32_t pg_global = 0;    //内核空间的映射要加上的G位，CPU不支持PGE时为0
+static uint32_t zero_page_phyaddr; //所有进程共享的只读零页
 
-    //位图置为0，内存初始化
-    bitmap_init(&kernel_pool.pool_bitmap);
-    bitmap_init(&user_pool.pool_bitmap);
+struct page_frame *frame_table; //页框描述符数组，下标为物理页框号
+uint32_t max_pfn;               //物理页框总数
 
-    //初始化锁
-    lock_init(&kernel_pool.lock);
-    lock_init(&user_pool.lock);
+static struct mem_range mem_ranges[ARDS_MAX]; //按地址排序且互不相交的可用物理内存
+static uint32_t mem_range_cnt;
 
-    //初始化内核虚拟地址的位图，按照实际物理内存大小生成数组
-    //用于维护内核堆的虚拟地址，所以和内核内存池大小一致
-    kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kbm_length;
+static struct list shrinker_list;          //已注册的收缩器，按优先级排序
+static struct task_struct *reclaim_thread; //后台回收线程
+static bool reclaim_idle = false;          //后台回收线程是否在等待唤醒
 
-    //位图的数组指向一块未使用的内存，定位在内核内存池和用户内存池之外
-    kernel_vaddr.vaddr_bitmap.bits = (void *)(MEM_BITMAP_BASE + kbm_length + ubm_length);
-    kernel_vaddr.vaddr_start = K_HEAP_START;
-    bitmap_init(&kernel_vaddr.vaddr_bitmap);
-    put_str("memory pool init done!\n");
+/**
+ * @brief 由页框描述符得到物理地址
+ * @param frame 页框描述符
+ * @return 物理地址
+ */
+static uint32_t frame2phy(struct page_frame *frame)
+{
+    return (uint32_t)(frame - frame_table) * PG_SIZE;
 }
 
 /**
- * @brief 内存管理部分初始化入口
+ * @brief 由物理地址得到页框描述符
+ * @param pg_phyaddr 物理地址
+ * @return 页框描述符
  */
-void mem_init()
+struct page_frame *phy2frame(uint32_t pg_phyaddr)
 {
-    put_str("memory init statr!\n");
-    //从物理地址0xb00处取值，这个是之前在loader.S中计算过的
-    uint32_t mem_bytes_total = (*(uint32_t *)(0xb00));
-    mem_pool_init(mem_bytes_total);
-    block_desc_init(k_block_descs);
-    put_str("memory init done!\n");
+    ASSERT(pg_phyaddr / PG_SIZE < max_pfn);
+    return &frame_table[pg_phyaddr / PG_SIZE];
 }
 
 /**
- * @brief 根据标记pf从内核/用户内存空间中得到pg_cnt块内存
- * @param pf pool_flags结构体，用于标记是内核空间还是用户空间
- * @param pg_cnt 内存块数量
- * @return 得到内存块集合的起始地址
+ * @brief 判断页框当前是否归内存池m_pool所有
+ * @param m_pool 内存池
+ * @param frame 页框描述符
+ * @return 属于返回true
+ * @note 页框可以在两个池之间出借，归属看PFF_USER标记而不是物理地址
  */
-static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt)
+static bool pool_owns_frame(struct pool *m_pool, struct page_frame *frame)
 {
-    int vaddr_start = 0;
-    int bit_idx_start = -1;
-    uint32_t count = 0;
-
-    //内核内存池中申请空间
-    if (pf == PF_KERNEL)
-    {
-        bit_idx_start = bitmap_scan(&kernel_vaddr.vaddr_bitmap, pg_cnt);
-        if (bit_idx_start == -1)
-        {
-            put_str("bitmap_scan error!!!!\n");
-            return NULL;
-        }
-
-        //将位图置为使用状态
-        while (count < pg_cnt)
-        {
-            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + count++, 1);
-        }
-        vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
-    }
-    else //用户进程池中申请内存
+    if (frame->flags & PFF_RESERVED)
     {
-        //TODO 用户内存池，将来实现用户进程再补充
-        struct task_struct *current_thread = running_thread();
-        bit_idx_start = bitmap_scan(&current_thread->userprog_vaddr.vaddr_bitmap, pg_cnt);
-        if (bit_idx_start == -1)
-        {
-            return NULL;
-        }
-
-        while (count < pg_cnt)
-        {
-            //内存位图置为被使用
-            bitmap_set(&current_thread->userprog_vaddr.vaddr_bitmap, bit_idx_start + count++, 1);
-        }
-        //获得起始地址
-        vaddr_start = current_thread->userprog_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
-
-        //保证不进入内核区域
-        ASSERT((uint32_t)vaddr_start < (0xc0000000 - PG_SIZE));
+        return false;
     }
-    return (void *)vaddr_start;
+    return (frame->flags & PFF_USER ? &user_pool : &kernel_pool) == m_pool;
 }
 
 /**
- * @brief 得到虚拟地址vaddr对应的页表项pte的指针
- * @param vaddr 虚拟地址
- * @return 返回能够访问vaddr所在的pte的虚拟地址
+ * @brief 得到物理页框当前所属的内存池
+ * @param frame 页框描述符
+ * @return 内存池
  */
-uint32_t *pte_ptr(uint32_t vaddr)
+static struct pool *frame_pool(struct page_frame *frame)
 {
-    //1.首先处理高10位的页目录项pde索引，得到页表物理地址
-    //2.处理中间10位的pte索引，进而处理器得到普通物理页的物理地址
-    //3.把低12位作为普通物理页内的物理偏移地址，相加得到最终的物理地址
-
-    //注：页目录项的1023个元素就是页目录项的地址，1023十六进制表示是0x3ff，移到高10位便是0xffc00000
-    uint32_t *pte = (uint32_t *)(0xffc00000 +
-                                 ((vaddr & 0xffc00000) >> 10) +
-                                 PTE_IDX(vaddr) * 4);
-    return pte;
+    ASSERT(!(frame->flags & PFF_RESERVED));
+    return frame->flags & PFF_USER ? &user_pool : &kernel_pool;
 }
 
 /**
- * @brief 根据虚拟地址vaddr得到所在的页目录项pde的指针
- * @param vaddr 虚拟地址
- * @return 返回能够访问该pde的虚拟地址
+ * @brief 把以frame开始的2^order个页框作为空闲块挂入内存池，并与空闲的伙伴合并
+ * @param m_pool 内存池
+ * @param frame 块首页框
+ * @param order 块的阶
  */
-uint32_t *pde_ptr(uint32_t vaddr)
+static void buddy_free(struct pool *m_pool, struct page_frame *frame, uint8_t order)
 {
-    uint32_t *pde = (uint32_t *)((0xfffff000) + PDE_IDX(vaddr) * 4);
-    return pde;
+    uint32_t pfn = frame - frame_table;
+    ASSERT(!(frame->flags & PFF_FREE) && (pfn & ((1 << order) - 1)) == 0);
+    ASSERT(pool_owns_frame(m_pool, frame));
+    //两个池之间会互相出借，任何一方都可能操作另一方的空闲链表，所以关中断而不是只靠池的锁
+    enum intr_status old_status = intr_disable();
+    m_pool->free_pages += 1 << order;
+
+    //伙伴空闲且阶相同就合并，直到最大阶
+    while (order < BUDDY_MAX_ORDER)
+    {
+        uint32_t buddy_pfn = pfn ^ (1 << order);
+        struct page_frame *buddy = &frame_table[buddy_pfn];
+        if (buddy_pfn >= max_pfn || !pool_owns_frame(m_pool, buddy) || !(buddy->flags & PFF_FREE) || buddy->order != order)
+        {
+            break;
+        }
+        list_remove(&buddy->free_elem);
+        buddy->flags &= ~PFF_FREE;
+        pfn &= buddy_pfn; //合并后的块首是两者中较小的那个
+        order++;
+    }
+
+    frame = &frame_table[pfn];
+    frame->order = order;
+    frame->flags |= PFF_FREE;
+    list_push(&m_pool->free_area[order], &frame->free_elem);
+    intr_set_status(old_status);
 }
 
 /**
- * @brief 再m_pool中分配一个物理页并返回该物理页的地址
- * @param m_pool 一个内存池(内核/用户)的地址
- * @return 成功返回该物理页地址，失败返回NULL
+ * @brief 从内存池中分配2^order个物理上连续的页框
+ * @param m_pool 内存池
+ * @param order 块的阶
+ * @return 成功返回块首页框描述符，失败返回NULL
  */
-static void *palloc(struct pool *m_pool)
+static struct page_frame *buddy_alloc(struct pool *m_pool, uint8_t order)
 {
-    int bit_idx = bitmap_scan(&m_pool->pool_bitmap, 1); //找到一个未使用的物理页
-    if (bit_idx == -1)
+    uint8_t cur_order = order;
+    enum intr_status old_status = intr_disable();
+    //找到第一个有空闲块的阶
+    while (cur_order <= BUDDY_MAX_ORDER && list_empty(&m_pool->free_area[cur_order]))
+    {
+        cur_order++;
+    }
+    if (cur_order > BUDDY_MAX_ORDER)
     {
+        intr_set_status(old_status);
         return NULL;
     }
 
-    bitmap_set(&m_pool->pool_bitmap, bit_idx, 1); //将此位置为1
-    uint32_t page_phyaddr = ((bit_idx * PG_SIZE) + m_pool->phy_addr_start);
-    return (void *)page_phyaddr;
+    struct page_frame *frame = elem2entry(struct page_frame, free_elem, list_pop(&m_pool->free_area[cur_order]));
+    frame->flags &= ~PFF_FREE;
+
+    //大块逐级对半拆分，后一半挂回低一阶的空闲链表
+    while (cur_order > order)
+    {
+        cur_order--;
+        struct page_frame *buddy = frame + (1 << cur_order);
+        buddy->order = cur_order;
+        buddy->flags |= PFF_FREE;
+        list_push(&m_pool->free_area[cur_order], &buddy->free_elem);
+    }
+
+    frame->order = order;
+    frame->ref_cnt = 1;
+    m_pool->free_pages -= 1 << order;
+    uint32_t used = m_pool->total_pages - m_pool->free_pages - m_pool->zero_cnt;
+    if (used > m_pool->peak_used)
+    {
+        m_pool->peak_used = used;
+    }
+    intr_set_status(old_status);
+    return frame;
 }
 
 /**
- * @brief 页表中添加虚拟地址vaddr和物理地址page_phyaddr的映射
- * @param vaddr 虚拟地址
- * @param page_phyaddr 物理地址
+ * @brief m_pool中没有足够大的空闲块时，从另一个内存池借一块过来
+ * @param m_pool 借入的内存池
+ * @param order 需要的块的阶
+ * @return 借到返回true
+ * @note 优先按POOL_LEND_ORDER成块出借，另一个池太碎时退而借更小的块，但出借后空闲页不能低于它的水位线；
+ *       借来的页框改为借入方所有，此后释放时直接回到借入方，需要时再被借回去
  */
-static void page_table_add(void *vaddr_, void *page_phyaddr_)
+static bool buddy_borrow(struct pool *m_pool, uint8_t order)
 {
-    uint32_t vaddr = (uint32_t)vaddr_;
-    uint32_t page_phyaddr = (uint32_t)page_phyaddr_;
-
-    //得到页表项和页表的地址
-    uint32_t *pde = pde_ptr(vaddr);
-    uint32_t *pte = pte_ptr(vaddr);
+    struct pool *lender = m_pool == &kernel_pool ? &user_pool : &kernel_pool;
+    uint8_t lend_order = order > POOL_LEND_ORDER ? order : POOL_LEND_ORDER;
+    struct page_frame *chunk = NULL;
 
-    //先判断目录项的P位是否为1,代表是否存在再内存之中
-    if (*pde & 0x00000001)
+    enum intr_status old_status = intr_disable();
+    while (true)
     {
-        //断言此页表项不为1
-        ASSERT(!(*pte & 0x00000001));
-        if (!(*pte & 0x00000001))
+        if (lender->free_pages >= lender->reserve_pages + (1 << lend_order))
         {
-            *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+            chunk = buddy_alloc(lender, lend_order);
         }
-        else
+        if (chunk != NULL || lend_order == order)
         {
-            PANIC("pte repeat!");
-            *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+            break;
         }
+        lend_order--;
     }
-    else
+    if (chunk == NULL)
     {
-        //不存在就申请页目录项内存，建立映射
-        uint32_t pde_phyaddr = (uint32_t)palloc(&kernel_pool);
-
-        *pde = (pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+        intr_set_status(old_status);
+        return false;
+    }
 
-        //清空页表项
-        memset((void *)((int)pte & 0xfffff000), 0, PG_SIZE);
-        ASSERT(!(*pte & 0x00000001));
-        *pte = (page_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+    //整块改换归属，再作为空闲块挂入借入方
+    uint32_t pg_cnt = 1 << lend_order;
+    uint32_t idx;
+    for (idx = 0; idx < pg_cnt; idx++)
+    {
+        chunk[idx].flags ^= PFF_USER;
     }
+    chunk->ref_cnt = 0;
+    lender->total_pages -= pg_cnt;
+    m_pool->total_pages += pg_cnt;
+    m_pool->borrow_cnt++;
+    buddy_free(m_pool, chunk, lend_order);
+    intr_set_status(old_status);
+    return true;
 }
 
 /**
- * @brief 从pf所代表的内存池(内核/用户)分配pg_cnt个内存块，并返回起始地址，其中会建立页表映射
- * @param pf 代表是内核内存池还是用户内存池
- * @param pg_cnt 要分配的内存块的数量
- * @return 分配的内存的起始地址，失败返回NULL
+ * @brief 从内存池中分配2^order个页框，本池不够时向另一个池借
+ * @param m_pool 内存池
+ * @param order 块的阶
+ * @return 成功返回块首页框描述符，失败返回NULL
  */
-void *malloc_page(enum pool_flags pf, uint32_t pg_cnt)
+static struct page_frame *pool_alloc(struct pool *m_pool, uint8_t order)
 {
-    //2000表示最大内存数量，我随便写的
-    ASSERT(pg_cnt > 0 && pg_cnt < 2000);
-    void *vaddr_start = vaddr_get(pf, pg_cnt);
-    if (vaddr_start == NULL)
+    struct page_frame *frame = buddy_alloc(m_pool, order);
+    if (frame == NULL && buddy_borrow(m_pool, order))
     {
-        return NULL;
+        frame = buddy_alloc(m_pool, order);
     }
+    return frame;
+}
 
-    uint32_t vaddr = (uint32_t)vaddr_start;
-    uint32_t cnt = pg_cnt;
-    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
-
-    while (cnt-- > 0)
+/**
+ * @brief 把页框号[pfn, end_pfn)的页框按最大对齐块挂入内存池的空闲链表
+ * @param m_pool 内存池
+ * @param pfn 起始页框号
+ * @param end_pfn 结束页框号
+ */
+static void buddy_free_range(struct pool *m_pool, uint32_t pfn, uint32_t end_pfn)
+{
+    uint32_t idx;
+    for (idx = pfn; idx < end_pfn; idx++)
+    {
+        frame_table[idx].flags = m_pool == &user_pool ? PFF_USER : 0; //池内页框不再是保留状态
+    }
+    while (pfn < end_pfn)
     {
-        void *page_phyaddr = palloc(mem_pool);
-        if (page_phyaddr == NULL)
+        //取pfn处对齐且不越过区间尾的最大块
+        uint8_t order = BUDDY_MAX_ORDER;
+        while ((pfn & ((1 << order) - 1)) || pfn + (1 << order) > end_pfn)
         {
-            return NULL;
+            order--;
         }
-        page_table_add((void *)vaddr, page_phyaddr);
-        vaddr += PG_SIZE; //下一个虚拟页
+        buddy_free(m_pool, &frame_table[pfn], order);
+        pfn += 1 << order;
     }
-    return vaddr_start;
 }
 
 /**
- * @brief 在内核内存池中申请pg_cnt个内存块，返回地址
- * @param pg_cnt 申请内存块的数量
- * @return 成功返回起始地址，失败返回NULL
+ * @brief 初始化内存池的伙伴系统，把池内所有可用页框挂入空闲链表
+ * @param m_pool 内存池
+ * @note 池内的空洞保持保留状态，不会被分配，也不会参与伙伴合并
  */
-void *get_kernel_pages(uint32_t pg_cnt)
+static void buddy_init(struct pool *m_pool)
 {
-    get_lock(&kernel_pool.lock);
-    void *vaddr = malloc_page(PF_KERNEL, pg_cnt);
-    if (vaddr != NULL)
+    uint8_t order;
+    for (order = 0; order <= BUDDY_MAX_ORDER; order++)
     {
-        memset(vaddr, 0, pg_cnt * PG_SIZE);
+        list_init(&m_pool->free_area[order]);
     }
-    abandon_lock(&kernel_pool.lock);
-    return vaddr;
+    m_pool->free_pages = 0;
+    m_pool->borrow_cnt = m_pool->peak_used = 0;
+    m_pool->large_cnt = m_pool->large_pages = 0;
+    list_init(&m_pool->zero_list);
+    m_pool->zero_cnt = m_pool->zero_hit = m_pool->zero_miss = 0;
+
+    uint32_t pool_start = m_pool->phy_addr_start;
+    uint32_t pool_end = pool_start + m_pool->pool_size;
+    uint32_t idx;
+    for (idx = 0; idx < mem_range_cnt; idx++)
+    {
+        uint32_t start = mem_ranges[idx].start > pool_start ? mem_ranges[idx].start : pool_start;
+        uint32_t end = mem_ranges[idx].end < pool_end ? mem_ranges[idx].end : pool_end;
+        if (start < end)
+        {
+            buddy_free_range(m_pool, start / PG_SIZE, end / PG_SIZE);
+        }
+    }
+    m_pool->total_pages = m_pool->free_pages;
+    m_pool->reserve_pages = m_pool->total_pages >> POOL_RESERVE_SHIFT;
 }
 
 /**
- * @brief 在用户内存池中申请pg_cnt个内存块，返回地址
- * @param pg_cnt 申请内存块的数量
- * @return 成功返回起始地址，失败返回NULL
- * @note 由于可能造成多线程访问，所以需要加锁
+ * @brief 内存池建立之前，把物理地址phy_start起的pg_cnt页映射到内核虚拟地址vaddr
+ * @param vaddr 虚拟起始地址
+ * @param phy_start 物理起始地址
+ * @param pg_cnt 页数
+ * @note 0xc0100000之后的页目录项在loader中就已经存在，直接填页表项即可
  */
-void *get_user_pages(uint32_t pg_cnt)
+static void kernel_map_early(uint32_t vaddr, uint32_t phy_start, uint32_t pg_cnt)
 {
-    get_lock(&user_pool.lock);
-    void *vaddr = malloc_page(PF_USER, pg_cnt);
-    memset(vaddr, 0, pg_cnt * PG_SIZE);
-    abandon_lock(&user_pool.lock);
-    return vaddr;
+    uint32_t pg_idx;
+    for (pg_idx = 0; pg_idx < pg_cnt; pg_idx++)
+    {
+        uint32_t *pte = pte_ptr(vaddr + pg_idx * PG_SIZE);
+        *pte = (phy_start + pg_idx * PG_SIZE) | PG_US_U | PG_RW_W | PG_P_1;
+    }
 }
 
 /**
- * @brief 建立虚拟地址vaddr和物理地址在页表中的映射关系
- * @param pf 表示是内核内存池还是用户内存池
- * @param vaddr 虚拟地址
- * @return 输入的虚拟地址
+ * @brief 在物理地址phy_start处建立页框描述符数组，映射到内核堆的开头
+ * @param phy_start 数组所在的物理起始地址
+ * @return 数组所占的页数
  */
-void *get_a_page(enum pool_flags pf, uint32_t vaddr)
+static uint32_t frame_table_init(uint32_t phy_start)
 {
-    //根据pf标记选择哪个内存池
-    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+    uint32_t table_pages = DIV_ROUND_UP(max_pfn * sizeof(struct page_frame), PG_SIZE);
+    kernel_map_early(K_HEAP_START, phy_start, table_pages);
+    frame_table = (struct page_frame *)K_HEAP_START;
 
-    get_lock(&mem_pool->lock);
-    struct task_struct *current_thread = running_thread();
-    int32_t bit_idx = -1;
-    if (current_thread->pgdir != NULL && pf == PF_USER)
+    //先全部标记为保留，内存池初始化时再放入伙伴系统
+    uint32_t pfn;
+    for (pfn = 0; pfn < max_pfn; pfn++)
     {
-        //得到这个vaddr是进程页表第几项，即下标
-        bit_idx = (vaddr - current_thread->userprog_vaddr.vaddr_start) / PG_SIZE;
-        ASSERT(bit_idx > 0);
-        //标记为已使用
-        bitmap_set(&current_thread->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
+        frame_table[pfn].ref_cnt = 0;
+        frame_table[pfn].order = 0;
+        frame_table[pfn].flags = PFF_RESERVED;
     }
-    else if (current_thread->pgdir == NULL && pf == PF_KERNEL)
+    return table_pages;
+}
+
+/**
+ * @brief 记录一段可用物理内存，按地址插入mem_ranges
+ * @param start 起始物理地址
+ * @param end 结束物理地址，不包含
+ * @note 不足一页的头尾舍去
+ */
+static void mem_range_add(uint32_t start, uint32_t end)
+{
+    if (start > end - PG_SIZE || mem_range_cnt == ARDS_MAX)
     {
-        bit_idx = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
-        ASSERT(bit_idx > 0);
-        bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx, 1);
+        return;
     }
-    else
+    start = (start + PG_SIZE - 1) & 0xfffff000;
+    end &= 0xfffff000;
+    if (start >= end)
     {
-        PANIC("get_a_page: not allow kernel malloc userspace or user alloc kernelspace!\n");
+        return;
     }
 
-    void *page_phyaddr = palloc(mem_pool);
-    if (page_phyaddr == NULL)
+    uint32_t idx = mem_range_cnt++;
+    while (idx > 0 && mem_ranges[idx - 1].start > start)
     {
-        return NULL;
+        mem_ranges[idx] = mem_ranges[idx - 1];
+        idx--;
     }
-
-    page_table_add((void *)vaddr, page_phyaddr);
-    abandon_lock(&mem_pool->lock);
-    return (void *)vaddr;
+    mem_ranges[idx].start = start;
+    mem_ranges[idx].end = end;
 }
 
 /**
- * @brief 通过传入一个虚拟地址，查表得到它的物理地址
- * @param vaddr 虚拟地址
- * @return 物理地址
+ * @brief 从loader留下的ARDS中整理出所有可用的物理内存
  */
-uint32_t addr_v2p(uint32_t vaddr)
+static void mem_ranges_init(void)
 {
-    uint32_t *pte = pte_ptr(vaddr);
-    //物理页起始地址+物理页内偏移量
-    return ((*pte & 0xfffff000) + (vaddr & 0x00000fff));
-}
+    struct ards *ards = (struct ards *)ARDS_BUF_ADDR;
+    uint32_t ards_nr = *(uint16_t *)ARDS_NR_ADDR;
+    if (ards_nr > ARDS_MAX)
+    {
+        ards_nr = ARDS_MAX;
+    }
 
-/**
- * @brief 初始化内存描述符块的元信息
- * @param desc_array 待初始化的内存描述块数组
- */
-void block_desc_init(struct mem_block_desc *desc_array)
-{
-    uint16_t desc_idx;        //数组下标
-    uint16_t block_size = 16; //定义最小规格块大小16进制
+    mem_range_cnt = 0;
+    if (ards_nr == 0)
+    {
+        //e820不可用时loader只得到了内存容量，认为1MB以上全部可用
+        mem_range_add(0x100000, *(uint32_t *)MEM_TOTAL_ADDR);
+    }
 
-    for (desc_idx = 0; desc_idx < MEM_DESC_CNT; desc_idx++)
+    uint32_t idx;
+    for (idx = 0; idx < ards_nr; idx++)
     {
-        desc_array[desc_idx].block_size = block_size;
+        //没有开启PAE，4GB以上的内存访问不到
+        if (ards[idx].type != ARDS_TYPE_USABLE || ards[idx].base_high != 0)
+        {
+            continue;
+        }
+        uint32_t end = ards[idx].base_low + ards[idx].length_low;
+        if (ards[idx].length_high != 0 || end < ards[idx].base_low)
+        {
+            end = 0xfffff000; //越过4GB的部分截掉
+        }
+        mem_range_add(ards[idx].base_low, end);
+    }
 
-        //初始化其中内存块数量
-        desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
-        list_init(&desc_array[desc_idx].free_list);
-        block_size *= 2;
+    //BIOS给出的区间可能相邻甚至重叠，合并成互不相交的区间
+    uint32_t cnt = 0;
+    for (idx = 0; idx < mem_range_cnt; idx++)
+    {
+        if (cnt > 0 && mem_ranges[idx].start <= mem_ranges[cnt - 1].end)
+        {
+            if (mem_ranges[idx].end > mem_ranges[cnt - 1].end)
+            {
+                mem_ranges[cnt - 1].end = mem_ranges[idx].end;
+            }
+            continue;
+        }
+        mem_ranges[cnt++] = mem_ranges[idx];
     }
+    mem_range_cnt = cnt;
 }
 
 /**
- * @brief 返回are内存仓库中第idx个内存块的首地址
- * @param are 内存仓库地址
- * @param idx 内存块的下标
- * @return are内存仓库中第idx个内存块的首地址
+ * @brief 统计[start, end)内可用的物理页数
  */
-static struct mem_block *arena2block(struct arena *are, uint32_t idx)
+static uint32_t mem_usable_pages(uint32_t start, uint32_t end)
 {
-    return (struct mem_block *)((uint32_t)are + sizeof(struct arena) + idx * are->desc->block_size);
+    uint32_t pg_cnt = 0;
+    uint32_t idx;
+    for (idx = 0; idx < mem_range_cnt; idx++)
+    {
+        uint32_t range_start = mem_ranges[idx].start > start ? mem_ranges[idx].start : start;
+        uint32_t range_end = mem_ranges[idx].end < end ? mem_ranges[idx].end : end;
+        if (range_start < range_end)
+        {
+            pg_cnt += (range_end - range_start) / PG_SIZE;
+        }
+    }
+    return pg_cnt;
 }
 
 /**
- * @brief 返回内存块block所在的arena地址
- * @param block 内存块的地址
- * @return arena内存仓库的地址
+ * @brief 从start开始数出pg_cnt个可用物理页，得到其后的地址
+ * @param start 起始物理地址
+ * @param pg_cnt 可用页数
+ * @return 第pg_cnt个可用页之后的物理地址，可用页不够时返回最后一段可用内存的结尾
  */
-static struct arena *block2arena(struct mem_block *block)
+static uint32_t mem_usable_skip(uint32_t start, uint32_t pg_cnt)
 {
-    //block & 0xfffff000 可以得到页表的地址
-    return (struct arena *)((uint32_t)block & 0xfffff000);
+    uint32_t idx;
+    for (idx = 0; idx < mem_range_cnt; idx++)
+    {
+        if (mem_ranges[idx].end <= start)
+        {
+            continue;
+        }
+        uint32_t range_start = mem_ranges[idx].start > start ? mem_ranges[idx].start : start;
+        uint32_t range_pages = (mem_ranges[idx].end - range_start) / PG_SIZE;
+        if (pg_cnt <= range_pages)
+        {
+            return range_start + pg_cnt * PG_SIZE;
+        }
+        pg_cnt -= range_pages;
+    }
+    return mem_ranges[mem_range_cnt - 1].end;
 }
 
 /**
- * @brief 在堆中申请size字节大小的内存
+ * @brief 按e820内存布局初始化内存池
+ */
+static void mem_pool_init(void)
+{
+    put_str("memory pool init start...\n");
+    mem_ranges_init();
+    ASSERT(mem_range_cnt > 0);
+    uint32_t mem_end = mem_ranges[mem_range_cnt - 1].end;
+    put_str("    usable memory:");
+    put_int(mem_usable_pages(0, mem_end) * PG_SIZE);
+    put_str(" ranges:");
+    put_int(mem_range_cnt);
+    put_str(" end:");
+    put_int(mem_end);
+    put_str("\n");
+    //页表大小 = 1页的页目录表+第0和第769页目录项指向同一个页表+第769~1022目录项指向254个页表，
+    //供256个页框
+    uint32_t page_table_size = PG_SIZE * 256;       //记录内核所用的页目录项和页表所占用的字节大小
+    uint32_t used_mem = page_table_size + 0x100000; //总共使用的内存
+
+    //页表之后紧接着存放页框描述符数组，覆盖到最后一个可用页框
+    max_pfn = mem_end / PG_SIZE;
+    uint32_t frame_table_pages = frame_table_init(used_mem);
+    used_mem += frame_table_pages * PG_SIZE;
+
+    //内核内存池的页都要在内核堆中有虚拟地址，所以不能超过内核堆的容量，多出的内存都给用户
+    //内核池可以向用户池借页框，内核堆按所有剩余内存准备虚拟地址
+    uint32_t kheap_limit = (K_HEAP_END - K_HEAP_START) / PG_SIZE - frame_table_pages;
+    uint32_t kheap_pages = mem_usable_pages(used_mem, mem_end);
+    if (kheap_pages > kheap_limit)
+    {
+        kheap_pages = kheap_limit;
+    }
+
+    //接着是内核虚拟地址分配器的节点池，按内核堆最多的页数准备
+    uint32_t kva_nodes = kva_node_cnt(kheap_pages);
+    uint32_t kva_node_pages = DIV_ROUND_UP(kva_nodes * sizeof(struct kva_extent), PG_SIZE);
+    struct kva_extent *kva_node_pool = (struct kva_extent *)(K_HEAP_START + frame_table_pages * PG_SIZE);
+    kernel_map_early((uint32_t)kva_node_pool, used_mem, kva_node_pages);
+    used_mem += kva_node_pages * PG_SIZE;
+    kheap_limit -= kva_node_pages;
+    if (kheap_pages > kheap_limit)
+    {
+        kheap_pages = kheap_limit;
+    }
+
+    //页表、frame_table和节点池是直接按物理地址连续摆放的，必须都落在可用内存中
+    ASSERT(mem_usable_pages(0x100000, used_mem) == (used_mem - 0x100000) / PG_SIZE);
+
+    uint32_t all_free_pages = mem_usable_pages(used_mem, mem_end); //剩余多少页
+
+    //计算内核和用户分别所剩的页数
+    uint32_t kernel_free_pages = all_free_pages / 2;
+    if (kernel_free_pages > kheap_limit)
+    {
+        kernel_free_pages = kheap_limit;
+    }
+    uint32_t user_free_pages = all_free_pages - kernel_free_pages;
+
+    //内核内存池起始地址
+    uint32_t kp_start = used_mem;
+    //用户内存池起始地址，两个池的范围中都可能夹着不可用的空洞
+    uint32_t up_start = mem_usable_skip(kp_start, kernel_free_pages);
+
+    kernel_pool.phy_addr_start = kp_start;
+    kernel_pool.pool_size = up_start - kp_start;
+
+    user_pool.phy_addr_start = up_start;
+    user_pool.pool_size = mem_end - up_start;
+
+    //输出内存池信息
+    put_str("    frame_table_start:");
+    put_int((int)frame_table);
+    put_str(" frame_table_pages:");
+    put_int(frame_table_pages);
+    put_str("\n");
+    put_str("    kernel_pool_phy_addr_start:");
+    put_int(kernel_pool.phy_addr_start);
+    put_str(" pages:");
+    put_int(kernel_free_pages);
+    put_str(" user_pool_phy_addr_start:");
+    put_int(user_pool.phy_addr_start);
+    put_str(" pages:");
+    put_int(user_free_pages);
+    put_str("\n");
+
+    //可用页框放入伙伴系统
+    buddy_init(&kernel_pool);
+    buddy_init(&user_pool);
+
+    //初始化锁
+    lock_init(&kernel_pool.lock);
+    lock_init(&user_pool.lock);
+
+    //内核堆开头已被frame_table和节点池占用
+    kva_init((uint32_t)kva_node_pool + kva_node_pages * PG_SIZE, kheap_pages, kva_node_pool, kva_nodes);
+    put_str("memory pool init done!\n");
+}
+
+/**
+ * @brief 根据标记pf从内核/用户内存空间中得到pg_cnt块内存
+ * @param pf pool_flags结构体，用于标记是内核空间还是用户空间
+ * @param pg_cnt 内存块数量
+ * @return 得到内存块集合的起始地址
+ */
+static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt)
+{
+    uint32_t vaddr_start = 0;
+
+    //内核内存池中申请空间
+    if (pf == PF_KERNEL)
+    {
+        vaddr_start = kva_alloc(pg_cnt);
+        if (vaddr_start == 0)
+        {
+            put_str("kva_alloc error!!!!\n");
+            return NULL;
+        }
+    }
+    else //用户进程池中申请内存
+    {
+        //在进程的虚拟内存区域之间找一段空隙
+        struct task_struct *current_thread = running_thread();
+        vaddr_start = vma_alloc(&current_thread->mm, pg_cnt, VM_READ | VM_WRITE);
+        if (vaddr_start == 0)
+        {
+            return NULL;
+        }
+
+        //保证不进入内核区域
+        ASSERT((uint32_t)vaddr_start < (0xc0000000 - PG_SIZE));
+    }
+    return (void *)vaddr_start;
+}
+
+/**
+ * @brief 在虚拟地址池中释放vaddr起始的pg_cnt个虚拟页地址
+ * @param pf 标记是内核还是用户虚拟地址池
+ * @param vaddr_  起始地址
+ * @param pg_cnt 虚拟地址页的个数
+ */
+static void vaddr_remove(enum pool_flags pf, void *vaddr_, uint32_t pg_cnt)
+{
+    uint32_t vaddr = (uint32_t)vaddr_;
+
+    if (pf == PF_KERNEL)
+    {
+        //归还给内核虚拟地址分配器，与相邻的空闲区间合并
+        kva_free(vaddr, pg_cnt);
+    }
+    else
+    {
+        //用户虚拟内存池
+        struct task_struct *current_thread = running_thread();
+        vma_unmap(&current_thread->mm, vaddr, pg_cnt);
+    }
+}
+
+/**
+ * @brief 得到虚拟地址vaddr对应的页表项pte的指针
+ * @param vaddr 虚拟地址
+ * @return 返回能够访问vaddr所在的pte的虚拟地址
+ */
+uint32_t *pte_ptr(uint32_t vaddr)
+{
+    //1.首先处理高10位的页目录项pde索引，得到页表物理地址
+    //2.处理中间10位的pte索引，进而处理器得到普通物理页的物理地址
+    //3.把低12位作为普通物理页内的物理偏移地址，相加得到最终的物理地址
+
+    //注：页目录项的1023个元素就是页目录项的地址，1023十六进制表示是0x3ff，移到高10位便是0xffc00000
+    uint32_t *pte = (uint32_t *)(0xffc00000 +
+                                 ((vaddr & 0xffc00000) >> 10) +
+                                 PTE_IDX(vaddr) * 4);
+    return pte;
+}
+
+/**
+ * @brief 根据虚拟地址vaddr得到所在的页目录项pde的指针
+ * @param vaddr 虚拟地址
+ * @return 返回能够访问该pde的虚拟地址
+ */
+uint32_t *pde_ptr(uint32_t vaddr)
+{
+    uint32_t *pde = (uint32_t *)((0xfffff000) + PDE_IDX(vaddr) * 4);
+    return pde;
+}
+
+/**
+ * @brief 从m_pool预先清零的页框中取一个
+ * @param m_pool 内存池
+ * @return 成功返回页框描述符，没有返回NULL
+ */
+static struct page_frame *zero_stock_take(struct pool *m_pool)
+{
+    struct page_frame *frame = NULL;
+    enum intr_status old_status = intr_disable();
+    if (!list_empty(&m_pool->zero_list))
+    {
+        struct list_elem *elem = list_pop(&m_pool->zero_list);
+        frame = elem2entry(struct page_frame, free_elem, elem);
+        m_pool->zero_cnt--;
+    }
+    intr_set_status(old_status);
+    return frame;
+}
+
+/**
+ * @brief 把一页内存清零，按4字节一次写入
+ * @param page 页的虚拟地址，页对齐
+ */
+static inline void page_zero(void *page)
+{
+    uint32_t dword_cnt = PG_SIZE / 4;
+    asm volatile("cld; rep stosl"
+                 : "+D"(page), "+c"(dword_cnt)
+                 : "a"(0)
+                 : "memory");
+}
+
+/**
+ * @brief 得到内存池可以立即分配的页框数，包括预先清零的页框
+ * @param m_pool 内存池
+ * @return 页框数
+ */
+static inline uint32_t pool_avail_pages(struct pool *m_pool)
+{
+    return m_pool->free_pages + m_pool->zero_cnt;
+}
+
+/**
+ * @brief 注册一个收缩器，内存紧张时按优先级被调用
+ * @param shrinker 收缩器，由注册者静态分配，注册后不能注销
+ */
+void shrinker_register(struct shrinker *shrinker)
+{
+    enum intr_status old_status = intr_disable();
+    struct list_elem *elem = shrinker_list.head.next;
+    while (elem != &shrinker_list.tail)
+    {
+        struct shrinker *registered = elem2entry(struct shrinker, shrinker_tag, elem);
+        if (registered->priority > shrinker->priority)
+        {
+            break;
+        }
+        elem = elem->next;
+    }
+    list_insert_before(elem, &shrinker->shrinker_tag);
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 按优先级依次收缩已注册的缓存，直到内核内存池多出pg_cnt个可用页框或者没有可收缩的了
+ * @param pg_cnt 希望回收的页数
+ * @return 内核内存池实际多出的页数
+ * @note 对象回收后所在的页不一定马上空出来，因此以内存池可用页框的增量衡量进展
+ */
+uint32_t shrink_caches(uint32_t pg_cnt)
+{
+    uint32_t avail_start = pool_avail_pages(&kernel_pool);
+    uint32_t freed = 0;
+    struct list_elem *elem = shrinker_list.head.next;
+    while (elem != &shrinker_list.tail && freed < pg_cnt)
+    {
+        struct shrinker *shrinker = elem2entry(struct shrinker, shrinker_tag, elem);
+        while (freed < pg_cnt && shrinker->count() > 0 && shrinker->scan(SHRINK_BATCH) > 0)
+        {
+            uint32_t avail = pool_avail_pages(&kernel_pool);
+            freed = avail > avail_start ? avail - avail_start : 0;
+        }
+        elem = elem->next;
+    }
+    return freed;
+}
+
+/**
+ * @brief 内核堆中保留的全空arena占用的页数
+ * @return 页数
+ */
+static uint32_t arena_shrink_count(void)
+{
+    uint32_t pg_cnt = 0;
+    uint32_t desc_idx;
+    for (desc_idx = 0; desc_idx < MEM_DESC_CNT; desc_idx++)
+    {
+        pg_cnt += k_block_descs[desc_idx].empty_cnt * k_block_descs[desc_idx].arena_pages;
+    }
+    return pg_cnt;
+}
+
+/**
+ * @brief 归还内核堆中保留的全部全空arena
+ * @param nr 不使用，全空arena不含数据，一次全部归还
+ * @return 归还的页数
+ */
+static uint32_t arena_shrink_scan(uint32_t nr UNUSED)
+{
+    get_lock(&kernel_pool.lock);
+    uint32_t pg_cnt = arena_reclaim(PF_KERNEL);
+    abandon_lock(&kernel_pool.lock);
+    return pg_cnt;
+}
+
+static struct shrinker arena_shrinker = {"arena", arena_shrink_count, arena_shrink_scan, SHRINK_PRIO_ARENA, {NULL, NULL}};
+
+/**
+ * @brief 内核内存池低于水位线时唤醒后台回收线程
+ */
+static void reclaim_wakeup(void)
+{
+    enum intr_status old_status = intr_disable();
+    //只唤醒在等待工作的回收线程，它在等锁时也是阻塞状态，不能被这里唤醒
+    if (reclaim_idle)
+    {
+        reclaim_idle = false;
+        thread_unblock(reclaim_thread);
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 后台回收线程，被唤醒后收缩内核缓存，直到内核内存池回到水位线以上
+ */
+static void reclaim_func(void *arg UNUSED)
+{
+    while (1)
+    {
+        enum intr_status old_status = intr_disable();
+        reclaim_idle = true;
+        thread_block(TASK_BLOCKED);
+        intr_set_status(old_status);
+
+        //没有可收缩的缓存时也停下，等下一次唤醒再试
+        while (pool_avail_pages(&kernel_pool) < kernel_pool.reserve_pages && shrink_caches(SHRINK_BATCH) > 0)
+            ;
+    }
+}
+
+/**
+ * @brief 注册内存管理自己的收缩器并启动后台回收线程
+ * @note 需要在thread_init之后调用
+ */
+void reclaim_init(void)
+{
+    shrinker_register(&arena_shrinker);
+    shrinker_register(&kmem_shrinker);
+    reclaim_thread = thread_start("kreclaimd", 10, reclaim_func, NULL);
+}
+
+/**
+ * @brief 再m_pool中分配一个物理页并返回该物理页的地址
+ * @param m_pool 一个内存池(内核/用户)的地址，调用者已持有其锁
+ * @return 成功返回该物理页地址，失败返回NULL
+ * @note 用户内存池借不到页框时换出一批用户页再试，内核内存池则收缩内核缓存再试
+ * @note 内核内存池低于水位线时唤醒后台回收线程
+ */
+static void *palloc(struct pool *m_pool)
+{
+    struct page_frame *frame = buddy_alloc(m_pool, 0); //从伙伴系统取一个页框
+    if (frame == NULL)
+    {
+        //伙伴系统用完时先动用预先清零的页框，再向另一个池借
+        frame = zero_stock_take(m_pool);
+        if (frame == NULL)
+        {
+            frame = pool_alloc(m_pool, 0);
+        }
+        while (frame == NULL && m_pool == &user_pool && swap_out() > 0)
+        {
+            frame = buddy_alloc(m_pool, 0);
+        }
+        while (frame == NULL && m_pool == &kernel_pool && shrink_caches(1) > 0)
+        {
+            frame = buddy_alloc(m_pool, 0);
+        }
+        if (frame == NULL)
+        {
+            return NULL;
+        }
+    }
+    if (m_pool == &kernel_pool && pool_avail_pages(m_pool) < m_pool->reserve_pages)
+    {
+        reclaim_wakeup();
+    }
+    return (void *)frame2phy(frame);
+}
+
+/**
+ * @brief 从m_pool分配一个内容为0的物理页框，优先使用预先清零的页框
+ * @param m_pool 内存池，调用者已持有其锁
+ * @param zeroed 输出页框是否已经清零，为false时由调用者清零
+ * @return 成功返回页框物理地址，失败返回NULL
+ */
+static void *palloc_zeroed(struct pool *m_pool, bool *zeroed)
+{
+    struct page_frame *frame = zero_stock_take(m_pool);
+    enum intr_status old_status = intr_disable();
+    if (frame != NULL)
+    {
+        m_pool->zero_hit++;
+    }
+    else
+    {
+        m_pool->zero_miss++;
+    }
+    intr_set_status(old_status);
+
+    *zeroed = frame != NULL;
+    return frame != NULL ? (void *)frame2phy(frame) : palloc(m_pool);
+}
+
+/**
+ * @brief 从pf所代表的内存池中分配2^order个物理上连续的页框
+ * @param pf 内存池标记
+ * @param order 块的阶，不超过BUDDY_MAX_ORDER
+ * @return 成功返回块的物理起始地址，失败返回NULL
+ * @note 返回的块整体用pfree释放
+ */
+void *palloc_order(enum pool_flags pf, uint8_t order)
+{
+    ASSERT(order <= BUDDY_MAX_ORDER);
+    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+
+    get_lock(&mem_pool->lock);
+    struct page_frame *frame = pool_alloc(mem_pool, order);
+    abandon_lock(&mem_pool->lock);
+    return frame == NULL ? NULL : (void *)frame2phy(frame);
+}
+
+/**
+ * @brief 确保vaddr所在的页表存在，不存在时创建
+ * @param vaddr 虚拟地址
+ * @return vaddr对应的页表项的指针
+ * @note 页表项都通过页目录最后一项线性映射在0xffc00000，同一页表内的页表项是连续的
+ */
+static uint32_t *page_table_ensure(uint32_t vaddr)
+{
+    //得到页表项和页表的地址
+    uint32_t *pde = pde_ptr(vaddr);
+    uint32_t *pte = pte_ptr(vaddr);
+
+    //先判断目录项的P位是否为1,代表是否存在再内存之中
+    if (!(*pde & 0x00000001))
+    {
+        //不存在就申请页目录项内存，建立映射，页表总是从内核内存池分配
+        bool zeroed;
+        get_lock(&kernel_pool.lock);
+        uint32_t pde_phyaddr = (uint32_t)palloc_zeroed(&kernel_pool, &zeroed);
+        abandon_lock(&kernel_pool.lock);
+        if (pde_phyaddr == 0)
+        {
+            PANIC("page_table_ensure: alloc page table failed!");
+        }
+
+        *pde = (pde_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+
+        //清空页表项
+        if (!zeroed)
+        {
+            page_zero((void *)((int)pte & 0xfffff000));
+        }
+    }
+    return pte;
+}
+
+/**
+ * @brief 把页表项pte_val填入vaddr对应的页表项，页表不存在时先创建页表
+ * @param vaddr 虚拟地址
+ * @param pte_val 页表项的值
+ */
+static void page_table_set(uint32_t vaddr, uint32_t pte_val)
+{
+    uint32_t *pte = page_table_ensure(vaddr);
+
+    //断言此页表项不为1
+    if (*pte & 0x00000001)
+    {
+        PANIC("pte repeat!");
+    }
+    //内核空间在所有页目录中都相同，作为全局页在切换页目录时保留在TLB中
+    *pte = vaddr >= 0xc0000000 ? pte_val | pg_global : pte_val;
+}
+
+/**
+ * @brief 页表中添加虚拟地址vaddr和物理地址page_phyaddr的映射
+ * @param vaddr 虚拟地址
+ * @param page_phyaddr 物理地址
+ */
+static void page_table_add(void *vaddr_, void *page_phyaddr_)
+{
+    page_table_set((uint32_t)vaddr_, (uint32_t)page_phyaddr_ | PG_US_U | PG_RW_W | PG_P_1);
+}
+
+/**
+ * @brief 从m_pool分配pg_cnt个物理页框，映射到vaddr起始的连续虚拟地址
+ * @param m_pool 内存池，调用者已持有其锁
+ * @param vaddr 起始虚拟地址，页对齐且尚未映射
+ * @param pg_cnt 页数
+ * @param zero 是否需要页内容为0
+ * @return 成功返回true，失败时撤销已建立的映射并返回false
+ * @note 每4MB只检查一次页目录项，页表项按下标连续填写
+ */
+static bool page_range_map(struct pool *m_pool, uint32_t vaddr, uint32_t pg_cnt, bool zero)
+{
+    uint32_t *pte = pte_ptr(vaddr);
+    uint32_t idx = 0;
+    while (idx < pg_cnt)
+    {
+        //本页表中还剩多少个页表项
+        uint32_t cur_vaddr = vaddr + idx * PG_SIZE;
+        uint32_t batch_end = idx + 1024 - PTE_IDX(cur_vaddr);
+        if (batch_end > pg_cnt)
+        {
+            batch_end = pg_cnt;
+        }
+        page_table_ensure(cur_vaddr);
+
+        for (; idx < batch_end; idx++)
+        {
+            bool zeroed = !zero;
+            void *page_phyaddr = zero ? palloc_zeroed(m_pool, &zeroed) : palloc(m_pool);
+            if (page_phyaddr == NULL)
+            {
+                //这些页表项从未被访问过，不会在TLB中，直接清掉即可
+                while (idx-- > 0)
+                {
+                    pfree(pte[idx] & 0xfffff000);
+                    pte[idx] = 0;
+                }
+                return false;
+            }
+            ASSERT(!(pte[idx] & PG_P_1));
+            pte[idx] = (uint32_t)page_phyaddr | PG_US_U | PG_RW_W | PG_P_1 | pg_global;
+            if (!zeroed)
+            {
+                page_zero((void *)(vaddr + idx * PG_SIZE));
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 从pf所代表的内存池(内核/用户)分配pg_cnt个内存块，并返回起始地址，其中会建立页表映射
+ * @param pf 代表是内核内存池还是用户内存池
+ * @param pg_cnt 要分配的内存块的数量
+ * @param zero 是否需要内存内容为0，内核页优先使用预先清零的页框，用户页总是在第一次访问时清零
+ * @return 分配的内存的起始地址，失败返回NULL
+ */
+void *malloc_page(enum pool_flags pf, uint32_t pg_cnt, bool zero)
+{
+    //2000表示最大内存数量，我随便写的
+    ASSERT(pg_cnt > 0 && pg_cnt < 2000);
+    void *vaddr_start = vaddr_get(pf, pg_cnt);
+    if (vaddr_start == NULL)
+    {
+        return NULL;
+    }
+
+    //用户内存只保留虚拟地址，等第一次访问时由页故障分配物理页框
+    if (pf == PF_USER)
+    {
+        return vaddr_start;
+    }
+
+    if (!page_range_map(&kernel_pool, (uint32_t)vaddr_start, pg_cnt, zero))
+    {
+        vaddr_remove(pf, vaddr_start, pg_cnt);
+        return NULL;
+    }
+    return vaddr_start;
+}
+
+/**
+ * @brief 在内核内存池中申请pg_cnt个内存块，返回地址
+ * @param pg_cnt 申请内存块的数量
+ * @return 成功返回起始地址，失败返回NULL
+ */
+void *get_kernel_pages(uint32_t pg_cnt)
+{
+    get_lock(&kernel_pool.lock);
+    void *vaddr = malloc_page(PF_KERNEL, pg_cnt, true);
+    abandon_lock(&kernel_pool.lock);
+    return vaddr;
+}
+
+/**
+ * @brief 在用户内存池中申请pg_cnt个内存块，返回地址
+ * @param pg_cnt 申请内存块的数量
+ * @return 成功返回起始地址，失败返回NULL
+ * @note 由于可能造成多线程访问，所以需要加锁
+ */
+void *get_user_pages(uint32_t pg_cnt)
+{
+    //物理页框在第一次访问时才分配，且保证内容为0，无需再清零
+    get_lock(&user_pool.lock);
+    void *vaddr = malloc_page(PF_USER, pg_cnt, false);
+    abandon_lock(&user_pool.lock);
+    return vaddr;
+}
+
+/**
+ * @brief 建立虚拟地址vaddr和物理地址在页表中的映射关系
+ * @param pf 表示是内核内存池还是用户内存池
+ * @param vaddr 虚拟地址
+ * @return 输入的虚拟地址
+ */
+void *get_a_page(enum pool_flags pf, uint32_t vaddr)
+{
+    //根据pf标记选择哪个内存池
+    struct pool *mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
+
+    get_lock(&mem_pool->lock);
+    struct task_struct *current_thread = running_thread();
+    if (current_thread->pgdir != NULL && pf == PF_USER)
+    {
+        //固定地址，尚未属于任何区域时把这一页加入地址空间
+        if (vma_find(&current_thread->mm, vaddr) == NULL &&
+            vma_map(&current_thread->mm, vaddr, 1, VM_READ | VM_WRITE) == -1)
+        {
+            abandon_lock(&mem_pool->lock);
+            return NULL;
+        }
+    }
+    else if (current_thread->pgdir == NULL && pf == PF_KERNEL)
+    {
+        if (!kva_reserve(vaddr, 1))
+        {
+            PANIC("get_a_page: kernel vaddr already in use!\n");
+        }
+    }
+    else
+    {
+        PANIC("get_a_page: not allow kernel malloc userspace or user alloc kernelspace!\n");
+    }
+
+    void *page_phyaddr = palloc(mem_pool);
+    if (page_phyaddr == NULL)
+    {
+        abandon_lock(&mem_pool->lock);
+        return NULL;
+    }
+
+    page_table_add((void *)vaddr, page_phyaddr);
+    abandon_lock(&mem_pool->lock);
+    return (void *)vaddr;
+}
+
+/**
+ * @brief 通过传入一个虚拟地址，查表得到它的物理地址
+ * @param vaddr 虚拟地址
+ * @return 物理地址
+ */
+uint32_t addr_v2p(uint32_t vaddr)
+{
+    //4MB大页没有页表项，页目录项中就是大页的物理地址
+    uint32_t pde = *pde_ptr(vaddr);
+    if (pde & PG_PS)
+    {
+        return (pde & 0xffc00000) + (vaddr & 0x003fffff);
+    }
+    uint32_t *pte = pte_ptr(vaddr);
+    //物理页起始地址+物理页内偏移量
+    return ((*pte & 0xfffff000) + (vaddr & 0x00000fff));
+}
+
+/**
+ * @brief 得到物理地址在直接映射区中的虚拟地址
+ * @param phyaddr 物理地址
+ * @return 虚拟地址，物理地址超出直接映射区时返回NULL
+ */
+void *addr_p2v(uint32_t phyaddr)
+{
+    return phyaddr < direct_map_end ? (void *)(DIRECT_MAP_START + phyaddr) : NULL;
+}
+
+/**
+ * @brief 得到已映射的虚拟地址vaddr所在物理页框的描述符
+ * @param vaddr 虚拟地址
+ * @return 页框描述符
+ */
+struct page_frame *vaddr2frame(uint32_t vaddr)
+{
+    return phy2frame(addr_v2p(vaddr));
+}
+
+/**
+ * @brief 初始化内存描述符块的元信息
+ * @param desc_array 待初始化的内存描述块数组
+ */
+void block_desc_init(struct mem_block_desc *desc_array)
+{
+    uint16_t desc_idx;        //数组下标
+    uint16_t block_size = 16; //定义最小规格块大小16进制
+
+    for (desc_idx = 0; desc_idx < MEM_DESC_CNT; desc_idx++)
+    {
+        if (desc_idx < MEM_SMALL_DESC_CNT)
+        {
+            desc_array[desc_idx].block_size = block_size;
+            desc_array[desc_idx].arena_pages = 1;
+            //初始化其中内存块数量
+            desc_array[desc_idx].blocks_per_arena = (PG_SIZE - sizeof(struct arena)) / block_size;
+            block_size *= 2;
+        }
+        else
+        {
+            const uint8_t *layout = medium_layout[desc_idx - MEM_SMALL_DESC_CNT];
+            desc_array[desc_idx].arena_pages = layout[0];
+            desc_array[desc_idx].blocks_per_arena = layout[1];
+            desc_array[desc_idx].block_size = ((layout[0] * PG_SIZE - sizeof(struct arena)) / layout[1]) & ~15;
+        }
+        list_init(&desc_array[desc_idx].free_list);
+        desc_array[desc_idx].arena_cnt = 0;
+        desc_array[desc_idx].free_cnt = 0;
+        desc_array[desc_idx].empty_cnt = 0;
+    }
+}
+
+/**
+ * @brief 返回are内存仓库中第idx个内存块的首地址
+ * @param are 内存仓库地址
+ * @param idx 内存块的下标
+ * @return are内存仓库中第idx个内存块的首地址
+ */
+static struct mem_block *arena2block(struct arena *are, uint32_t idx)
+{
+    return (struct mem_block *)((uint32_t)are + sizeof(struct arena) + idx * are->desc->block_size);
+}
+
+/**
+ * @brief 返回内存块block所在的arena地址
+ * @param block 内存块的地址
+ * @return arena内存仓库的地址
+ */
+static struct arena *block2arena(struct mem_block *block)
+{
+    //用户arena的页在建立时就钉住不会被换出，这里的页表项必须存在，
+    //否则vaddr2frame会把交换槽号当成物理地址去查页框描述符
+    ASSERT((*pde_ptr((uint32_t)block) & PG_P_1) && (*pte_ptr((uint32_t)block) & PG_P_1));
+    //跨多页的arena和用户arena由页框描述符直接记录
+    struct page_frame *frame = vaddr2frame((uint32_t)block);
+    if (frame->flags & PFF_ARENA)
+    {
+        return frame->slab;
+    }
+    //block & 0xfffff000 可以得到页表的地址
+    return (struct arena *)((uint32_t)block & 0xfffff000);
+}
+
+/**
+ * @brief 初始化任务的各规格内存块私有缓存
+ * @param mag_array 待初始化的私有缓存数组
+ */
+void magazine_init(struct mem_magazine *mag_array)
+{
+    memset(mag_array, 0, sizeof(struct mem_magazine) * MEM_SMALL_DESC_CNT);
+}
+
+/**
+ * @brief 为规格desc新建一个arena，把其中所有内存块挂入desc的空闲链表
+ * @param desc 内存块规格
+ * @param PF 内存池标记
+ * @return 成功返回true
+ * @note 调用者需持有对应内存池的锁
+ */
+static bool arena_create(struct mem_block_desc *desc, enum pool_flags PF)
+{
+    //arena的元信息和每个内存块的链表节点都会重新填写，不必清零
+    struct arena *are = malloc_page(PF, desc->arena_pages, false);
+    if (are == NULL && arena_reclaim(PF) > 0)
+    {
+        //其他规格保留的全空arena归还后再试一次
+        are = malloc_page(PF, desc->arena_pages, false);
+    }
+    if (are == NULL)
+    {
+        return false;
+    }
+
+    //跨多页的arena不能由块地址按页对齐找到，在每页的页框描述符中记下所属arena，
+    //用户页要先写一次，让页故障分配好私有的页框；带标记的页不会被换出，
+    //用户arena的每一页都要标记，释放时才能安全地查页框描述符
+    if (desc->arena_pages > 1 || PF == PF_USER)
+    {
+        uint32_t pg_idx;
+        for (pg_idx = 0; pg_idx < desc->arena_pages; pg_idx++)
+        {
+            uint32_t vaddr = (uint32_t)are + pg_idx * PG_SIZE;
+            *(volatile uint8_t *)vaddr = 0;
+            struct page_frame *frame = vaddr2frame(vaddr);
+            frame->flags |= PFF_ARENA;
+            frame->slab = are;
+        }
+    }
+
+    are->desc = desc;
+    are->large = false;
+    are->cnt = desc->blocks_per_arena;
+    uint32_t block_idx;
+
+    enum intr_status old_status = intr_disable();
+    for (block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++)
+    {
+        struct mem_block *block = arena2block(are, block_idx);
+        list_append(&are->desc->free_list, &block->free_elem);
+    }
+    intr_set_status(old_status);
+    desc->arena_cnt++;
+    desc->free_cnt += desc->blocks_per_arena;
+    desc->empty_cnt++;
+    return true;
+}
+
+/**
+ * @brief 从desc的空闲链表取出一个内存块，空闲链表为空时新建arena
+ * @param desc 内存块规格
+ * @param PF 内存池标记
+ * @return 成功返回内存块，失败返回NULL
+ * @note 调用者需持有对应内存池的锁
+ */
+static struct mem_block *arena_block_get(struct mem_block_desc *desc, enum pool_flags PF)
+{
+    if (list_empty(&desc->free_list) && !arena_create(desc, PF))
+    {
+        return NULL;
+    }
+
+    struct mem_block *block = elem2entry(struct mem_block, free_elem, list_pop(&desc->free_list));
+    struct arena *are = block2arena(block);
+    ASSERT(are->cnt > 0);
+    if (are->cnt == desc->blocks_per_arena)
+    {
+        desc->empty_cnt--; //动用了保留的全空arena
+    }
+    are->cnt--; //arena中空闲块少了一个
+    desc->free_cnt--;
+    return block;
+}
+
+/**
+ * @brief 从desc的空闲链表批量取出内存块放入私有缓存，空闲链表不够时新建arena
+ * @param mag 私有缓存
+ * @param desc 内存块规格
+ * @param PF 内存池标记
+ * @note 调用者需持有对应内存池的锁
+ */
+static void magazine_refill(struct mem_magazine *mag, struct mem_block_desc *desc, enum pool_flags PF)
+{
+    while (mag->cnt < MAG_BATCH)
+    {
+        struct mem_block *block = arena_block_get(desc, PF);
+        if (block == NULL)
+        {
+            return;
+        }
+        mag->blocks[mag->cnt++] = block;
+    }
+}
+
+/**
+ * @brief 把全空的arena的内存块从空闲链表中摘下，并归还其页框
+ * @param are 全空的arena
+ * @param PF 内存池标记
+ * @note 调用者需持有对应内存池的锁
+ */
+static void arena_release(struct arena *are, enum pool_flags PF)
+{
+    struct mem_block_desc *desc = are->desc;
+    ASSERT(are->cnt == desc->blocks_per_arena);
+    desc->arena_cnt--;
+    desc->free_cnt -= desc->blocks_per_arena;
+    uint32_t block_idx;
+    for (block_idx = 0; block_idx < desc->blocks_per_arena; block_idx++)
+    {
+        list_remove(&arena2block(are, block_idx)->free_elem);
+    }
+    mfree_page(PF, are, desc->arena_pages);
+}
+
+/**
+ * @brief 把内存块放回所在arena的空闲链表，arena全部空闲时归还页框
+ * @param block 内存块
+ * @param PF 内存池标记
+ * @note 调用者需持有对应内存池的锁
+ */
+static void arena_block_put(struct mem_block *block, enum pool_flags PF)
+{
+    struct arena *are = block2arena(block);
+    struct mem_block_desc *desc = are->desc;
+    list_append(&desc->free_list, &block->free_elem);
+    desc->free_cnt++;
+
+    if (++are->cnt == desc->blocks_per_arena)
+    {
+        //保留少量全空的arena，同一规格反复分配释放时不必每次都申请和归还页框
+        if (desc->empty_cnt < ARENA_KEEP_MAX)
+        {
+            desc->empty_cnt++;
+            return;
+        }
+        arena_release(are, PF);
+    }
+}
+
+/**
+ * @brief 归还内存堆中保留的全空arena，在内存紧张时调用
+ * @param pf 内核还是用户的标记，用户表示当前进程的堆
+ * @return 归还的页数
+ * @note 调用者需持有对应内存池的锁
+ */
+uint32_t arena_reclaim(enum pool_flags pf)
+{
+    struct task_struct *cur = running_thread();
+    if (pf == PF_USER && cur->pgdir == NULL)
+    {
+        return 0;
+    }
+    struct mem_block_desc *desc_array = pf == PF_KERNEL ? k_block_descs : cur->u_block_desc;
+
+    uint32_t pg_cnt = 0;
+    uint32_t desc_idx;
+    for (desc_idx = 0; desc_idx < MEM_DESC_CNT; desc_idx++)
+    {
+        struct mem_block_desc *desc = &desc_array[desc_idx];
+        struct list_elem *elem = desc->free_list.head.next;
+        while (desc->empty_cnt > 0 && elem != &desc->free_list.tail)
+        {
+            struct arena *are = block2arena(elem2entry(struct mem_block, free_elem, elem));
+            if (are->cnt != desc->blocks_per_arena)
+            {
+                elem = elem->next;
+                continue;
+            }
+            //arena的块被摘掉后elem已不在链表中，从头再找
+            desc->empty_cnt--;
+            pg_cnt += desc->arena_pages;
+            arena_release(are, pf);
+            elem = desc->free_list.head.next;
+        }
+    }
+    return pg_cnt;
+}
+
+/**
+ * @brief 把私有缓存中最早放入的MAG_BATCH个内存块归还给arena
+ * @param mag 私有缓存
+ * @param PF 内存池标记
+ * @note 调用者需持有对应内存池的锁
+ */
+static void magazine_flush(struct mem_magazine *mag, enum pool_flags PF)
+{
+    uint32_t idx;
+    for (idx = 0; idx < MAG_BATCH; idx++)
+    {
+        arena_block_put(mag->blocks[idx], PF);
+    }
+    //剩下的内存块前移，栈顶仍是最近释放的
+    for (idx = MAG_BATCH; idx < mag->cnt; idx++)
+    {
+        mag->blocks[idx - MAG_BATCH] = mag->blocks[idx];
+    }
+    mag->cnt -= MAG_BATCH;
+}
+
+/**
+ * @brief 在堆中申请size字节大小的内存
  * @param size 申请的字节大小
  * @return 内存的首地址
  */
-void *sys_malloc(uint32_t size)
+void *sys_malloc(uint32_t size)
+{
+    enum pool_flags PF;
+    struct pool *mem_pool;
+    uint32_t pool_size;
+    struct mem_block_desc *desc;
+    struct task_struct *current_thread = running_thread();
+
+    if (current_thread->pgdir == NULL)
+    {
+        //内核线程
+        PF = PF_KERNEL;
+        pool_size = kernel_pool.pool_size;
+        mem_pool = &kernel_pool;
+        desc = k_block_descs;
+    }
+    else
+    {
+        //用户进程
+        PF = PF_USER;
+        pool_size = user_pool.pool_size;
+        mem_pool = &user_pool;
+        desc = current_thread->u_block_desc;
+    }
+
+    //如果申请内存不在内存池容量范围内，直接返回NULL
+    if (!(size > 0 && size < pool_size))
+    {
+        return NULL;
+    }
+
+    struct arena *are;
+    struct mem_block *block;
+    uint8_t desc_idx;
+    for (desc_idx = 0; desc_idx < MEM_DESC_CNT; desc_idx++)
+    {
+        if (size <= desc[desc_idx].block_size)
+        {
+            break;
+        }
+    }
+
+    //得到按页分配时的页数
+    uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE);
+    //超过最大规格，或者中等规格平摊到每块的内存不比直接按页分配省时，按页分配
+    if (desc_idx == MEM_DESC_CNT ||
+        (desc_idx >= MEM_SMALL_DESC_CNT &&
+         page_cnt * PG_SIZE <= desc[desc_idx].arena_pages * PG_SIZE / desc[desc_idx].blocks_per_arena))
+    {
+        get_lock(&mem_pool->lock);
+        //用户页第一次访问时才分配并清零，内核页优先使用预先清零的页框
+        are = malloc_page(PF, page_cnt, true);
+        if (are == NULL && arena_reclaim(PF) > 0)
+        {
+            are = malloc_page(PF, page_cnt, true);
+        }
+        if (are != NULL)
+        {
+            mem_pool->large_cnt++;
+            mem_pool->large_pages += page_cnt;
+        }
+        abandon_lock(&mem_pool->lock);
+        if (are == NULL)
+        {
+            return NULL;
+        }
+        are->desc = NULL;
+        are->cnt = page_cnt;
+        are->large = true;
+        if (PF == PF_USER)
+        {
+            //元信息所在的页在释放前要一直驻留，不能被换出
+            struct page_frame *frame = vaddr2frame((uint32_t)are);
+            frame->flags |= PFF_ARENA;
+            frame->slab = are;
+        }
+        return (void *)(are + 1);
+    }
+    else
+    {
+        //中等规格的块大、每个arena块数少，不经过私有缓存，直接加锁从arena取；
+        //私有缓存只按规格号索引，里面存着另一个内存池的块时也不能用
+        struct mem_magazine *mag = desc_idx < MEM_SMALL_DESC_CNT ? &current_thread->mem_mag[desc_idx] : NULL;
+        if (mag == NULL || (mag->cnt > 0 && mag->pf != PF))
+        {
+            get_lock(&mem_pool->lock);
+            block = arena_block_get(&desc[desc_idx], PF);
+            abandon_lock(&mem_pool->lock);
+            if (block == NULL)
+            {
+                return NULL;
+            }
+            memset(block, 0, desc[desc_idx].block_size);
+            return (void *)block;
+        }
+
+        //私有缓存为空时才加锁从arena批量补充
+        if (mag->cnt == 0)
+        {
+            mag->miss_cnt++;
+            mag->pf = PF;
+            get_lock(&mem_pool->lock);
+            magazine_refill(mag, &desc[desc_idx], PF);
+            abandon_lock(&mem_pool->lock);
+            if (mag->cnt == 0)
+            {
+                return NULL;
+            }
+        }
+        else
+        {
+            mag->hit_cnt++;
+        }
+
+        //开始分配内存块
+        block = mag->blocks[--mag->cnt];
+        memset(block, 0, desc[desc_idx].block_size);
+        return (void *)block;
+    }
+}
+
+/**
+ * @brief 将物理地址pg_phyaddr回收到物理内存池
+ * @param pg_phyaddr 物理地址，必须是分配时得到的块首地址
+ */
+void pfree(uint32_t pg_phyaddr)
+{
+    //零页永不释放
+    if (pg_phyaddr == zero_page_phyaddr)
+    {
+        return;
+    }
+
+    //页框可能是借来的，按页框当前的归属而不是物理地址还给内存池
+    struct page_frame *frame = phy2frame(pg_phyaddr);
+    ASSERT(!(frame->flags & (PFF_FREE | PFF_RESERVED)) && frame->ref_cnt > 0);
+    struct pool *mem_pool = frame_pool(frame);
+
+    //写时复制共享的页框只减少引用计数，最后一个使用者才真正释放
+    enum intr_status old_status = intr_disable();
+    if (--frame->ref_cnt == 0)
+    {
+        frame->flags &= ~PFF_ARENA;
+        buddy_free(mem_pool, frame, frame->order);
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 增加物理页框的引用计数，用于多个页表项共享同一页框
+ * @param pg_phyaddr 物理地址
+ */
+void page_frame_ref(uint32_t pg_phyaddr)
+{
+    if (pg_phyaddr == zero_page_phyaddr)
+    {
+        return;
+    }
+    struct page_frame *frame = phy2frame(pg_phyaddr);
+    enum intr_status old_status = intr_disable();
+    ASSERT(!(frame->flags & (PFF_FREE | PFF_RESERVED)) && frame->ref_cnt > 0);
+    frame->ref_cnt++;
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 刷新TLB中虚拟地址vaddr所在页的缓存
+ * @param vaddr 虚拟地址
+ */
+static inline void invlpg(uint32_t vaddr)
+{
+    asm volatile("invlpg %0" ::"m"(*(char *)vaddr)
+                 : "memory");
+}
+
+/**
+ * @brief 重新加载CR3，刷新TLB中所有的缓存
+ */
+static inline void tlb_flush_all(void)
+{
+    asm volatile("movl %%cr3, %%eax; movl %%eax, %%cr3" ::
+                     : "eax", "memory");
+}
+
+/**
+ * @brief 刷新TLB中包括全局页在内的所有缓存
+ * @note 重新加载CR3不会刷新全局页，要先关再开CR4的PGE位
+ */
+static inline void tlb_flush_global(void)
+{
+    if (pg_global == 0)
+    {
+        tlb_flush_all();
+        return;
+    }
+    asm volatile("movl %%cr4, %%eax; andl %0, %%eax; movl %%eax, %%cr4; orl %1, %%eax; movl %%eax, %%cr4" ::"i"(~CR4_PGE), "i"(CR4_PGE)
+                 : "eax", "memory");
+}
+
+/**
+ * @brief 得到访问物理页框的内核虚拟地址，直接映射区之外的页框临时映射到slot对应的内核窗口
+ * @param slot 窗口编号
+ * @param pg_phyaddr 页框物理地址，低12位被忽略
+ * @return 可以访问该页框的虚拟地址
+ * @note 调用者需关中断，用完后调用kunmap
+ * @note 直接映射区中的页框不占用窗口，不修改页表也不刷新TLB
+ */
+void *kmap(enum kmap_slot slot, uint32_t pg_phyaddr)
+{
+    ASSERT(intr_get_status() == INTR_OFF && slot < KMAP_SLOT_CNT);
+    pg_phyaddr &= 0xfffff000;
+    void *direct = addr_p2v(pg_phyaddr);
+    if (direct != NULL)
+    {
+        return direct;
+    }
+    uint32_t vaddr = kmap_vaddr_start + slot * PG_SIZE;
+    *pte_ptr(vaddr) = pg_phyaddr | PG_US_S | PG_RW_W | PG_P_1 | pg_global;
+    invlpg(vaddr);
+    return (void *)vaddr;
+}
+
+/**
+ * @brief 解除slot窗口的临时映射
+ * @param slot 窗口编号
+ */
+void kunmap(enum kmap_slot slot)
+{
+    uint32_t vaddr = kmap_vaddr_start + slot * PG_SIZE;
+    uint32_t *pte = pte_ptr(vaddr);
+    //kmap用的是直接映射区时窗口没有被占用
+    if (*pte & PG_P_1)
+    {
+        *pte = 0;
+        invlpg(vaddr);
+    }
+}
+
+/**
+ * @brief 为新建的页目录复制内核空间的页目录项，并登记此页目录，此后内核页目录项的变化都会同步过来
+ * @param pgdir 新建的页目录
+ */
+void kernel_pde_copy(uint32_t *pgdir)
+{
+    enum intr_status old_status = intr_disable();
+    uint32_t *kernel_pgdir = kmap(KMAP_PGTABLE, KERNEL_PGDIR_PHY);
+    memcpy(pgdir + 0x300, kernel_pgdir + 0x300, 0x100 * 4);
+    kunmap(KMAP_PGTABLE);
+    list_append(&pgdir_list, &vaddr2frame((uint32_t)pgdir)->free_elem);
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 取消页目录的登记，在释放页目录之前调用
+ * @param pgdir 页目录
+ */
+void kernel_pde_drop(uint32_t *pgdir)
+{
+    enum intr_status old_status = intr_disable();
+    list_remove(&vaddr2frame((uint32_t)pgdir)->free_elem);
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 修改内核空间的一个页目录项，同步到所有进程的页目录
+ * @param vaddr 页目录项对应的虚拟地址
+ * @param pde_val 页目录项的值
+ * @note 内核空间的页目录项一般在loader中就建好了，只有大页会修改它们
+ */
+static void kernel_pde_set(uint32_t vaddr, uint32_t pde_val)
+{
+    uint32_t pde_idx = vaddr >> 22;
+    enum intr_status old_status = intr_disable();
+    uint32_t *pgdir = kmap(KMAP_PGTABLE, KERNEL_PGDIR_PHY);
+    pgdir[pde_idx] = pde_val;
+    kunmap(KMAP_PGTABLE);
+
+    struct list_elem *elem = pgdir_list.head.next;
+    while (elem != &pgdir_list.tail)
+    {
+        pgdir = kmap(KMAP_PGTABLE, frame2phy(elem2entry(struct page_frame, free_elem, elem)));
+        pgdir[pde_idx] = pde_val;
+        kunmap(KMAP_PGTABLE);
+        elem = elem->next;
+    }
+    invlpg(vaddr);
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 得到loader为内核空间的页目录项建好的页表，大页解除映射后页目录项恢复成它
+ * @param vaddr 虚拟地址
+ * @return 页目录项的值
+ */
+static uint32_t kernel_pde_origin(uint32_t vaddr)
+{
+    uint32_t pde_idx = vaddr >> 22;
+    ASSERT(pde_idx > 0x300 && pde_idx < 0x3ff);
+    return (KERNEL_PGDIR_PHY + (pde_idx - 0x2ff) * PG_SIZE) | PG_US_U | PG_RW_W | PG_P_1;
+}
+
+/**
+ * @brief 解除vaddr起始的lp_cnt个大页的映射并归还它们的页框
+ * @param vaddr 起始虚拟地址，4MB对齐
+ * @param lp_cnt 大页数
+ */
+static void large_range_unmap(uint32_t vaddr, uint32_t lp_cnt)
+{
+    uint32_t lp_idx;
+    for (lp_idx = 0; lp_idx < lp_cnt; lp_idx++)
+    {
+        uint32_t lp_vaddr = vaddr + lp_idx * LARGE_PAGE_SIZE;
+        uint32_t pde = *pde_ptr(lp_vaddr);
+        ASSERT(pde & PG_PS);
+        kernel_pde_set(lp_vaddr, kernel_pde_origin(lp_vaddr));
+        pfree(pde & 0xffc00000);
+    }
+}
+
+/**
+ * @brief 申请由lp_cnt个4MB大页组成的内核缓冲区，虚拟地址和物理地址都按4MB对齐
+ * @param lp_cnt 大页数
+ * @param zero 是否需要内容为0
+ * @return 成功返回起始虚拟地址，CPU不支持大页或者内存不足时返回NULL
+ * @note 每个大页只占一个页目录项和一个TLB项，适合数MB、整体访问的缓冲区
+ * @note 大页是伙伴系统最大阶的块，内存碎片化之后可能分配不到，调用者可以退回get_kernel_pages
+ */
+void *get_large_pages(uint32_t lp_cnt, bool zero)
+{
+    ASSERT(lp_cnt > 0);
+    if (!pse_enabled)
+    {
+        return NULL;
+    }
+    uint32_t pg_cnt = lp_cnt * (LARGE_PAGE_SIZE / PG_SIZE);
+    get_lock(&kernel_pool.lock);
+
+    //多要不足一个大页的虚拟地址，从中切出4MB对齐的部分，头尾还回去
+    uint32_t extra = LARGE_PAGE_SIZE / PG_SIZE - 1;
+    uint32_t start = (uint32_t)vaddr_get(PF_KERNEL, pg_cnt + extra);
+    if (start == 0)
+    {
+        abandon_lock(&kernel_pool.lock);
+        return NULL;
+    }
+    uint32_t vaddr = (start + LARGE_PAGE_SIZE - 1) & 0xffc00000;
+    uint32_t head_pages = (vaddr - start) / PG_SIZE;
+    if (head_pages > 0)
+    {
+        vaddr_remove(PF_KERNEL, (void *)start, head_pages);
+    }
+    if (extra - head_pages > 0)
+    {
+        vaddr_remove(PF_KERNEL, (void *)(vaddr + pg_cnt * PG_SIZE), extra - head_pages);
+    }
+
+    uint32_t lp_idx;
+    for (lp_idx = 0; lp_idx < lp_cnt; lp_idx++)
+    {
+        uint32_t lp_vaddr = vaddr + lp_idx * LARGE_PAGE_SIZE;
+        uint32_t lp_phyaddr = (uint32_t)palloc_order(PF_KERNEL, LARGE_PAGE_ORDER);
+        if (lp_phyaddr == 0)
+        {
+            large_range_unmap(vaddr, lp_idx);
+            vaddr_remove(PF_KERNEL, (void *)vaddr, pg_cnt);
+            abandon_lock(&kernel_pool.lock);
+            return NULL;
+        }
+        //伙伴系统的块按自身大小对齐，最大阶的块正好是一个4MB对齐的大页
+        ASSERT((lp_phyaddr & (LARGE_PAGE_SIZE - 1)) == 0);
+        kernel_pde_set(lp_vaddr, lp_phyaddr | PG_PS | PG_US_S | PG_RW_W | PG_P_1 | pg_global);
+        if (zero)
+        {
+            memset((void *)lp_vaddr, 0, LARGE_PAGE_SIZE);
+        }
+    }
+    abandon_lock(&kernel_pool.lock);
+    return (void *)vaddr;
+}
+
+/**
+ * @brief 释放get_large_pages得到的lp_cnt个大页
+ * @param vaddr 起始虚拟地址
+ * @param lp_cnt 大页数
+ */
+void free_large_pages(void *vaddr, uint32_t lp_cnt)
+{
+    ASSERT(((uint32_t)vaddr & (LARGE_PAGE_SIZE - 1)) == 0);
+    get_lock(&kernel_pool.lock);
+    large_range_unmap((uint32_t)vaddr, lp_cnt);
+    vaddr_remove(PF_KERNEL, vaddr, lp_cnt * (LARGE_PAGE_SIZE / PG_SIZE));
+    abandon_lock(&kernel_pool.lock);
+}
+
+/**
+ * @brief 为库存不足的内存池补充一个清零的页框，由idle线程在空闲时调用
+ * @return 补充了页框返回true，库存已满或暂时无法补充返回false
+ * @note idle线程不能阻塞，内存池的锁被占用时直接放弃
+ */
+bool zero_stock_refill(void)
+{
+    struct pool *m_pool = kernel_pool.zero_cnt < ZERO_STOCK_MAX ? &kernel_pool : &user_pool;
+    if (m_pool->zero_cnt >= ZERO_STOCK_MAX || !try_get_lock(&m_pool->lock))
+    {
+        return false;
+    }
+    struct page_frame *frame = buddy_alloc(m_pool, 0);
+    abandon_lock(&m_pool->lock);
+    if (frame == NULL)
+    {
+        return false;
+    }
+
+    enum intr_status old_status = intr_disable();
+    page_zero(kmap(KMAP_ZERO, frame2phy(frame)));
+    kunmap(KMAP_ZERO);
+    list_append(&m_pool->zero_list, &frame->free_elem);
+    m_pool->zero_cnt++;
+    intr_set_status(old_status);
+    return true;
+}
+
+/**
+ * @brief 填写一个内存池的统计
+ * @param m_pool 内存池
+ * @param info 输出的统计信息
+ */
+static void pool_info_fill(struct pool *m_pool, struct mem_pool_info *info)
+{
+    enum intr_status old_status = intr_disable();
+    info->total_pages = m_pool->total_pages;
+    info->free_pages = m_pool->free_pages;
+    info->zero_pages = m_pool->zero_cnt;
+    info->zero_hit = m_pool->zero_hit;
+    info->zero_miss = m_pool->zero_miss;
+    info->peak_used = m_pool->peak_used;
+    info->reserve_pages = m_pool->reserve_pages;
+    info->borrow_cnt = m_pool->borrow_cnt;
+    info->large_cnt = m_pool->large_cnt;
+    info->large_pages = m_pool->large_pages;
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 填写各内存块规格的统计
+ * @param desc 内存块规格数组
+ * @param mag 对应的私有缓存数组，为NULL时不统计
+ * @param info 输出的统计信息数组
+ */
+static void desc_info_fill(struct mem_block_desc *desc, struct mem_magazine *mag, struct mem_desc_info *info)
+{
+    uint32_t desc_idx;
+    for (desc_idx = 0; desc_idx < MEM_DESC_CNT; desc_idx++)
+    {
+        info[desc_idx].block_size = desc[desc_idx].block_size;
+        info[desc_idx].blocks_per_arena = desc[desc_idx].blocks_per_arena;
+        info[desc_idx].arena_cnt = desc[desc_idx].arena_cnt;
+        info[desc_idx].free_blocks = desc[desc_idx].free_cnt;
+        info[desc_idx].empty_arenas = desc[desc_idx].empty_cnt;
+        if (mag != NULL && desc_idx < MEM_SMALL_DESC_CNT)
+        {
+            info[desc_idx].cached_blocks = mag[desc_idx].cnt;
+            info[desc_idx].mag_hits = mag[desc_idx].hit_cnt;
+            info[desc_idx].mag_misses = mag[desc_idx].miss_cnt;
+        }
+    }
+}
+
+/**
+ * @brief 得到内存使用情况的统计，meminfo系统调用的实现
+ * @param info 输出的统计信息
+ */
+void sys_meminfo(struct mem_info *info)
+{
+    struct task_struct *cur = running_thread();
+    memset(info, 0, sizeof(struct mem_info));
+
+    pool_info_fill(&kernel_pool, &info->kernel_pool);
+    pool_info_fill(&user_pool, &info->user_pool);
+
+    //内核线程各自的私有缓存不在统计之内，只统计内核堆的arena
+    get_lock(&kernel_pool.lock);
+    desc_info_fill(k_block_descs, NULL, info->kernel_descs);
+    abandon_lock(&kernel_pool.lock);
+    if (cur->pgdir != NULL)
+    {
+        get_lock(&user_pool.lock);
+        desc_info_fill(cur->u_block_desc, cur->mem_mag, info->user_descs);
+        abandon_lock(&user_pool.lock);
+    }
+
+    struct kva_stat kva;
+    get_lock(&kernel_pool.lock);
+    kva_get_stat(&kva);
+    abandon_lock(&kernel_pool.lock);
+    info->kva_free_pages = kva.free_pages;
+    info->kva_extent_cnt = kva.extent_cnt;
+    info->kva_largest_pages = kva.largest_pages;
+    swap_get_stat(&info->swap_total_pages, &info->swap_free_pages, &info->swap_out_cnt, &info->swap_in_cnt);
+    page_dir_switch_stat(&info->cr3_load_cnt, &info->cr3_skip_cnt);
+    info->cache_cnt = kmem_cache_stat(info->caches);
+}
+
+/**
+ * @brief 为当前进程分配一个用户页框，并用src页的内容填充
+ * @param src 源页的虚拟地址，为NULL时页框清零
+ * @return 页框的物理地址，内存耗尽时返回0
+ * @note 在页故障和fork中调用，此时已关中断
+ */
+uint32_t user_frame_fill(void *src)
+{
+    bool zeroed = false;
+    get_lock(&user_pool.lock);
+    void *new_phyaddr = src == NULL ? palloc_zeroed(&user_pool, &zeroed) : palloc(&user_pool);
+    abandon_lock(&user_pool.lock);
+    if (new_phyaddr == NULL)
+    {
+        return 0;
+    }
+    if (zeroed)
+    {
+        return (uint32_t)new_phyaddr;
+    }
+
+    //新页框还没有映射，通过临时窗口填充
+    void *dst = kmap(KMAP_COPY, (uint32_t)new_phyaddr);
+    if (src == NULL)
+    {
+        page_zero(dst);
+    }
+    else
+    {
+        memcpy(dst, src, PG_SIZE);
+    }
+    kunmap(KMAP_COPY);
+    return (uint32_t)new_phyaddr;
+}
+
+/**
+ * @brief 写时复制，为当前进程的vaddr所在页换上私有的可写页框
+ * @param vaddr 引起写故障的虚拟地址
+ * @return 成功返回true，内存耗尽时返回false，页表项保持不变
+ */
+static bool cow_break(uint32_t vaddr)
+{
+    uint32_t *pte = pte_ptr(vaddr);
+    uint32_t old_phyaddr = *pte & 0xfffff000;
+
+    //只剩自己在用，直接恢复可写
+    if (old_phyaddr != zero_page_phyaddr && phy2frame(old_phyaddr)->ref_cnt == 1)
+    {
+        *pte = (*pte & ~PG_COW) | PG_RW_W;
+        invlpg(vaddr);
+        return true;
+    }
+
+    //零页不用复制，直接给一个清零的页框
+    void *src = old_phyaddr == zero_page_phyaddr ? NULL : (void *)(vaddr & 0xfffff000);
+    uint32_t new_phyaddr = user_frame_fill(src);
+    if (new_phyaddr == 0)
+    {
+        return false;
+    }
+    if (src != NULL && (phy2frame(old_phyaddr)->flags & PFF_ARENA))
+    {
+        //arena页的标记跟着页的内容走
+        phy2frame(new_phyaddr)->flags |= PFF_ARENA;
+        phy2frame(new_phyaddr)->slab = phy2frame(old_phyaddr)->slab;
+    }
+
+    *pte = new_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+    invlpg(vaddr);
+    pfree(old_phyaddr);
+    return true;
+}
+
+/**
+ * @brief 判断vaddr是否落在当前进程允许此次访问的虚拟内存区域中
+ * @param vaddr 虚拟地址
+ * @param write 是否是写访问
+ * @return 是返回true
+ * @note 紧贴在栈区域下方的访问会让栈向下扩展
+ */
+static bool user_vaddr_valid(uint32_t vaddr, bool write)
+{
+    struct task_struct *current_thread = running_thread();
+    if (current_thread->pgdir == NULL || vaddr >= 0xc0000000)
+    {
+        return false;
+    }
+    struct vm_area *vma = vma_find(&current_thread->mm, vaddr);
+    if (vma == NULL && vma_stack_grow(&current_thread->mm, vaddr))
+    {
+        vma = vma_find(&current_thread->mm, vaddr);
+    }
+    return vma != NULL && (vma->vm_flags & (write ? VM_WRITE : VM_READ));
+}
+
+/**
+ * @brief 第一次访问文件映射的页时，把页缓存中的文件页映射进来，不在页缓存中时先从磁盘读入
+ * @param vma vaddr所在的区域
+ * @param vaddr 页对齐的虚拟地址
+ * @param write 是否是写访问
+ * @return 成功返回true，内存耗尽时返回false
+ * @note 共享映射直接映射页缓存中的页框；私有映射按写时复制映射，写访问立即复制
+ */
+static bool file_page_fault(struct vm_area *vma, uint32_t vaddr, bool write)
+{
+    struct file_map *fmap = vma->vm_file;
+    uint32_t pg_idx = vma->vm_pgoff + (vaddr - vma->vm_start) / PG_SIZE;
+
+    get_lock(&fmap->lock);
+    uint32_t pg_phyaddr = fmap->pages[pg_idx];
+    if (pg_phyaddr == 0)
+    {
+        //先只给内核映射到故障地址，磁盘数据直接读进页框，不经过中间缓冲区
+        pg_phyaddr = user_frame_fill(NULL);
+        if (pg_phyaddr == 0)
+        {
+            abandon_lock(&fmap->lock);
+            return false;
+        }
+        page_table_set(vaddr, pg_phyaddr | PG_US_S | PG_RW_W | PG_P_1);
+        file_map_read(fmap, pg_idx, (void *)vaddr);
+        //分配时的引用归页缓存所有
+        fmap->pages[pg_idx] = pg_phyaddr;
+        *pte_ptr(vaddr) = 0;
+        invlpg(vaddr);
+    }
+    page_frame_ref(pg_phyaddr);
+    abandon_lock(&fmap->lock);
+
+    if (vma->vm_flags & VM_SHARED)
+    {
+        page_table_set(vaddr, pg_phyaddr | PG_US_U | (vma->vm_flags & VM_WRITE ? PG_RW_W : PG_RW_R) | PG_P_1);
+        return true;
+    }
+    page_table_set(vaddr, pg_phyaddr | PG_US_U | PG_RW_R | PG_COW | PG_P_1);
+    return !write || cow_break(vaddr);
+}
+
+/**
+ * @brief 访问已被换出的页时，把它从交换分区读入一个新的私有页框
+ * @param vma vaddr所在的区域
+ * @param vaddr 页对齐的虚拟地址
+ * @return 成功返回true，内存耗尽时返回false
+ * @note 被fork共享的交换槽由各进程分别换入，换入后的页框只属于本进程，按区域的权限映射
+ */
+static bool swap_page_fault(struct vm_area *vma, uint32_t vaddr)
+{
+    uint32_t entry = *pte_ptr(vaddr);
+    get_lock(&user_pool.lock);
+    uint32_t pg_phyaddr = (uint32_t)palloc(&user_pool);
+    abandon_lock(&user_pool.lock);
+    if (pg_phyaddr == 0)
+    {
+        return false;
+    }
+
+    //先只给内核映射到故障地址，交换槽中的数据直接读进页框
+    page_table_set(vaddr, pg_phyaddr | PG_US_S | PG_RW_W | PG_P_1);
+    swap_in(entry, (void *)vaddr);
+    *pte_ptr(vaddr) = pg_phyaddr | PG_US_U | (vma->vm_flags & VM_WRITE ? PG_RW_W : PG_RW_R) | PG_P_1;
+    invlpg(vaddr);
+    return true;
+}
+
+/**
+ * @brief 第一次访问用户页时建立映射，读访问映射共享零页，写访问分配清零的页框；访问换出的页时换入
+ * @param vaddr 引起故障的虚拟地址
+ * @param write 是否是写访问
+ * @return 成功返回true，内存耗尽时返回false
+ */
+static bool demand_page(uint32_t vaddr, bool write)
+{
+    vaddr &= 0xfffff000;
+    struct vm_area *vma = vma_find(&running_thread()->mm, vaddr);
+    if ((*pde_ptr(vaddr) & PG_P_1) && (*pte_ptr(vaddr) & PG_SWAP))
+    {
+        return swap_page_fault(vma, vaddr);
+    }
+    if (vma->vm_file != NULL)
+    {
+        return file_page_fault(vma, vaddr, write);
+    }
+    if (write)
+    {
+        uint32_t pg_phyaddr = user_frame_fill(NULL);
+        if (pg_phyaddr == 0)
+        {
+            return false;
+        }
+        page_table_set(vaddr, pg_phyaddr | PG_US_U | PG_RW_W | PG_P_1);
+        return true;
+    }
+    //零页只读，之后写的时候按写时复制处理
+    page_table_set(vaddr, zero_page_phyaddr | PG_US_U | PG_RW_R | PG_COW | PG_P_1);
+    return true;
+}
+
+/**
+ * @brief 用户态的页故障无法处理时，结束当前进程
+ * @param why 结束的原因
+ * @param vaddr 引起故障的虚拟地址
+ * @param stack 故障时的中断栈
+ * @return 不能结束当前进程时返回false，由调用者停机；否则不返回
+ * @note 内核态访问用户地址时可能正持有锁，这时结束进程会让别的任务永远等不到锁，只能停机；
+ *       init进程不能退出，也只能停机
+ */
+static bool user_fault_kill(const char *why, uint32_t vaddr, struct intr_stack *stack)
+{
+    struct task_struct *cur = running_thread();
+    if ((stack->cs & 3) != 3 || cur->pid == INIT_PID)
+    {
+        return false;
+    }
+    put_str("\n");
+    put_str((char *)why);
+    put_str(", kill pid:");
+    put_int(cur->pid);
+    put_str(" addr:");
+    put_int(vaddr);
+    put_str("\n");
+    //释放地址空间时要等锁、读写磁盘，和系统调用一样开中断执行
+    intr_enable();
+    sys_exit(-1);
+    return true;
+}
+
+/**
+ * @brief 0x0e号页故障处理函数，处理按需分配和写时复制
+ * @note 其余情况打印故障信息，用户态的故障结束当前进程，内核态的故障停机
+ * @param vec_nr 中断向量号
+ */
+static void page_fault_handler(uint8_t vec_nr)
+{
+    //kernel.S压入的中断号就是本函数的参数，其所在位置即中断栈的开始
+    struct intr_stack *stack = (struct intr_stack *)((uint32_t *)__builtin_frame_address(0) + 2);
+    uint32_t fault_vaddr;
+    asm("movl %%cr2, %0"
+        : "=r"(fault_vaddr));
+
+    if (!(stack->err_code & PF_ERR_PRESENT) && user_vaddr_valid(fault_vaddr, stack->err_code & PF_ERR_WRITE))
+    {
+        if (!demand_page(fault_vaddr, stack->err_code & PF_ERR_WRITE) &&
+            !user_fault_kill("out of memory", fault_vaddr, stack))
+        {
+            PANIC("page fault: out of memory!");
+        }
+        return;
+    }
+
+    //mprotect去掉写权限后，写时复制的页也不能再写
+    if ((stack->err_code & PF_ERR_PRESENT) && (stack->err_code & PF_ERR_WRITE) && fault_vaddr < 0xc0000000 &&
+        (*pde_ptr(fault_vaddr) & PG_P_1) && (*pte_ptr(fault_vaddr) & PG_COW) && user_vaddr_valid(fault_vaddr, true))
+    {
+        if (!cow_break(fault_vaddr) && !user_fault_kill("out of memory", fault_vaddr, stack))
+        {
+            PANIC("page fault: out of memory!");
+        }
+        return;
+    }
+
+    put_str("\n!!!!!!!      page fault      !!!!!!!!\n");
+    put_str("vector:");
+    put_int(vec_nr);
+    put_str(" addr:");
+    put_int(fault_vaddr);
+    put_str(" error code:");
+    put_int(stack->err_code);
+    put_str(" eip:");
+    put_int((uint32_t)stack->eip);
+    //越界访问、写只读区域或者访问PROT_NONE区域
+    if (!user_fault_kill("segmentation fault", fault_vaddr, stack))
+    {
+        PANIC("page fault");
+    }
+}
+
+/**
+ * @brief 只申请pg_cnt页的内核虚拟地址，不分配页框也不建立映射
+ * @param pg_cnt 页数
+ * @return 成功返回起始地址，失败返回NULL
+ */
+void *kernel_vaddr_get(uint32_t pg_cnt)
+{
+    get_lock(&kernel_pool.lock);
+    void *vaddr = vaddr_get(PF_KERNEL, pg_cnt);
+    abandon_lock(&kernel_pool.lock);
+    return vaddr;
+}
+
+/**
+ * @brief 归还kernel_vaddr_get得到的内核虚拟地址
+ * @param vaddr 起始地址
+ * @param pg_cnt 页数
+ */
+void kernel_vaddr_put(void *vaddr, uint32_t pg_cnt)
+{
+    get_lock(&kernel_pool.lock);
+    vaddr_remove(PF_KERNEL, vaddr, pg_cnt);
+    abandon_lock(&kernel_pool.lock);
+}
+
+/**
+ * @brief 释放get_kernel_pages得到的pg_cnt个内核页
+ * @param vaddr 起始虚拟地址
+ * @param pg_cnt 页数
+ */
+void free_kernel_pages(void *vaddr, uint32_t pg_cnt)
+{
+    get_lock(&kernel_pool.lock);
+    mfree_page(PF_KERNEL, vaddr, pg_cnt);
+    abandon_lock(&kernel_pool.lock);
+}
+
+/**
+ * @brief 解除vaddr起始的pg_cnt页的映射并释放其物理页框
+ * @param pf 内核还是用户的标记
+ * @param vaddr 起始虚拟地址，页对齐
+ * @param pg_cnt 页数
+ * @note 每4MB只检查一次页目录项；页数超过TLB_FLUSH_ALL_PAGES时只整体刷新一次TLB，否则逐页invlpg
+ */
+static void page_range_unmap(enum pool_flags pf, uint32_t vaddr, uint32_t pg_cnt)
+{
+    bool flush_all = pg_cnt > TLB_FLUSH_ALL_PAGES;
+    uint32_t *pte = pte_ptr(vaddr);
+    uint32_t idx = 0;
+    while (idx < pg_cnt)
+    {
+        uint32_t cur_vaddr = vaddr + idx * PG_SIZE;
+        uint32_t batch_end = idx + 1024 - PTE_IDX(cur_vaddr);
+        if (batch_end > pg_cnt)
+        {
+            batch_end = pg_cnt;
+        }
+
+        //整个页表都不存在，用户页可能从未被访问过
+        if (!(*pde_ptr(cur_vaddr) & PG_P_1))
+        {
+            ASSERT(pf == PF_USER);
+            idx = batch_end;
+            continue;
+        }
+
+        for (; idx < batch_end; idx++)
+        {
+            if (!(pte[idx] & PG_P_1))
+            {
+                //换出的页只需放下交换槽
+                ASSERT(pf == PF_USER);
+                if (pte[idx] & PG_SWAP)
+                {
+                    swap_entry_free(pte[idx]);
+                    pte[idx] = 0;
+                }
+                continue;
+            }
+
+            uint32_t pg_phyaddr = pte[idx] & 0xfffff000;
+            //确保页框当前归对应的内存池所有，用户页还可能是共享的零页
+            ASSERT(pg_phyaddr == zero_page_phyaddr ||
+                   pool_owns_frame(pf == PF_USER ? &user_pool : &kernel_pool, phy2frame(pg_phyaddr)));
+
+            pfree(pg_phyaddr);
+            pte[idx] = 0;
+            if (!flush_all)
+            {
+                invlpg(vaddr + idx * PG_SIZE);
+            }
+        }
+    }
+
+    if (flush_all)
+    {
+        //内核页是全局页，重新加载CR3刷新不掉
+        if (pf == PF_KERNEL)
+        {
+            tlb_flush_global();
+        }
+        else
+        {
+            tlb_flush_all();
+        }
+    }
+}
+
+/**
+ * @brief 释放以虚拟地址vaddr起始的cnt个物理页框
+ * @param pf 内核还是用户的标记
+ * @param vaddr_ 虚拟地址
+ * @param pg_cnt 要释放物理页框的数量
+ * @note 内存回收两步：     ① 调用page_range_unmap删除页表项并释放物理页框
+ *                          ② 归还虚拟地址
+ */
+void mfree_page(enum pool_flags pf, void *vaddr_, uint32_t pg_cnt)
+{
+    uint32_t vaddr = (uint32_t)vaddr_;
+    ASSERT(pg_cnt >= 1 && vaddr % PG_SIZE == 0);
+
+    page_range_unmap(pf, vaddr, pg_cnt);
+    //归还虚拟地址
+    vaddr_remove(pf, vaddr_, pg_cnt);
+}
+
+/**
+ * @brief 回收内存ptr
+ * @param ptr 待回收的地址
+ * @note 小内存块先放入私有缓存，缓存满时才加锁批量归还arena
+ * @note 大内存直接解除页表映射并归还物理页框
+ */
+void sys_free(void *ptr)
+{
+    ASSERT(ptr != NULL);
+    if (ptr != NULL)
+    {
+        enum pool_flags PF;
+        struct pool *mem_pool;
+        struct mem_block_desc *desc;
+        struct task_struct *current_thread = running_thread();
+
+        //如果是线程
+        if (current_thread->pgdir == NULL)
+        {
+            ASSERT((uint32_t)ptr >= K_HEAP_START);
+            PF = PF_KERNEL;
+            mem_pool = &kernel_pool;
+            desc = k_block_descs;
+        }
+        else
+        {
+            PF = PF_USER;
+            mem_pool = &user_pool;
+            desc = current_thread->u_block_desc;
+        }
+
+        struct mem_block *block = ptr;
+        struct arena *are = block2arena(block);
+
+        ASSERT(are->large == 0 || are->large == 1);
+        if (are->desc == NULL && are->large == true)
+        {
+            get_lock(&mem_pool->lock);
+            mem_pool->large_cnt--;
+            mem_pool->large_pages -= are->cnt;
+            mfree_page(PF, are, are->cnt);
+            abandon_lock(&mem_pool->lock);
+            return;
+        }
+
+        uint32_t desc_idx = ((uint32_t)are->desc - (uint32_t)desc) / sizeof(struct mem_block_desc);
+        if ((uint32_t)are->desc < (uint32_t)desc || desc_idx >= MEM_SMALL_DESC_CNT)
+        {
+            //中等规格或不是本任务规格描述符管理的内存块，直接还给arena
+            get_lock(&mem_pool->lock);
+            arena_block_put(block, PF);
+            abandon_lock(&mem_pool->lock);
+            return;
+        }
+
+        struct mem_magazine *mag = &current_thread->mem_mag[desc_idx];
+        if (mag->cnt > 0 && mag->pf != PF)
+        {
+            //私有缓存里存着另一个内存池的块，这一块直接还给arena
+            get_lock(&mem_pool->lock);
+            arena_block_put(block, PF);
+            abandon_lock(&mem_pool->lock);
+            return;
+        }
+        mag->pf = PF;
+        if (mag->cnt == MAG_SIZE)
+        {
+            mag->miss_cnt++;
+            get_lock(&mem_pool->lock);
+            magazine_flush(mag, PF);
+            abandon_lock(&mem_pool->lock);
+        }
+        else
+        {
+            mag->hit_cnt++;
+        }
+        mag->blocks[mag->cnt++] = block;
+    }
+}
+
+/**
+ * @brief 调整当前进程brk堆的结束地址，brk系统调用的实现
+ * @param new_brk 新的结束地址，为0时只查询
+ * @return 调整后的结束地址，失败时是原来的结束地址
+ * @note 扩大时只建立虚拟内存区域，页框在第一次访问时分配；缩小时解除映射并释放页框
+ */
+uint32_t sys_brk(uint32_t new_brk)
+{
+    struct mm_struct *mm = &running_thread()->mm;
+    if (new_brk == 0 || mm->brk_start == 0 || new_brk < mm->brk_start)
+    {
+        return mm->brk;
+    }
+
+    uint32_t old_end = DIV_ROUND_UP(mm->brk, PG_SIZE) * PG_SIZE;
+    uint32_t new_end = DIV_ROUND_UP(new_brk, PG_SIZE) * PG_SIZE;
+    if (new_end < new_brk)
+    {
+        return mm->brk; //越过4GB
+    }
+
+    get_lock(&user_pool.lock);
+    if (new_end > old_end)
+    {
+        //和相邻的堆区域属性相同，会合并成一个区域；与其他区域重叠时失败
+        if (vma_map(mm, old_end, (new_end - old_end) / PG_SIZE, VM_READ | VM_WRITE) == -1)
+        {
+            abandon_lock(&user_pool.lock);
+            return mm->brk;
+        }
+    }
+    else if (new_end < old_end)
+    {
+        mfree_page(PF_USER, (void *)new_end, (old_end - new_end) / PG_SIZE);
+    }
+    mm->brk = new_brk;
+    abandon_lock(&user_pool.lock);
+    return new_brk;
+}
+
+/**
+ * @brief 检查[addr, addr + len)是否是页对齐、非空且完全落在用户空间中的一段地址
+ * @param addr 起始地址
+ * @param len 字节数
+ * @return 是返回页数，否则返回0
+ */
+static uint32_t user_range_pages(uint32_t addr, uint32_t len)
+{
+    if (addr % PG_SIZE != 0 || addr < USER_VADDR_START || addr >= 0xc0000000 || len == 0 || len > 0xc0000000 - addr)
+    {
+        return 0;
+    }
+    return DIV_ROUND_UP(len, PG_SIZE);
+}
+
+/**
+ * @brief 把虚拟内存区域的权限同步到vaddr起始的pg_cnt页中已经存在的页表项
+ * @param vaddr 起始虚拟地址，页对齐
+ * @param pg_cnt 页数
+ * @param flags 区域的新属性
+ * @note 不可访问的页去掉PG_US_U，用户态访问时触发保护违例
+ * @note 私有区域恢复写权限时，共享的页框和零页只标记PG_COW，写的时候再复制
+ */
+static void page_range_protect(uint32_t vaddr, uint32_t pg_cnt, uint32_t flags)
+{
+    bool flush_all = pg_cnt > TLB_FLUSH_ALL_PAGES;
+    uint32_t *pte = pte_ptr(vaddr);
+    uint32_t idx = 0;
+    while (idx < pg_cnt)
+    {
+        uint32_t cur_vaddr = vaddr + idx * PG_SIZE;
+        uint32_t batch_end = idx + 1024 - PTE_IDX(cur_vaddr);
+        if (batch_end > pg_cnt)
+        {
+            batch_end = pg_cnt;
+        }
+
+        //整个页表都不存在，这些页之后按新的区域权限按需映射
+        if (!(*pde_ptr(cur_vaddr) & PG_P_1))
+        {
+            idx = batch_end;
+            continue;
+        }
+
+        for (; idx < batch_end; idx++)
+        {
+            uint32_t old_pte = pte[idx];
+            if (!(old_pte & PG_P_1))
+            {
+                continue;
+            }
+
+            uint32_t new_pte = flags & (VM_READ | VM_WRITE) ? old_pte | PG_US_U : old_pte & ~PG_US_U;
+            if (!(flags & VM_WRITE))
+            {
+                new_pte &= ~PG_RW_W;
+            }
+            else if (flags & VM_SHARED)
+            {
+                new_pte |= PG_RW_W;
+            }
+            else if (!(old_pte & PG_RW_W))
+            {
+                uint32_t pg_phyaddr = old_pte & 0xfffff000;
+                if (pg_phyaddr != zero_page_phyaddr && phy2frame(pg_phyaddr)->ref_cnt == 1)
+                {
+                    new_pte = (new_pte & ~PG_COW) | PG_RW_W;
+                }
+                else
+                {
+                    new_pte |= PG_COW;
+                }
+            }
+
+            if (new_pte != old_pte)
+            {
+                pte[idx] = new_pte;
+                if (!flush_all)
+                {
+                    invlpg(vaddr + idx * PG_SIZE);
+                }
+            }
+        }
+    }
+
+    if (flush_all)
+    {
+        tlb_flush_all();
+    }
+}
+
+/**
+ * @brief 把mmap的权限转换成虚拟内存区域的属性
+ * @param prot PROT_*的组合
+ * @return VM_READ和VM_WRITE的组合
+ */
+static uint32_t prot2vm_flags(uint32_t prot)
+{
+    uint32_t flags = 0;
+    if (prot & PROT_READ)
+    {
+        flags |= VM_READ;
+    }
+    if (prot & PROT_WRITE)
+    {
+        flags |= VM_READ | VM_WRITE;
+    }
+    return flags;
+}
+
+/**
+ * @brief 把当前进程[start, end)中共享文件映射被写过的页写回文件
+ * @param start 起始地址，页对齐
+ * @param end 结束地址，页对齐
+ * @note 按页表项的D位判断是否被写过，写回前清除D位，只处理本进程写过的页
+ */
+static void user_range_sync(uint32_t start, uint32_t end)
 {
-    enum pool_flags PF;
-    struct pool *mem_pool;
-    uint32_t pool_size;
-    struct mem_block_desc *desc;
-    struct task_struct *current_thread = running_thread();
+    struct mm_struct *mm = &running_thread()->mm;
+    struct vm_area *vma = vma_find(mm, start);
+    if (vma == NULL)
+    {
+        vma = vma_next(mm, NULL);
+        while (vma != NULL && vma->vm_end <= start)
+        {
+            vma = vma_next(mm, vma);
+        }
+    }
 
-    if (current_thread->pgdir == NULL)
+    for (; vma != NULL && vma->vm_start < end; vma = vma_next(mm, vma))
     {
-        //内核线程
-        PF = PF_KERNEL;
-        pool_size = kernel_pool.pool_size;
-        mem_pool = &kernel_pool;
-        desc = k_block_descs;
+        if (!(vma->vm_flags & VM_SHARED) || vma->vm_file == NULL)
+        {
+            continue;
+        }
+        uint32_t vaddr = vma->vm_start > start ? vma->vm_start : start;
+        uint32_t vend = vma->vm_end < end ? vma->vm_end : end;
+        for (; vaddr < vend; vaddr += PG_SIZE)
+        {
+            if (!(*pde_ptr(vaddr) & PG_P_1))
+            {
+                continue;
+            }
+            uint32_t *pte = pte_ptr(vaddr);
+            if ((*pte & (PG_P_1 | PG_DIRTY)) != (PG_P_1 | PG_DIRTY))
+            {
+                continue;
+            }
+            *pte &= ~PG_DIRTY;
+            invlpg(vaddr);
+
+            get_lock(&vma->vm_file->lock);
+            file_map_write(vma->vm_file, vma->vm_pgoff + (vaddr - vma->vm_start) / PG_SIZE, (void *)vaddr);
+            abandon_lock(&vma->vm_file->lock);
+        }
     }
-    else
+}
+
+/**
+ * @brief 为mmap找到要映射的文件
+ * @param args 系统调用的参数
+ * @param flags 输入映射的权限，输出时补充VM_SHARED和VM_MAYWRITE
+ * @param pg_cnt 映射的页数
+ * @return 成功返回持有一个引用的文件映射，文件不能按要求映射时返回NULL
+ */
+static struct file_map *mmap_file_get(struct mmap_args *args, uint32_t *flags, uint32_t pg_cnt)
+{
+    bool writable;
+    if (args->offset % PG_SIZE != 0)
     {
-        //用户进程
-        PF = PF_USER;
-        pool_size = user_pool.pool_size;
-        mem_pool = &user_pool;
-        desc = current_thread->u_block_desc;
+        return NULL;
+    }
+    struct file_map *fmap = file_map_get(args->fd, args->offset / PG_SIZE, pg_cnt, &writable);
+    if (fmap == NULL || !(args->flags & MAP_SHARED))
+    {
+        return fmap;
     }
 
-    //如果申请内存不在内存池容量范围内，直接返回NULL
-    if (!(size > 0 && size < pool_size))
+    //以只读方式打开的文件不能通过共享映射修改
+    *flags |= VM_SHARED;
+    if (writable)
+    {
+        *flags |= VM_MAYWRITE;
+    }
+    else if (*flags & VM_WRITE)
     {
+        file_map_put(fmap);
         return NULL;
     }
+    return fmap;
+}
 
-    struct arena *are;
-    struct mem_block *block;
-    get_lock(&mem_pool->lock);
-    if (size > 1024)
+/**
+ * @brief 在当前进程中建立一段匿名或文件映射，mmap系统调用的实现
+ * @param args 系统调用的参数
+ * @return 成功返回映射的起始地址，失败返回MAP_FAILED
+ * @note 只建立虚拟内存区域，不分配页框，第一次访问时由页故障按需映射，没访问过的页不占物理内存
+ * @note 映射同一文件的进程共享页缓存中的文件页，MAP_SHARED的修改在msync或munmap时写回文件
+ * @note 没有MAP_FIXED时addr只是建议，那里放不下就另找空隙
+ */
+void *sys_mmap(struct mmap_args *args)
+{
+    struct task_struct *current_thread = running_thread();
+    struct mm_struct *mm = &current_thread->mm;
+    uint32_t addr = args->addr;
+    uint32_t pg_cnt = args->len == 0 || args->len > 0xc0000000 ? 0 : DIV_ROUND_UP(args->len, PG_SIZE);
+    uint32_t share = args->flags & (MAP_SHARED | MAP_PRIVATE);
+    if (current_thread->pgdir == NULL || pg_cnt == 0 || (args->prot & ~(PROT_READ | PROT_WRITE)) ||
+        (share != MAP_SHARED && share != MAP_PRIVATE) || ((args->flags & MAP_ANONYMOUS) && share != MAP_PRIVATE))
     {
-        //得到要分配的页数
-        uint32_t page_cnt = DIV_ROUND_UP(size + sizeof(struct arena), PG_SIZE);
+        return MAP_FAILED;
+    }
+    if ((args->flags & MAP_FIXED) && user_range_pages(addr, args->len) == 0)
+    {
+        return MAP_FAILED;
+    }
 
-        are = malloc_page(PF, page_cnt);
-        if (are != NULL)
+    uint32_t flags = prot2vm_flags(args->prot);
+    struct file_map *fmap = NULL;
+    if (!(args->flags & MAP_ANONYMOUS))
+    {
+        fmap = mmap_file_get(args, &flags, pg_cnt);
+        if (fmap == NULL)
         {
-            memset(are, 0, page_cnt * PG_SIZE);
-            are->desc = NULL;
-            are->cnt = page_cnt;
-            are->large = true;
-            abandon_lock(&mem_pool->lock);
-            return (void *)(are + 1);
+            return MAP_FAILED;
+        }
+    }
+
+    if (args->flags & MAP_FIXED)
+    {
+        //先去掉这段地址上原有的映射，共享文件映射的修改要先写回
+        user_range_sync(addr, addr + pg_cnt * PG_SIZE);
+        get_lock(&user_pool.lock);
+        if (vma_unmap(mm, addr, pg_cnt) == -1)
+        {
+            addr = 0;
         }
         else
         {
-            abandon_lock(&mem_pool->lock);
-            return NULL;
+            page_range_unmap(PF_USER, addr, pg_cnt);
+            addr = vma_mmap(mm, addr, pg_cnt, flags, fmap, args->offset / PG_SIZE);
         }
     }
     else
     {
-        uint8_t desc_idx;
-        for (desc_idx = 0; desc_idx < MEM_DESC_CNT; desc_idx++)
+        get_lock(&user_pool.lock);
+        if (addr % PG_SIZE != 0 || (addr != 0 && vma_mmap(mm, addr, pg_cnt, flags, fmap, args->offset / PG_SIZE) == 0))
         {
-            if (size <= desc[desc_idx].block_size)
-            {
-                break;
-            }
+            addr = 0;
         }
-
-        //如果没有可用内存了
-        if (list_empty(&desc[desc_idx].free_list))
+        if (addr == 0)
         {
-            are = malloc_page(PF, 1);
-            if (are == NULL)
-            {
-                abandon_lock(&mem_pool->lock);
-                return NULL;
-            }
-            memset(are, 0, PG_SIZE);
-
-            are->desc = &desc[desc_idx];
-            are->large = false;
-            are->cnt = desc[desc_idx].blocks_per_arena;
-            uint32_t block_idx;
+            addr = vma_mmap(mm, 0, pg_cnt, flags, fmap, args->offset / PG_SIZE);
+        }
+    }
+    abandon_lock(&user_pool.lock);
 
-            enum intr_status old_status = intr_disable();
-            for (block_idx = 0; block_idx < desc[desc_idx].blocks_per_arena; block_idx++)
-            {
-                block = arena2block(are, block_idx);
-                ASSERT(!elem_find(&are->desc->free_list, &block->free_elem));
-                list_append(&are->desc->free_list, &block->free_elem);
-            }
-            intr_set_status(old_status);
+    if (addr == 0)
+    {
+        if (fmap != NULL)
+        {
+            file_map_put(fmap);
         }
+        return MAP_FAILED;
+    }
+    return (void *)addr;
+}
 
-        //开始分配内存块
-        block = elem2entry(struct mem_block, free_elem, list_pop(&(desc[desc_idx].free_list)));
-        memset(block, 0, desc[desc_idx].block_size);
+/**
+ * @brief 解除当前进程[addr, addr + len)的映射，munmap系统调用的实现
+ * @param addr 起始地址，页对齐
+ * @param len 字节数
+ * @return 成功返回0，失败返回-1
+ * @note 这段地址中已经分配的页框立即归还用户内存池，其中没有映射的部分被忽略
+ * @note 共享文件映射被写过的页先写回文件
+ */
+int32_t sys_munmap(void *addr, uint32_t len)
+{
+    struct task_struct *current_thread = running_thread();
+    uint32_t pg_cnt = user_range_pages((uint32_t)addr, len);
+    if (current_thread->pgdir == NULL || pg_cnt == 0)
+    {
+        return -1;
+    }
 
-        are = block2arena(block);
-        abandon_lock(&mem_pool->lock);
-        return (void *)block;
+    //写回时会等待磁盘，不能持有内存池的锁
+    user_range_sync((uint32_t)addr, (uint32_t)addr + pg_cnt * PG_SIZE);
+    get_lock(&user_pool.lock);
+    //拆分区域可能失败，先改区域再释放页框
+    if (vma_unmap(&current_thread->mm, (uint32_t)addr, pg_cnt) == -1)
+    {
+        abandon_lock(&user_pool.lock);
+        return -1;
     }
+    page_range_unmap(PF_USER, (uint32_t)addr, pg_cnt);
+    abandon_lock(&user_pool.lock);
+    return 0;
 }
 
 /**
- * @brief 将物理地址pg_phyaddr回收到物理内存池
- * @param pg_phyaddr 物理地址
+ * @brief 修改当前进程[addr, addr + len)的访问权限，mprotect系统调用的实现
+ * @param addr 起始地址，页对齐
+ * @param len 字节数
+ * @param prot 新的权限，PROT_*的组合
+ * @return 成功返回0，这段地址没有全部映射或失败返回-1
  */
-void pfree(uint32_t pg_phyaddr)
+int32_t sys_mprotect(void *addr, uint32_t len, uint32_t prot)
 {
-    struct pool *mem_pool;
-    uint32_t bit_idx = 0;
-    if (pg_phyaddr >= user_pool.phy_addr_start)
+    struct task_struct *current_thread = running_thread();
+    uint32_t pg_cnt = user_range_pages((uint32_t)addr, len);
+    if (current_thread->pgdir == NULL || pg_cnt == 0 || (prot & ~(PROT_READ | PROT_WRITE)))
     {
-        //用户物理内存池
-        mem_pool = &user_pool;
-        //得到是第几个页
-        bit_idx = (pg_phyaddr - user_pool.phy_addr_start) / PG_SIZE;
+        return -1;
     }
-    else
+    uint32_t flags = prot2vm_flags(prot);
+
+    get_lock(&user_pool.lock);
+    if (vma_protect(&current_thread->mm, (uint32_t)addr, pg_cnt, flags) == -1)
     {
-        //内核物理内存池
-        mem_pool = &kernel_pool;
-        bit_idx = (pg_phyaddr - kernel_pool.phy_addr_start) / PG_SIZE;
+        abandon_lock(&user_pool.lock);
+        return -1;
     }
-    bitmap_set(&mem_pool->pool_bitmap, bit_idx, 0);
+
+    //各区域的其他属性不同，逐个区域同步页表项
+    uint32_t start = (uint32_t)addr;
+    uint32_t end = start + pg_cnt * PG_SIZE;
+    struct vm_area *vma = vma_find(&current_thread->mm, start);
+    for (; vma != NULL && vma->vm_start < end; vma = vma_next(&current_thread->mm, vma))
+    {
+        uint32_t vstart = vma->vm_start > start ? vma->vm_start : start;
+        uint32_t vend = vma->vm_end < end ? vma->vm_end : end;
+        page_range_protect(vstart, (vend - vstart) / PG_SIZE, vma->vm_flags);
+    }
+    abandon_lock(&user_pool.lock);
+    return 0;
 }
 
 /**
- * @brief 去掉页表中vaddr的映射，只去掉pte就行
- * @param vaddr 虚拟地址
+ * @brief 把当前进程[addr, addr + len)中共享文件映射的修改写回文件，msync系统调用的实现
+ * @param addr 起始地址，页对齐
+ * @param len 字节数
+ * @return 成功返回0，地址不合法返回-1
  */
-static void page_table_pte_remove(uint32_t vaddr)
+int32_t sys_msync(void *addr, uint32_t len)
 {
-    uint32_t *pte = pte_ptr(vaddr);
-    *pte &= ~PG_P_1; //页表项pte的p位置为0
-    //下面的命令更新页表高速缓存tlb，这里只用更新vaddr对应的页表项就可以了
-    asm volatile("invlpg %0" ::"m"(vaddr)
-                 : "memory");
+    uint32_t pg_cnt = user_range_pages((uint32_t)addr, len);
+    if (running_thread()->pgdir == NULL || pg_cnt == 0)
+    {
+        return -1;
+    }
+    user_range_sync((uint32_t)addr, (uint32_t)addr + pg_cnt * PG_SIZE);
+    return 0;
 }
 
 /**
- * @brief 在虚拟地址池中释放vaddr起始的pg_cnt个虚拟页地址
- * @param pf 标记是内核还是用户虚拟地址池
- * @param vaddr_  起始地址
- * @param pg_cnt 虚拟地址页的个数
+ * @brief 把已有的pg_cnt个物理页框映射到当前进程的一段新的共享区域，每个页框增加一个引用
+ * @param pages 各页框的物理地址
+ * @param pg_cnt 页数
+ * @return 成功返回起始地址，失败返回NULL
+ * @note 映射时就建立全部页表项，fork之后父子进程继续共享这些页框
  */
-static void vaddr_remove(enum pool_flags pf, void *vaddr_, uint32_t pg_cnt)
+void *user_pages_share(uint32_t *pages, uint32_t pg_cnt)
 {
-    uint32_t bit_idx_start = 0;
-    uint32_t vaddr = (uint32_t)vaddr_;
-    uint32_t cnt = 0;
+    struct task_struct *current_thread = running_thread();
+    if (current_thread->pgdir == NULL)
+    {
+        return NULL;
+    }
 
-    if (pf == PF_KERNEL)
+    get_lock(&user_pool.lock);
+    uint32_t vaddr = vma_mmap(&current_thread->mm, 0, pg_cnt, VM_READ | VM_WRITE | VM_SHARED | VM_MAYWRITE, NULL, 0);
+    if (vaddr == 0)
     {
-        //移出内核的pte
-        //得到具体位图信息
-        bit_idx_start = (vaddr - kernel_vaddr.vaddr_start) / PG_SIZE;
-        while (cnt < pg_cnt)
-        {
-            //位图置0，表示释放内存
-            bitmap_set(&kernel_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
-        }
+        abandon_lock(&user_pool.lock);
+        return NULL;
     }
-    else
+    uint32_t idx;
+    for (idx = 0; idx < pg_cnt; idx++)
     {
-        //用户虚拟内存池
-        struct task_struct *current_thread = running_thread();
-        bit_idx_start = (vaddr - current_thread->userprog_vaddr.vaddr_start) / PG_SIZE;
-        while (cnt < pg_cnt)
-        {
-            //位图置0，表示释放内存
-            bitmap_set(&current_thread->userprog_vaddr.vaddr_bitmap, bit_idx_start + cnt++, 0);
-        }
+        page_frame_ref(pages[idx]);
+        page_table_set(vaddr + idx * PG_SIZE, pages[idx] | PG_US_U | PG_RW_W | PG_P_1);
     }
+    abandon_lock(&user_pool.lock);
+    return (void *)vaddr;
 }
 
 /**
- * @brief 释放以虚拟地址vaddr起始的cnt个物理页框
- * @param pf 内核还是用户的标记
- * @param vaddr_ 虚拟地址
- * @param pg_cnt 要释放物理页框的数量
- * @note 内存回收三步：     ① 调用pfree清空物理地址位图中的相应位，
- *                          ② 再调用page_table_pte_remove删除页表
- *                          ③ 清除虚拟地址位图中的相应位
+ * @brief 释放当前进程的整个用户地址空间，进程退出时调用
+ * @note 按页目录项整张页表地遍历，释放其中的页框、交换槽以及页表本身，不再逐个区域解除映射
+ * @note 共享文件映射被写过的页先写回文件；页目录所在的页仍在使用，由回收进程的父进程释放
  */
-void mfree_page(enum pool_flags pf, void *vaddr_, uint32_t pg_cnt)
+void user_vm_release(void)
 {
-    uint32_t pg_phyaddr;
-    uint32_t vaddr = (int32_t)vaddr_;
-    uint32_t page_cnt = 0;
-    ASSERT(pg_cnt >= 1 && vaddr % PG_SIZE == 0);
-
-    pg_phyaddr = addr_v2p(vaddr); //获得物理地址
-
-    //0x102000 表示的是低端1M的物理内存
-    ASSERT((pg_phyaddr % PG_SIZE) == 0 && pg_phyaddr >= 0x102000);
+    struct task_struct *current_thread = running_thread();
+    ASSERT(current_thread->pgdir != NULL);
 
-    if (pg_phyaddr >= user_pool.phy_addr_start)
+    //写回时会等待磁盘，不能持有内存池的锁
+    user_range_sync(0, 0xc0000000);
+    get_lock(&user_pool.lock);
+    uint32_t pde_idx;
+    for (pde_idx = 0; pde_idx < 0x300; pde_idx++)
     {
-        vaddr -= PG_SIZE;
-        while (page_cnt < pg_cnt)
+        uint32_t vaddr = pde_idx << 22;
+        uint32_t *pde = pde_ptr(vaddr);
+        if (!(*pde & PG_P_1))
         {
-            vaddr += PG_SIZE;
-            pg_phyaddr = addr_v2p(vaddr);
-
-            //确保物理地址属于用户物理内存池
-            ASSERT((pg_phyaddr % PG_SIZE) == 0 && pg_phyaddr >= user_pool.phy_addr_start);
-
-            //归还物理地址和虚拟地址
-            pfree(pg_phyaddr);
-            page_table_pte_remove(vaddr);
-            page_cnt++;
+            continue;
         }
 
-        vaddr_remove(pf, vaddr_, pg_cnt);
-    }
-    else
-    {
-        vaddr -= PG_SIZE;
-        while (page_cnt < pg_cnt)
+        uint32_t *pt = pte_ptr(vaddr);
+        uint32_t pte_idx;
+        for (pte_idx = 0; pte_idx < 1024; pte_idx++)
         {
-            vaddr += PG_SIZE;
-            pg_phyaddr = addr_v2p(vaddr);
-
-            ASSERT((pg_phyaddr % PG_SIZE) == 0 && pg_phyaddr >= kernel_pool.phy_addr_start && pg_phyaddr < user_pool.phy_addr_start);
-            pfree(pg_phyaddr);
-            page_table_pte_remove(vaddr);
-            page_cnt++;
+            if (pt[pte_idx] & PG_P_1)
+            {
+                pfree(pt[pte_idx] & 0xfffff000);
+            }
+            else if (pt[pte_idx] & PG_SWAP)
+            {
+                swap_entry_free(pt[pte_idx]);
+            }
         }
-        vaddr_remove(pf, vaddr_, pg_cnt);
+        //页表总是从内核内存池分配的
+        pfree(*pde & 0xfffff000);
+        *pde = 0;
     }
+    tlb_flush_all();
+    abandon_lock(&user_pool.lock);
+
+    //区域释放时放下对映射文件的引用
+    mm_release(&current_thread->mm);
 }
 
 /**
- * @brief 回收内存ptr
- * @param ptr 待回收的地址
- * @note 主要有两步 1.物理内存的bitmap置为1
- * @note           2. 虚拟内存的页表映射关系解除
+ * @brief 释放一个没有运行过的进程的用户页表，fork失败时调用
+ * @param pgdir 子进程的页目录，没有加载在CR3中
+ * @note 页表项是从父进程复制来的，逐项放下对页框和交换槽的引用；
+ *       父进程的页框只剩自己引用之后，写时复制故障直接恢复可写，不必复制
  */
-void sys_free(void *ptr)
+void user_pgdir_release(uint32_t *pgdir)
 {
-    ASSERT(ptr != NULL);
-    if (ptr != NULL)
+    get_lock(&user_pool.lock);
+    uint32_t pde_idx;
+    for (pde_idx = 0; pde_idx < 0x300; pde_idx++)
     {
-        enum pool_flags PF;
-        struct pool *mem_pool;
-
-        //如果是线程
-        if (running_thread()->pgdir == NULL)
+        if (!(pgdir[pde_idx] & PG_P_1))
         {
-            ASSERT((uint32_t)ptr >= K_HEAP_START);
-            PF = PF_KERNEL;
-            mem_pool = &kernel_pool;
-        }
-        else
-        {
-            PF = PF_USER;
-            mem_pool = &user_pool;
+            continue;
         }
 
-        get_lock(&mem_pool->lock);
-        struct mem_block *block = ptr;
-        struct arena *are = block2arena(block);
-
-        ASSERT(are->large == 0 || are->large == 1);
-        if (are->desc == NULL && are->large == true)
-        {
-            mfree_page(PF, are, are->cnt);
-        }
-        else
+        uint32_t pt_phyaddr = pgdir[pde_idx] & 0xfffff000;
+        uint32_t *pt = kmap(KMAP_PGTABLE, pt_phyaddr);
+        uint32_t pte_idx;
+        for (pte_idx = 0; pte_idx < 1024; pte_idx++)
         {
-            list_append(&are->desc->free_list, &block->free_elem);
-
-            if (++are->cnt == are->desc->blocks_per_arena)
+            if (pt[pte_idx] & PG_P_1)
             {
-                uint32_t block_idx;
-                for (block_idx = 0; block_idx < are->desc->blocks_per_arena; block_idx++)
-                {
-                    struct mem_block *block = arena2block(are, block_idx);
-                    ASSERT(elem_find(&are->desc->free_list, &block->free_elem));
-                    list_remove(&block->free_elem);
-                }
-                mfree_page(PF, are, 1);
+                pfree(pt[pte_idx] & 0xfffff000);
+            }
+            else if (pt[pte_idx] & PG_SWAP)
+            {
+                swap_entry_free(pt[pte_idx]);
             }
         }
-        abandon_lock(&mem_pool->lock);
+        kunmap(KMAP_PGTABLE);
+        pfree(pt_phyaddr);
+        pgdir[pde_idx] = 0;
     }
+    abandon_lock(&user_pool.lock);
 }
 
 /**
@@ -759,3 +3035,135 @@ void *get_one_page_without_operate_vaddr_bitmap(enum pool_flags pf, uint32_t vad
     return (void *)vaddr;
 }
 
+/**
+ * @brief 得到CPU支持的功能
+ * @return cpuid功能1返回的edx，CPUID_*位表示是否支持对应功能
+ */
+static uint32_t cpu_features(void)
+{
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile("cpuid"
+                 : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    return edx;
+}
+
+/**
+ * @brief 把物理内存映射到直接映射区
+ * @param mem_end 可用物理内存的结束地址
+ * @note 支持PSE时整4MB的部分用大页，一个页目录项就能映射；不支持PSE以及不足4MB的尾部填loader预先建好的页表
+ * @note 在创建任何进程之前调用，之后新建的页目录都会复制这些页目录项
+ * @note 只允许特权级0访问，用户进程不能通过它读写任意物理内存
+ */
+static void direct_map_init(uint32_t mem_end)
+{
+    direct_map_end = mem_end < DIRECT_MAP_SIZE ? mem_end : DIRECT_MAP_SIZE;
+    pse_enabled = (cpu_features() & CPUID_PSE) != 0;
+    if (pse_enabled)
+    {
+        asm volatile("movl %%cr4, %%eax; orl %0, %%eax; movl %%eax, %%cr4" ::"i"(CR4_PSE)
+                     : "eax", "memory");
+    }
+
+    uint32_t large_cnt = 0;
+    uint32_t phyaddr = 0;
+    while (phyaddr < direct_map_end)
+    {
+        uint32_t vaddr = DIRECT_MAP_START + phyaddr;
+        if (pse_enabled && direct_map_end - phyaddr >= LARGE_PAGE_SIZE)
+        {
+            *pde_ptr(vaddr) = phyaddr | PG_PS | PG_US_S | PG_RW_W | PG_P_1;
+            phyaddr += LARGE_PAGE_SIZE;
+            large_cnt++;
+        }
+        else
+        {
+            *pte_ptr(vaddr) = phyaddr | PG_US_S | PG_RW_W | PG_P_1;
+            phyaddr += PG_SIZE;
+        }
+    }
+    tlb_flush_all();
+
+    put_str("    direct_map_bytes:");
+    put_int(direct_map_end);
+    put_str(" large_pages:");
+    put_int(large_cnt);
+    put_str("\n");
+}
+
+/**
+ * @brief 把内核空间已有的映射都标记为全局页，并打开CR4的PGE位
+ * @note 第0和第768个页目录项共用loader建的第一张页表，低端1MB的恒等映射不能是全局的，
+ *       否则进程在这里的用户页会被它在TLB中的缓存覆盖，所以先给第768个页目录项换一张自己的页表
+ * @note 此后新建的内核映射由page_table_set等函数加上G位
+ */
+static void global_pages_init(void)
+{
+    if (!(cpu_features() & CPUID_PGE))
+    {
+        return;
+    }
+    pg_global = PG_GLOBAL;
+
+    uint32_t pt_phyaddr = (uint32_t)palloc_order(PF_KERNEL, 0);
+    if (pt_phyaddr == 0)
+    {
+        PANIC("global_pages_init: alloc page table failed!");
+    }
+    uint32_t *new_pt = addr_p2v(pt_phyaddr);
+    memcpy(new_pt, pte_ptr(0xc0000000), PG_SIZE);
+    *pde_ptr(0xc0000000) = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+    tlb_flush_all();
+
+    uint32_t vaddr;
+    for (vaddr = 0xc0000000; vaddr < 0xffc00000; vaddr += LARGE_PAGE_SIZE)
+    {
+        uint32_t *pde = pde_ptr(vaddr);
+        if (!(*pde & PG_P_1))
+        {
+            continue;
+        }
+        if (*pde & PG_PS)
+        {
+            *pde |= PG_GLOBAL;
+            continue;
+        }
+        uint32_t *pt = pte_ptr(vaddr);
+        uint32_t pte_idx;
+        for (pte_idx = 0; pte_idx < 1024; pte_idx++)
+        {
+            if (pt[pte_idx] & PG_P_1)
+            {
+                pt[pte_idx] |= PG_GLOBAL;
+            }
+        }
+    }
+    asm volatile("movl %%cr4, %%eax; orl %0, %%eax; movl %%eax, %%cr4" ::"i"(CR4_PGE)
+                 : "eax", "memory");
+}
+
+/**
+ * @brief 内存管理部分初始化入口
+ */
+void mem_init()
+{
+    put_str("memory init statr!\n");
+    //内存布局是之前在loader.S中通过e820得到的
+    mem_pool_init();
+    direct_map_init(max_pfn * PG_SIZE);
+    global_pages_init();
+    block_desc_init(k_block_descs);
+    list_init(&shrinker_list);
+    list_init(&pgdir_list);
+
+    //保留临时映射窗口的虚拟地址，只占位不分配物理页
+    kmap_vaddr_start = (uint32_t)vaddr_get(PF_KERNEL, KMAP_SLOT_CNT);
+
+    //零页，未写过的用户页都映射到这里
+    zero_page_phyaddr = addr_v2p((uint32_t)get_kernel_pages(1));
+
+    //注册页故障处理函数，并打开CR0的WP位，使内核写只读页也会触发页故障，写时复制才能生效
+    register_handler(0x0e, page_fault_handler);
+    asm volatile("movl %%cr0, %%eax; orl $0x10000, %%eax; movl %%eax, %%cr0" ::
+                     : "eax", "memory");
+    put_str("memory init done!\n");
+}
@@ -10,13 +10,16 @@
 #define PG_RW_W 2 //表示RW位为w，表示此页允许读、写、执行
 #define PG_US_S 0 //表示US位的值为S，只允许特权级0 1 2的程序访问
 #define PG_US_U 4 //表示都能访问
+#define PG_ACCESSED 0x20 //表示A位，CPU访问此页时置1
+#define PG_DIRTY 0x40 //表示D位，CPU写此页时置1
+#define PG_PS 0x80 //页目录项的PS位，为1表示直接映射4MB的大页，需要打开CR4的PSE位
+#define PG_GLOBAL 0x100 //G位，打开CR4的PGE位后，重新加载CR3时不刷新此页在TLB中的缓存
+#define PG_COW 0x200 //页表项中可供软件使用的位，表示此页是写时复制共享的只读页
+#define PG_SWAP 0x400 //P位为0时有效，表示此页已被换出，高20位是交换槽号
 
-//虚拟内存池，用于虚拟地址管理
-struct virtual_addr
-{
-    struct bitmap vaddr_bitmap; //虚拟地址用到的位图结构
-    uint32_t vaddr_start;       //虚拟地址起始地址
-};
+//页故障错误码
+#define PF_ERR_PRESENT 1 //为1表示页存在，是保护违例引起的
+#define PF_ERR_WRITE 2   //为1表示写操作引起的
 
 //内存池标记，用于判断用哪个内存池
 enum pool_flags
@@ -28,6 +31,31 @@ enum pool_flags
 extern struct pool kernel_pool,
     user_pool;
 
+#define BUDDY_MAX_ORDER 10 //伙伴系统最大阶，2^10个页框即4MB
+#define LARGE_PAGE_SIZE 0x400000 //4MB大页的大小，即一个页目录项覆盖的范围
+
+//页框状态标记
+#define PFF_FREE 1     //此页框是伙伴系统中某个空闲块的首页
+#define PFF_RESERVED 2 //此页框不归任何内存池管理
+#define PFF_USER 4     //此页框当前归用户内存池所有，否则归内核内存池，随出借一起改变
+#define PFF_ARENA 8    //此页框属于跨多页的arena或用户arena，slab字段指向所属arena，不会被换出
+
+#define POOL_LEND_ORDER 8    //内存池之间每次出借的块的阶，2^8个页框即1MB
+#define POOL_RESERVE_SHIFT 4 //出借后内存池至少保留初始页数的1/16空闲页
+
+//物理页框描述符，每个物理页框对应一个，按页框号pfn组成frame_table数组
+struct page_frame
+{
+    union
+    {
+        struct list_elem free_elem; //空闲时，在伙伴系统空闲链表中的节点
+        void *slab;                 //被slab使用时，指向所属的slab
+    };
+    uint16_t ref_cnt;           //引用计数
+    uint8_t order;              //所在块的阶，仅块首页有效
+    uint8_t flags;              //页框状态
+};
+
 //内存块
 struct mem_block
 {
@@ -38,22 +66,185 @@ struct mem_block_desc
 {
     uint32_t block_size;       //内存块大小
     uint32_t blocks_per_arena; //本内存仓库arena中可容纳此mem_block的数量
+    uint32_t arena_pages;      //每个arena占用的页数
     struct list free_list;     //mem_block 链表
+    uint32_t arena_cnt;        //此规格现有的arena数量
+    uint32_t free_cnt;         //free_list中的空闲块数，即arena中未被使用的部分
+    uint32_t empty_cnt;        //全部块都空闲、暂时保留不归还的arena数量
+};
+
+#define MEM_SMALL_DESC_CNT 7                                    //16~1024字节的小规格，arena只占一页，有私有缓存
+#define MEM_MEDIUM_DESC_CNT 8                                   //1KB~16KB的中等规格，arena跨多页
+#define MEM_DESC_CNT (MEM_SMALL_DESC_CNT + MEM_MEDIUM_DESC_CNT) //内存块规格总数
+#define ARENA_KEEP_MAX 2                                        //每种规格最多保留的全空arena数
+
+//临时映射窗口，用于访问直接映射区之外的物理页框，使用期间必须关中断
+enum kmap_slot
+{
+    KMAP_PGTABLE, //访问其他进程的页表
+    KMAP_COPY,    //写时复制时访问新页框
+    KMAP_ZERO,    //idle线程清零页框
+    KMAP_SLOT_CNT
+};
+
+#define ZERO_STOCK_MAX 64 //每个内存池最多预先清零的页框数
+
+#define MAG_SIZE 8  //每种规格的私有缓存最多容纳的内存块数
+#define MAG_BATCH 4 //私有缓存与arena之间每次批量搬运的内存块数
+
+//任务私有的内存块缓存，只有所属任务访问，因此存取不需要加锁
+struct mem_magazine
+{
+    uint32_t cnt;           //当前缓存的内存块数
+    enum pool_flags pf;     //缓存的内存块所属的内存池，为0表示还没用过
+    void *blocks[MAG_SIZE]; //缓存的内存块，按栈的方式存取
+    uint32_t hit_cnt;       //不加锁就完成分配或释放的次数
+    uint32_t miss_cnt;      //需要加锁访问arena的次数
+};
+
+#define SHRINK_BATCH 32 //每次让一个收缩器回收的最多对象数
+
+//收缩器的优先级，数值小的先收缩，丢掉后重建代价越小的越靠前
+#define SHRINK_PRIO_ARENA 0 //全空的内核arena，不含任何数据
+#define SHRINK_PRIO_SLAB 1  //slab缓存保留的全空slab
+#define SHRINK_PRIO_INODE 2 //缓存的inode，再次打开时要读磁盘
+
+//内存紧张时可以收缩的内核缓存，由各模块注册
+struct shrinker
+{
+    const char *name;              //名称
+    uint32_t (*count)(void);       //可以回收的对象数
+    uint32_t (*scan)(uint32_t nr); //回收至多nr个对象，返回实际回收的数量；除内核内存池的锁外只能尝试加锁
+    uint8_t priority;              //SHRINK_PRIO_*
+    struct list_elem shrinker_tag; //在收缩器链表中的节点
+};
+
+//单个内存池的统计，以页为单位
+struct mem_pool_info
+{
+    uint32_t total_pages;   //当前归本池所有的页框数
+    uint32_t free_pages;    //伙伴系统中的空闲页框数
+    uint32_t zero_pages;    //预先清零备用的页框数
+    uint32_t zero_hit;      //需要清零的分配直接拿到清零页框的次数
+    uint32_t zero_miss;     //需要清零的分配只能自己清零的次数
+    uint32_t peak_used;     //使用页框数的峰值
+    uint32_t reserve_pages; //不再出借的水位线
+    uint32_t borrow_cnt;    //向另一个池借入的次数
+    uint32_t large_cnt;     //超过1024字节、直接按页分配的内存块数
+    uint32_t large_pages;   //这些大内存块占用的页数
+};
+
+//单个内存块规格的统计
+struct mem_desc_info
+{
+    uint32_t block_size;       //内存块大小
+    uint32_t blocks_per_arena; //每个arena的内存块数
+    uint32_t arena_cnt;        //arena数量
+    uint32_t free_blocks;      //arena中空闲的内存块数
+    uint32_t empty_arenas;     //保留的全空arena数
+    uint32_t cached_blocks;    //调用者私有缓存中的内存块数
+    uint32_t mag_hits;         //调用者私有缓存不加锁就完成分配或释放的次数
+    uint32_t mag_misses;       //调用者私有缓存需要加锁访问arena的次数
+};
+
+#define KMEM_NAME_LEN 16  //对象缓存名称最大长度
+#define KMEM_CACHE_MAX 16 //系统中最多的对象缓存数量
+
+//单个对象缓存的统计
+struct kmem_cache_info
+{
+    char name[KMEM_NAME_LEN]; //缓存名称
+    uint32_t obj_size;        //对象大小
+    uint32_t active_objs;     //正在使用的对象数
+    uint32_t total_objs;      //所有slab中的对象总数
+    uint32_t free_slabs;      //全空的slab数
+};
+
+//meminfo系统调用返回的内存统计
+struct mem_info
+{
+    struct mem_pool_info kernel_pool;                //内核内存池
+    struct mem_pool_info user_pool;                  //用户内存池
+    struct mem_desc_info kernel_descs[MEM_DESC_CNT]; //内核堆的各规格
+    struct mem_desc_info user_descs[MEM_DESC_CNT];   //调用进程堆的各规格，内核线程调用时全为0
+    uint32_t kva_free_pages;                         //内核堆空闲的虚拟页数
+    uint32_t kva_extent_cnt;                         //内核堆空闲虚拟地址的区间数
+    uint32_t kva_largest_pages;                      //内核堆最大的空闲虚拟地址区间页数
+    uint32_t swap_total_pages;                       //交换分区的总页数，没有交换分区时为0
+    uint32_t swap_free_pages;                        //交换分区空闲的页数
+    uint32_t swap_out_cnt;                           //累计换出的页数
+    uint32_t swap_in_cnt;                            //累计换入的页数
+    uint32_t cr3_load_cnt;                           //切换任务时重新加载CR3的次数
+    uint32_t cr3_skip_cnt;                           //切换任务时页目录不变、省去重新加载CR3的次数
+    uint32_t cache_cnt;                              //内核对象缓存的数量
+    struct kmem_cache_info caches[KMEM_CACHE_MAX];   //各内核对象缓存
 };
 
-#define MEM_DESC_CNT 7
+//mmap的权限，与Linux的取值相同
+#define PROT_NONE 0  //不可访问
+#define PROT_READ 1  //可读
+#define PROT_WRITE 2 //可写，x86上可写的页同时可读
+
+//mmap的标记
+#define MAP_SHARED 1       //与其他进程共享
+#define MAP_PRIVATE 2      //私有，写的时候复制
+#define MAP_FIXED 0x10     //必须映射到addr，覆盖原有的映射
+#define MAP_ANONYMOUS 0x20 //不对应文件，内容为0
+#define MAP_FAILED ((void *)-1)
+
+//mmap系统调用的参数，超过了系统调用能直接传递的3个，放在结构体中传地址
+struct mmap_args
+{
+    uint32_t addr;   //希望映射到的地址，为0时由内核选择
+    uint32_t len;    //字节数
+    uint32_t prot;   //PROT_*
+    uint32_t flags;  //MAP_*
+    int32_t fd;      //映射的文件，匿名映射时忽略
+    uint32_t offset; //文件中的偏移，页对齐，匿名映射时忽略
+};
 
 void mem_init(void);
 void *get_kernel_pages(uint32_t pg_cnt);
 void *get_user_pages(uint32_t pg_cnt);
-void *malloc_page(enum pool_flags pf, uint32_t pg_cnt);
+void *malloc_page(enum pool_flags pf, uint32_t pg_cnt, bool zero);
 void malloc_init(void);
 uint32_t *pte_ptr(uint32_t vaddr);
 uint32_t *pde_ptr(uint32_t vaddr);
 void *get_a_page(enum pool_flags pf, uint32_t vaddr);
 uint32_t addr_v2p(uint32_t vaddr);
+void *addr_p2v(uint32_t phyaddr);
 void block_desc_init(struct mem_block_desc *desc_array);
+void magazine_init(struct mem_magazine *mag_array);
 void *sys_malloc(uint32_t size);
 void sys_free(void *ptr);
 void *get_one_page_without_operate_vaddr_bitmap(enum pool_flags pf, uint32_t vaddr);
-void mfree_page(enum pool_flags pf, void *vaddr_, uint32_t pg_cnt);
\ No newline at end of file
+void mfree_page(enum pool_flags pf, void *vaddr_, uint32_t pg_cnt);
+void *palloc_order(enum pool_flags pf, uint8_t order);
+void free_kernel_pages(void *vaddr, uint32_t pg_cnt);
+void *kernel_vaddr_get(uint32_t pg_cnt);
+void kernel_vaddr_put(void *vaddr, uint32_t pg_cnt);
+void *get_large_pages(uint32_t lp_cnt, bool zero);
+void free_large_pages(void *vaddr, uint32_t lp_cnt);
+void kernel_pde_copy(uint32_t *pgdir);
+void kernel_pde_drop(uint32_t *pgdir);
+struct page_frame *vaddr2frame(uint32_t vaddr);
+struct page_frame *phy2frame(uint32_t pg_phyaddr);
+void pfree(uint32_t pg_phyaddr);
+void page_frame_ref(uint32_t pg_phyaddr);
+void *kmap(enum kmap_slot slot, uint32_t pg_phyaddr);
+void kunmap(enum kmap_slot slot);
+bool zero_stock_refill(void);
+void sys_meminfo(struct mem_info *info);
+uint32_t arena_reclaim(enum pool_flags pf);
+uint32_t sys_brk(uint32_t new_brk);
+void *sys_mmap(struct mmap_args *args);
+int32_t sys_munmap(void *addr, uint32_t len);
+int32_t sys_mprotect(void *addr, uint32_t len, uint32_t prot);
+int32_t sys_msync(void *addr, uint32_t len);
+void *user_pages_share(uint32_t *pages, uint32_t pg_cnt);
+void user_vm_release(void);
+void user_pgdir_release(uint32_t *pgdir);
+uint32_t user_frame_fill(void *src);
+void shrinker_register(struct shrinker *shrinker);
+uint32_t shrink_caches(uint32_t pg_cnt);
+void reclaim_init(void);
@@ -0,0 +1,229 @@
+#include "shm.h"
+#include "memory.h"
+#include "global.h"
+#include "debug.h"
+#include "string.h"
+#include "sync.h"
+#include "interrupt.h"
+#include "thread.h"
+
+/*
+ * 共享内存段持有其每个页框的一个引用，映射它的每个页表项再各持有一个引用。
+ * 最后一次shm_close只去掉名字和段自己的引用，还在映射中的页框要等解除映射时才真正释放。
+ * 每个进程在shm_opened中记下自己打开的段，同一进程重复打开只算一次，进程退出时关闭它打开的所有段
+ */
+
+//一个共享内存段
+struct shm_seg
+{
+    char name[SHM_NAME_LEN]; //名称，为空表示此项空闲
+    uint32_t pg_cnt;         //页数
+    uint32_t open_cnt;       //被打开的次数
+    uint32_t *pages;         //各页框的物理地址，放在内核页中
+};
+
+static struct shm_seg shm_table[SHM_MAX_CNT]; //所有共享内存段
+static struct lock shm_lock;                  //访问shm_table时持有
+
+/**
+ * @brief 初始化共享内存模块
+ */
+void shm_init(void)
+{
+    lock_init(&shm_lock);
+    memset(shm_table, 0, sizeof(shm_table));
+}
+
+/**
+ * @brief 释放共享内存段自己持有的页框引用和页框数组，并把此项标为空闲
+ * @param seg 共享内存段
+ * @param pg_cnt 已经分配的页框数
+ */
+static void shm_seg_release(struct shm_seg *seg, uint32_t pg_cnt)
+{
+    uint32_t idx;
+    for (idx = 0; idx < pg_cnt; idx++)
+    {
+        pfree(seg->pages[idx]);
+    }
+    free_kernel_pages(seg->pages, DIV_ROUND_UP(seg->pg_cnt * sizeof(uint32_t), PG_SIZE));
+    seg->name[0] = 0;
+}
+
+/**
+ * @brief 为共享内存段分配pg_cnt个清零的用户页框
+ * @param seg 共享内存段，名称和页数已经填好
+ * @return 成功返回true，失败时释放已分配的页框并返回false
+ */
+static bool shm_seg_alloc(struct shm_seg *seg)
+{
+    seg->pages = get_kernel_pages(DIV_ROUND_UP(seg->pg_cnt * sizeof(uint32_t), PG_SIZE));
+    if (seg->pages == NULL)
+    {
+        return false;
+    }
+
+    uint32_t idx;
+    for (idx = 0; idx < seg->pg_cnt; idx++)
+    {
+        uint32_t pg_phyaddr = (uint32_t)palloc_order(PF_USER, 0);
+        if (pg_phyaddr == 0)
+        {
+            shm_seg_release(seg, idx);
+            return false;
+        }
+        //页框还没有映射，通过临时窗口清零
+        enum intr_status old_status = intr_disable();
+        memset(kmap(KMAP_COPY, pg_phyaddr), 0, PG_SIZE);
+        kunmap(KMAP_COPY);
+        intr_set_status(old_status);
+        seg->pages[idx] = pg_phyaddr;
+    }
+    return true;
+}
+
+/**
+ * @brief 打开名为name的共享内存段，不存在时创建，shm_open系统调用的实现
+ * @param name 名称
+ * @param size 字节数，打开已有的段时不能超过它的大小
+ * @return 成功返回共享内存段的编号，失败返回-1
+ * @note 新建的段内容为0，页框在创建时全部分配
+ */
+int32_t sys_shm_open(const char *name, uint32_t size)
+{
+    struct task_struct *cur = running_thread();
+    uint32_t pg_cnt = DIV_ROUND_UP(size, PG_SIZE);
+    if (name == NULL || name[0] == 0 || strlen(name) >= SHM_NAME_LEN || size == 0 || size > SHM_MAX_PAGES * PG_SIZE)
+    {
+        return -1;
+    }
+
+    get_lock(&shm_lock);
+    int32_t free_id = -1;
+    int32_t shm_id;
+    for (shm_id = 0; shm_id < SHM_MAX_CNT; shm_id++)
+    {
+        struct shm_seg *seg = &shm_table[shm_id];
+        if (seg->name[0] == 0)
+        {
+            if (free_id == -1)
+            {
+                free_id = shm_id;
+            }
+        }
+        else if (!strcmp(seg->name, name))
+        {
+            if (pg_cnt > seg->pg_cnt)
+            {
+                abandon_lock(&shm_lock);
+                return -1;
+            }
+            if (!(cur->shm_opened & (1 << shm_id)))
+            {
+                cur->shm_opened |= 1 << shm_id;
+                seg->open_cnt++;
+            }
+            abandon_lock(&shm_lock);
+            return shm_id;
+        }
+    }
+
+    if (free_id == -1)
+    {
+        abandon_lock(&shm_lock);
+        return -1;
+    }
+    struct shm_seg *seg = &shm_table[free_id];
+    seg->pg_cnt = pg_cnt;
+    if (!shm_seg_alloc(seg))
+    {
+        abandon_lock(&shm_lock);
+        return -1;
+    }
+    strcpy(seg->name, name);
+    seg->open_cnt = 1;
+    cur->shm_opened |= 1 << free_id;
+    abandon_lock(&shm_lock);
+    return free_id;
+}
+
+/**
+ * @brief 把共享内存段映射到当前进程，shm_map系统调用的实现
+ * @param shm_id 共享内存段的编号
+ * @return 成功返回映射的起始地址，失败返回MAP_FAILED
+ * @note 只能映射当前进程打开了的段，映射整个段，用munmap解除；fork出的子进程继续共享这段映射
+ */
+void *sys_shm_map(int32_t shm_id)
+{
+    if (shm_id < 0 || shm_id >= SHM_MAX_CNT || !(running_thread()->shm_opened & (1 << shm_id)))
+    {
+        return MAP_FAILED;
+    }
+
+    get_lock(&shm_lock);
+    struct shm_seg *seg = &shm_table[shm_id];
+    void *vaddr = seg->name[0] == 0 ? NULL : user_pages_share(seg->pages, seg->pg_cnt);
+    abandon_lock(&shm_lock);
+    return vaddr == NULL ? MAP_FAILED : vaddr;
+}
+
+/**
+ * @brief 关闭共享内存段，最后一次关闭时删除它，shm_close系统调用的实现
+ * @param shm_id 共享内存段的编号
+ * @return 成功返回0，当前进程没有打开这个段时返回-1
+ * @note 已经建立的映射不受影响
+ */
+int32_t sys_shm_close(int32_t shm_id)
+{
+    struct task_struct *cur = running_thread();
+    if (shm_id < 0 || shm_id >= SHM_MAX_CNT || !(cur->shm_opened & (1 << shm_id)))
+    {
+        return -1;
+    }
+
+    get_lock(&shm_lock);
+    struct shm_seg *seg = &shm_table[shm_id];
+    ASSERT(seg->name[0] != 0 && seg->open_cnt > 0);
+    cur->shm_opened &= ~(1 << shm_id);
+    if (--seg->open_cnt == 0)
+    {
+        shm_seg_release(seg, seg->pg_cnt);
+    }
+    abandon_lock(&shm_lock);
+    return 0;
+}
+
+/**
+ * @brief fork出的子进程继承父进程打开的共享内存段，各段的打开次数加一
+ * @param pthread 子进程，shm_opened已从父进程复制
+ */
+void shm_task_dup(struct task_struct *pthread)
+{
+    get_lock(&shm_lock);
+    int32_t shm_id;
+    for (shm_id = 0; shm_id < SHM_MAX_CNT; shm_id++)
+    {
+        if (pthread->shm_opened & (1 << shm_id))
+        {
+            shm_table[shm_id].open_cnt++;
+        }
+    }
+    abandon_lock(&shm_lock);
+}
+
+/**
+ * @brief 进程退出时关闭它打开的所有共享内存段
+ * @param pthread 退出的进程，即当前进程
+ */
+void shm_task_release(struct task_struct *pthread)
+{
+    ASSERT(pthread == running_thread());
+    int32_t shm_id;
+    for (shm_id = 0; shm_id < SHM_MAX_CNT; shm_id++)
+    {
+        if (pthread->shm_opened & (1 << shm_id))
+        {
+            sys_shm_close(shm_id);
+        }
+    }
+}
@@ -0,0 +1,16 @@
+//有名字的共享内存段，多个进程的页表映射同一组物理页框
+#pragma once
+#include "stdint.h"
+
+struct task_struct;
+
+#define SHM_NAME_LEN 16    //共享内存段名称的最大长度，包括结尾的0
+#define SHM_MAX_CNT 16     //系统中最多的共享内存段数
+#define SHM_MAX_PAGES 1024 //每个共享内存段最多的页数，即4MB
+
+void shm_init(void);
+int32_t sys_shm_open(const char *name, uint32_t size);
+void *sys_shm_map(int32_t shm_id);
+int32_t sys_shm_close(int32_t shm_id);
+void shm_task_dup(struct task_struct *pthread);
+void shm_task_release(struct task_struct *pthread);
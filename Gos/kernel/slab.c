@@ -0,0 +1,340 @@
+#include "slab.h"
+#include "memory.h"
+#include "global.h"
+#include "string.h"
+#include "debug.h"
+#include "stdio-kernel.h"
+#include "interrupt.h"
+
+#define SLAB_END 0xffff     //空闲对象链表结束标记
+#define SLAB_OFF_MAX_OBJS 8 //slab描述符放在页外时，一个slab最多的对象数
+
+/*
+ * slab描述符，一个slab占一个页框
+ * 对象较小时描述符放在页框开头，其后是各对象
+ * 对象较大时描述符单独从slab_desc_cache分配，页框全部用来存放对象
+ */
+struct slab
+{
+    struct list_elem slab_tag; //在kmem_cache三个slab链表之一中的节点
+    struct kmem_cache *cache;  //所属的缓存
+    void *objs;                //第一个对象的地址
+    uint16_t inuse;            //已分配出去的对象数
+    uint16_t free_idx;         //第一个空闲对象的下标
+    uint16_t next_free[];      //空闲对象链表，next_free[i]为对象i之后的空闲对象下标
+};
+
+static struct kmem_cache caches[KMEM_CACHE_MAX];  //所有缓存
+static uint32_t cache_cnt = 0;                    //已创建的缓存数量
+static struct kmem_cache *slab_desc_cache = NULL; //存放页外slab描述符的缓存
+
+/**
+ * @brief 计算描述符放在页内时一个slab能容纳的对象数
+ * @param obj_size 对象大小
+ * @return 对象数
+ */
+static uint32_t on_slab_objs(uint32_t obj_size)
+{
+    uint32_t obj_cnt = (PG_SIZE - sizeof(struct slab)) / (obj_size + sizeof(uint16_t));
+    //描述符之后按4字节对齐，可能要少放一个
+    while (obj_cnt > 0 &&
+           DIV_ROUND_UP(sizeof(struct slab) + obj_cnt * sizeof(uint16_t), 4) * 4 + obj_cnt * obj_size > PG_SIZE)
+    {
+        obj_cnt--;
+    }
+    return obj_cnt;
+}
+
+/**
+ * @brief 按对象大小填写缓存的各项信息
+ * @param cache 待初始化的缓存
+ * @param name 缓存名称
+ * @param size 对象大小
+ * @param ctor 对象构造函数
+ */
+static void kmem_cache_setup(struct kmem_cache *cache, const char *name, uint32_t size, kmem_ctor *ctor)
+{
+    memset(cache, 0, sizeof(struct kmem_cache));
+    strcpy(cache->name, name);
+    cache->obj_size = DIV_ROUND_UP(size, 4) * 4;
+    cache->ctor = ctor;
+
+    //大对象描述符放在页内太浪费，能多放对象时就放到页外
+    cache->objs_per_slab = on_slab_objs(cache->obj_size);
+    uint32_t off_objs = PG_SIZE / cache->obj_size;
+    if (cache->obj_size > PG_SIZE / SLAB_OFF_MAX_OBJS && off_objs > cache->objs_per_slab)
+    {
+        cache->off_slab = true;
+        cache->objs_per_slab = off_objs;
+    }
+
+    lock_init(&cache->lock);
+    list_init(&cache->slabs_partial);
+    list_init(&cache->slabs_full);
+    list_init(&cache->slabs_free);
+}
+
+/**
+ * @brief 创建一个对象缓存
+ * @param name 缓存名称
+ * @param size 对象大小，不超过一页
+ * @param ctor 对象构造函数，不需要时传NULL
+ * @return 成功返回缓存指针，失败返回NULL
+ */
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size, kmem_ctor *ctor)
+{
+    ASSERT(size > 0 && size <= PG_SIZE && strlen(name) < KMEM_NAME_LEN);
+
+    //第一次创建时先建立存放页外slab描述符的缓存
+    if (slab_desc_cache == NULL)
+    {
+        slab_desc_cache = &caches[cache_cnt++];
+        kmem_cache_setup(slab_desc_cache, "slab", sizeof(struct slab) + SLAB_OFF_MAX_OBJS * sizeof(uint16_t), NULL);
+    }
+    if (cache_cnt == KMEM_CACHE_MAX)
+    {
+        return NULL;
+    }
+
+    struct kmem_cache *cache = &caches[cache_cnt++];
+    kmem_cache_setup(cache, name, size, ctor);
+    return cache;
+}
+
+/**
+ * @brief 为cache新建一个slab，并对其中的对象调用构造函数
+ * @param cache 对象缓存
+ * @return 成功返回slab，失败返回NULL
+ * @note 调用者需持有cache->lock
+ */
+static struct slab *slab_create(struct kmem_cache *cache)
+{
+    void *page = get_kernel_pages(1);
+    if (page == NULL)
+    {
+        return NULL;
+    }
+
+    struct slab *slab;
+    if (cache->off_slab)
+    {
+        slab = kmem_cache_alloc(slab_desc_cache);
+        if (slab == NULL)
+        {
+            free_kernel_pages(page, 1);
+            return NULL;
+        }
+        slab->objs = page;
+    }
+    else
+    {
+        slab = page;
+        slab->objs = (void *)((uint32_t)page +
+                              DIV_ROUND_UP(sizeof(struct slab) + cache->objs_per_slab * sizeof(uint16_t), 4) * 4);
+    }
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->free_idx = 0;
+
+    //串起空闲对象链表并构造对象
+    uint32_t obj_idx;
+    for (obj_idx = 0; obj_idx < cache->objs_per_slab; obj_idx++)
+    {
+        slab->next_free[obj_idx] = obj_idx + 1;
+        if (cache->ctor != NULL)
+        {
+            cache->ctor((void *)((uint32_t)slab->objs + obj_idx * cache->obj_size));
+        }
+    }
+    slab->next_free[cache->objs_per_slab - 1] = SLAB_END;
+
+    //释放对象时通过页框描述符找到slab
+    vaddr2frame((uint32_t)page)->slab = slab;
+    cache->total_objs += cache->objs_per_slab;
+    return slab;
+}
+
+/**
+ * @brief 销毁一个全部空闲的slab，归还页框
+ * @param cache 对象缓存
+ * @param slab 待销毁的slab
+ * @note 调用者需持有cache->lock
+ */
+static void slab_destroy(struct kmem_cache *cache, struct slab *slab)
+{
+    ASSERT(slab->inuse == 0);
+    void *page = (void *)((uint32_t)slab->objs & 0xfffff000);
+    cache->total_objs -= cache->objs_per_slab;
+    if (cache->off_slab)
+    {
+        kmem_cache_free(slab_desc_cache, slab);
+    }
+    free_kernel_pages(page, 1);
+}
+
+/**
+ * @brief 从cache中分配一个对象
+ * @param cache 对象缓存
+ * @return 成功返回对象地址，失败返回NULL
+ * @note 对象不会被清零，复用的对象保持上次释放时的内容
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    struct slab *slab;
+    get_lock(&cache->lock);
+
+    //优先从部分使用的slab中分配，其次是空闲slab，都没有再新建
+    if (!list_empty(&cache->slabs_partial))
+    {
+        slab = elem2entry(struct slab, slab_tag, cache->slabs_partial.head.next);
+    }
+    else
+    {
+        if (!list_empty(&cache->slabs_free))
+        {
+            slab = elem2entry(struct slab, slab_tag, list_pop(&cache->slabs_free));
+        }
+        else
+        {
+            slab = slab_create(cache);
+            if (slab == NULL)
+            {
+                abandon_lock(&cache->lock);
+                return NULL;
+            }
+        }
+        list_push(&cache->slabs_partial, &slab->slab_tag);
+    }
+
+    uint16_t obj_idx = slab->free_idx;
+    ASSERT(obj_idx != SLAB_END);
+    slab->free_idx = slab->next_free[obj_idx];
+    if (++slab->inuse == cache->objs_per_slab)
+    {
+        list_remove(&slab->slab_tag);
+        list_push(&cache->slabs_full, &slab->slab_tag);
+    }
+    cache->active_objs++;
+
+    abandon_lock(&cache->lock);
+    return (void *)((uint32_t)slab->objs + obj_idx * cache->obj_size);
+}
+
+/**
+ * @brief 把对象obj归还给cache
+ * @param cache 对象缓存
+ * @param obj 由kmem_cache_alloc得到的对象
+ * @note 只保留一个全部空闲的slab，多余的空闲slab直接归还页框
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    ASSERT(obj != NULL);
+    struct slab *slab = vaddr2frame((uint32_t)obj)->slab;
+    ASSERT(slab->cache == cache);
+
+    uint32_t obj_idx = ((uint32_t)obj - (uint32_t)slab->objs) / cache->obj_size;
+    ASSERT((uint32_t)slab->objs + obj_idx * cache->obj_size == (uint32_t)obj);
+
+    get_lock(&cache->lock);
+    slab->next_free[obj_idx] = slab->free_idx;
+    slab->free_idx = obj_idx;
+    if (slab->inuse-- == cache->objs_per_slab)
+    {
+        //原来是满的，回到部分使用链表
+        list_remove(&slab->slab_tag);
+        list_push(&cache->slabs_partial, &slab->slab_tag);
+    }
+    if (slab->inuse == 0)
+    {
+        list_remove(&slab->slab_tag);
+        if (list_empty(&cache->slabs_free))
+        {
+            list_push(&cache->slabs_free, &slab->slab_tag);
+        }
+        else
+        {
+            slab_destroy(cache, slab);
+        }
+    }
+    cache->active_objs--;
+    abandon_lock(&cache->lock);
+}
+
+/**
+ * @brief 得到每个缓存的对象使用情况
+ * @param info 输出的统计信息数组，至少KMEM_CACHE_MAX项
+ * @return 缓存的数量
+ */
+uint32_t kmem_cache_stat(struct kmem_cache_info *info)
+{
+    uint32_t cache_idx;
+    enum intr_status old_status = intr_disable();
+    for (cache_idx = 0; cache_idx < cache_cnt; cache_idx++)
+    {
+        struct kmem_cache *cache = &caches[cache_idx];
+        strcpy(info[cache_idx].name, cache->name);
+        info[cache_idx].obj_size = cache->obj_size;
+        info[cache_idx].active_objs = cache->active_objs;
+        info[cache_idx].total_objs = cache->total_objs;
+        info[cache_idx].free_slabs = list_len(&cache->slabs_free);
+    }
+    intr_set_status(old_status);
+    return cache_cnt;
+}
+
+/**
+ * @brief 所有缓存保留的全空slab数，每个占一页
+ * @return slab数
+ */
+static uint32_t kmem_shrink_count(void)
+{
+    uint32_t slab_cnt = 0;
+    uint32_t cache_idx;
+    enum intr_status old_status = intr_disable();
+    for (cache_idx = 0; cache_idx < cache_cnt; cache_idx++)
+    {
+        slab_cnt += list_len(&caches[cache_idx].slabs_free);
+    }
+    intr_set_status(old_status);
+    return slab_cnt;
+}
+
+/**
+ * @brief 销毁至多nr个全空slab
+ * @param nr 最多销毁的slab数
+ * @return 实际销毁的slab数
+ * @note 调用者可能持有内核内存池的锁，而分配slab时先持有缓存的锁再申请页，
+ *       所以这里等待缓存的锁可能互相等待，锁被别人持有的缓存直接跳过
+ */
+static uint32_t kmem_shrink_scan(uint32_t nr)
+{
+    uint32_t freed = 0;
+    uint32_t cache_idx;
+    for (cache_idx = 0; cache_idx < cache_cnt && freed < nr; cache_idx++)
+    {
+        struct kmem_cache *cache = &caches[cache_idx];
+        if (!try_get_lock(&cache->lock))
+        {
+            continue;
+        }
+        //页外的slab描述符要还给slab_desc_cache，同样不能等锁
+        if (cache->off_slab && !try_get_lock(&slab_desc_cache->lock))
+        {
+            abandon_lock(&cache->lock);
+            continue;
+        }
+        while (freed < nr && !list_empty(&cache->slabs_free))
+        {
+            slab_destroy(cache, elem2entry(struct slab, slab_tag, list_pop(&cache->slabs_free)));
+            freed++;
+        }
+        if (cache->off_slab)
+        {
+            abandon_lock(&slab_desc_cache->lock);
+        }
+        abandon_lock(&cache->lock);
+    }
+    return freed;
+}
+
+struct shrinker kmem_shrinker = {"slab", kmem_shrink_count, kmem_shrink_scan, SHRINK_PRIO_SLAB, {NULL, NULL}};
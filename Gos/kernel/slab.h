@@ -0,0 +1,34 @@
+//在页框之上为固定大小的内核对象提供缓存
+#pragma once
+#include "stdint.h"
+#include "list.h"
+#include "sync.h"
+#include "memory.h"
+
+//对象构造函数，只在slab新建时对每个对象调用一次
+typedef void kmem_ctor(void *obj);
+
+//某一种对象的缓存
+struct kmem_cache
+{
+    char name[KMEM_NAME_LEN]; //缓存名称
+    uint32_t obj_size;        //对象大小，4字节对齐
+    uint32_t objs_per_slab;   //每个slab可容纳的对象数量
+    bool off_slab;            //slab描述符是否放在slab页之外
+    kmem_ctor *ctor;          //对象构造函数，可为NULL
+
+    struct lock lock;          //分配和释放时互斥
+    struct list slabs_partial; //部分对象被使用的slab
+    struct list slabs_full;    //对象全部被使用的slab
+    struct list slabs_free;    //对象全部空闲的slab
+
+    uint32_t active_objs; //正在使用的对象数
+    uint32_t total_objs;  //所有slab中的对象总数
+};
+
+extern struct shrinker kmem_shrinker;
+
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size, kmem_ctor *ctor);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+uint32_t kmem_cache_stat(struct kmem_cache_info *info);
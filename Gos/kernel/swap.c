@@ -0,0 +1,338 @@
+#include "swap.h"
+#include "ide.h"
+#include "thread.h"
+#include "process.h"
+#include "vma.h"
+#include "interrupt.h"
+#include "global.h"
+#include "debug.h"
+#include "string.h"
+#include "sync.h"
+#include "stdio-kernel.h"
+
+/*
+ * 换出的页按时钟算法挑选：时钟指针依次扫过各进程的页表，访问位为1的页清除访问位再给一次机会，
+ * 转回来时仍没被访问过才换出。挑出的页先复制到缓冲区，页表项改为交换项并立即释放页框，
+ * 凑够一批后用一次ide_write写入连续的交换槽。
+ * 只换出只被一个页表项引用的私有页，写时复制的页、共享区域的页和跨多页arena的页框都不动，
+ * 换入时总是得到一个进程私有的新页框。fork时交换项随页表复制，交换槽按引用计数共享
+ */
+
+//一批换出的页
+struct swap_batch
+{
+    uint32_t base; //起始交换槽
+    uint32_t cnt;  //已经挑出的页数
+    bool done;     //后面的交换槽已被占用，这一批不能再加页
+    bool flush;    //改动了CR3中页目录的页表项，需要刷新TLB
+};
+
+static uint32_t swap_slot_cnt; //交换槽总数，每个槽存放一页，为0表示没有交换分区
+static uint32_t swap_free_cnt; //空闲的交换槽数
+static uint8_t *swap_map;      //各交换槽被多少个页表项引用，为0表示空闲，存取时关中断
+static uint32_t swap_hint;     //下次从这里开始找空闲的交换槽
+static uint8_t *swap_buf;      //换出的一批页先复制到这里再一次写出
+static struct lock swap_lock;  //换出和换入读写磁盘期间持有，换入时槽中的数据一定已经写完
+static pid_t clock_pid;        //时钟指针所在的进程
+static uint32_t clock_vaddr;   //时钟指针在该进程中下一个要检查的地址
+static uint32_t swap_out_cnt;  //累计换出的页数
+static uint32_t swap_in_cnt;   //累计换入的页数
+
+/**
+ * @brief 初始化交换模块，ide_init找到交换分区后调用
+ * @note 没有交换分区时内存用完的分配照旧失败
+ */
+void swap_init(void)
+{
+    lock_init(&swap_lock);
+    if (swap_part == NULL || swap_part->sec_cnt < SWAP_PAGE_SECTORS)
+    {
+        return;
+    }
+
+    swap_slot_cnt = swap_part->sec_cnt / SWAP_PAGE_SECTORS;
+    swap_map = get_kernel_pages(DIV_ROUND_UP(swap_slot_cnt, PG_SIZE));
+    swap_buf = get_kernel_pages(SWAP_BATCH);
+    if (swap_map == NULL || swap_buf == NULL)
+    {
+        PANIC("swap_init: alloc swap map failed!");
+    }
+    swap_free_cnt = swap_slot_cnt;
+    printk("swap init done: %s, %d pages\n", swap_part->name, swap_slot_cnt);
+}
+
+/**
+ * @brief 从swap_hint开始找一个空闲的交换槽
+ * @return 成功返回槽号，交换分区已满返回-1
+ * @note 调用者需关中断
+ */
+static int32_t swap_slot_find(void)
+{
+    if (swap_free_cnt == 0)
+    {
+        return -1;
+    }
+    uint32_t idx;
+    for (idx = 0; idx < swap_slot_cnt; idx++)
+    {
+        uint32_t slot = (swap_hint + idx) % swap_slot_cnt;
+        if (swap_map[slot] == 0)
+        {
+            swap_hint = slot;
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief 判断能否换出进程pthread的页
+ * @param pthread 进程
+ * @return 能返回true
+ * @note 持有硬盘通道锁的进程正在以自己的页为缓冲区读写磁盘，这期间不能换出它的页
+ */
+static bool task_swappable(struct task_struct *pthread)
+{
+    if (pthread->pgdir == NULL || pthread->task_status == TASK_HANGING)
+    {
+        return false;
+    }
+    uint8_t channel_no;
+    for (channel_no = 0; channel_no < channel_cnt; channel_no++)
+    {
+        if (channels[channel_no].lock.holder == pthread)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 时钟指针扫过进程pthread中vaddr处的页表项pte，没被访问过的页加入这一批换出
+ * @param pthread 页表项所属的进程
+ * @param vaddr 页表项对应的虚拟地址
+ * @param pte 页表项的指针
+ * @param batch 这一批换出的页
+ * @return 改动了页表项返回true
+ */
+static bool clock_check(struct task_struct *pthread, uint32_t vaddr, uint32_t *pte, struct swap_batch *batch)
+{
+    uint32_t val = *pte;
+    if ((val & (PG_P_1 | PG_US_U | PG_COW)) != (PG_P_1 | PG_US_U))
+    {
+        return false;
+    }
+    uint32_t pg_phyaddr = val & 0xfffff000;
+    struct page_frame *frame = phy2frame(pg_phyaddr);
+    if (!(frame->flags & PFF_USER) || (frame->flags & PFF_ARENA) || frame->ref_cnt != 1)
+    {
+        return false;
+    }
+    struct vm_area *vma = vma_find(&pthread->mm, vaddr);
+    if (vma == NULL || (vma->vm_flags & VM_SHARED))
+    {
+        return false;
+    }
+
+    //第二次机会
+    if (val & PG_ACCESSED)
+    {
+        *pte = val & ~PG_ACCESSED;
+        return true;
+    }
+
+    //同一批的页放在连续的交换槽中
+    if (batch->cnt == 0)
+    {
+        int32_t slot = swap_slot_find();
+        if (slot == -1)
+        {
+            batch->done = true;
+            return false;
+        }
+        batch->base = slot;
+    }
+    uint32_t slot = batch->base + batch->cnt;
+    if (slot >= swap_slot_cnt || swap_map[slot] != 0)
+    {
+        batch->done = true;
+        return false;
+    }
+    swap_map[slot] = 1;
+    swap_free_cnt--;
+
+    void *src = kmap(KMAP_COPY, pg_phyaddr);
+    memcpy(swap_buf + batch->cnt * PG_SIZE, src, PG_SIZE);
+    kunmap(KMAP_COPY);
+    *pte = SWAP_ENTRY(slot);
+    pfree(pg_phyaddr);
+    batch->cnt++;
+    return true;
+}
+
+/**
+ * @brief 从clock_vaddr开始扫描进程pthread的页表，直到凑够一批或者扫到用户空间末尾
+ * @param pthread 进程
+ * @param batch 这一批换出的页
+ * @return 扫到用户空间末尾返回true
+ * @note 页表通过临时窗口访问，调用者需关中断
+ */
+static bool clock_scan_task(struct task_struct *pthread, struct swap_batch *batch)
+{
+    while (clock_vaddr < 0xc0000000)
+    {
+        uint32_t pde = pthread->pgdir[clock_vaddr >> 22];
+        if (!(pde & PG_P_1))
+        {
+            clock_vaddr = (clock_vaddr & 0xffc00000) + 0x400000;
+            continue;
+        }
+
+        uint32_t *pt = kmap(KMAP_PGTABLE, pde);
+        uint32_t pte_idx;
+        for (pte_idx = (clock_vaddr >> 12) & 0x3ff; pte_idx < 1024; pte_idx++)
+        {
+            if (batch->cnt == SWAP_BATCH || batch->done)
+            {
+                break;
+            }
+            uint32_t vaddr = (clock_vaddr & 0xffc00000) + pte_idx * PG_SIZE;
+            //内核线程沿用上一个进程的页目录，被改动的不一定是正在运行的任务
+            if (clock_check(pthread, vaddr, &pt[pte_idx], batch) && page_dir_loaded(pthread))
+            {
+                batch->flush = true;
+            }
+        }
+        kunmap(KMAP_PGTABLE);
+        clock_vaddr = (clock_vaddr & 0xffc00000) + pte_idx * PG_SIZE;
+        if (pte_idx < 1024)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 按时钟算法换出一批用户页，用户内存池分配不到页框时调用
+ * @return 换出的页数，为0表示没有交换分区、交换分区已满或者没有能换出的页
+ * @note 调用者已持有用户内存池的锁，进程退出时释放页表也要持有它，扫描期间页表不会消失
+ * @note 时钟指针最多转两圈，第一圈清除的访问位第二圈还没有被置上的页就会被换出
+ */
+uint32_t swap_out(void)
+{
+    if (swap_slot_cnt == 0)
+    {
+        return 0;
+    }
+
+    get_lock(&swap_lock);
+    struct swap_batch batch = {0, 0, false, false};
+    enum intr_status old_status = intr_disable();
+    struct task_struct *pthread = pid2thread(clock_pid);
+    struct list_elem *elem;
+    if (pthread != NULL)
+    {
+        elem = &pthread->all_list_tag;
+    }
+    else
+    {
+        //时钟指针所在的进程已经退出，从头开始
+        elem = thread_all_list.head.next;
+        clock_vaddr = 0;
+    }
+
+    uint32_t visit_cnt = 2 * list_len(&thread_all_list) + 1;
+    while (visit_cnt-- > 0 && batch.cnt < SWAP_BATCH && !batch.done)
+    {
+        pthread = elem2entry(struct task_struct, all_list_tag, elem);
+        if (!task_swappable(pthread) || clock_scan_task(pthread, &batch))
+        {
+            elem = elem->next == &thread_all_list.tail ? thread_all_list.head.next : elem->next;
+            clock_vaddr = 0;
+        }
+    }
+    pthread = elem2entry(struct task_struct, all_list_tag, elem);
+    clock_pid = pthread->pid;
+
+    if (batch.flush)
+    {
+        page_dir_activate(running_thread());
+    }
+    intr_set_status(old_status);
+
+    //页框已经释放，数据在缓冲区中，写完之前换入这些页的进程会在swap_lock上等待
+    if (batch.cnt > 0)
+    {
+        ide_write(swap_part->my_disk, swap_part->start_lba + batch.base * SWAP_PAGE_SECTORS, swap_buf,
+                  batch.cnt * SWAP_PAGE_SECTORS);
+        swap_out_cnt += batch.cnt;
+        swap_hint = (batch.base + batch.cnt) % swap_slot_cnt;
+    }
+    abandon_lock(&swap_lock);
+    return batch.cnt;
+}
+
+/**
+ * @brief 把交换项entry对应的页读入buf，并放下这个页表项对交换槽的引用
+ * @param entry 交换项
+ * @param buf 一页大小的缓冲区
+ */
+void swap_in(uint32_t entry, void *buf)
+{
+    uint32_t slot = SWAP_SLOT(entry);
+    ASSERT(slot < swap_slot_cnt && swap_map[slot] > 0);
+
+    get_lock(&swap_lock);
+    ide_read(swap_part->my_disk, swap_part->start_lba + slot * SWAP_PAGE_SECTORS, buf, SWAP_PAGE_SECTORS);
+    swap_in_cnt++;
+    abandon_lock(&swap_lock);
+    swap_entry_free(entry);
+}
+
+/**
+ * @brief 增加交换项对应交换槽的引用，用于fork复制页表
+ * @param entry 交换项
+ */
+void swap_entry_dup(uint32_t entry)
+{
+    uint32_t slot = SWAP_SLOT(entry);
+    enum intr_status old_status = intr_disable();
+    ASSERT(slot < swap_slot_cnt && swap_map[slot] > 0 && swap_map[slot] < 0xff);
+    swap_map[slot]++;
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 减少交换项对应交换槽的引用，为0时交换槽空闲
+ * @param entry 交换项
+ */
+void swap_entry_free(uint32_t entry)
+{
+    uint32_t slot = SWAP_SLOT(entry);
+    enum intr_status old_status = intr_disable();
+    ASSERT(slot < swap_slot_cnt && swap_map[slot] > 0);
+    if (--swap_map[slot] == 0)
+    {
+        swap_free_cnt++;
+    }
+    intr_set_status(old_status);
+}
+
+/**
+ * @brief 得到交换分区的统计，以页为单位
+ * @param total 输出交换槽总数
+ * @param free 输出空闲的交换槽数
+ * @param out_cnt 输出累计换出的页数
+ * @param in_cnt 输出累计换入的页数
+ */
+void swap_get_stat(uint32_t *total, uint32_t *free, uint32_t *out_cnt, uint32_t *in_cnt)
+{
+    enum intr_status old_status = intr_disable();
+    *total = swap_slot_cnt;
+    *free = swap_free_cnt;
+    *out_cnt = swap_out_cnt;
+    *in_cnt = swap_in_cnt;
+    intr_set_status(old_status);
+}
@@ -0,0 +1,18 @@
+//交换分区，用户内存池用完时把进程的私有页换出到磁盘
+#pragma once
+#include "stdint.h"
+#include "memory.h"
+
+#define SWAP_PAGE_SECTORS 8 //每页占用的扇区数
+#define SWAP_BATCH 8        //每次最多换出的页数，这些页放在连续的交换槽中一次写出
+
+//交换项，换出的页的页表项，P位为0，高20位是交换槽号
+#define SWAP_ENTRY(slot) (((slot) << 12) | PG_SWAP)
+#define SWAP_SLOT(entry) ((entry) >> 12)
+
+void swap_init(void);
+uint32_t swap_out(void);
+void swap_in(uint32_t entry, void *buf);
+void swap_entry_dup(uint32_t entry);
+void swap_entry_free(uint32_t entry);
+void swap_get_stat(uint32_t *total, uint32_t *free, uint32_t *out_cnt, uint32_t *in_cnt);
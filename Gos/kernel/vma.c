@@ -0,0 +1,571 @@
+#include "vma.h"
+#include "slab.h"
+#include "process.h"
+#include "global.h"
+#include "debug.h"
+#include "filemap.h"
+
+#define PG_SIZE 4096
+
+//堆区域的上限，其上留给向下增长的用户栈
+#define USER_HEAP_END (0xc0000000 - USER_STACK3_PAGES * PG_SIZE)
+
+static struct kmem_cache *vma_cache; //vm_area对象缓存
+
+/**
+ * @brief 初始化虚拟内存区域模块
+ */
+void vma_init(void)
+{
+    vma_cache = kmem_cache_create("vm_area", sizeof(struct vm_area), NULL);
+}
+
+/**
+ * @brief 初始化一个空的用户地址空间
+ * @param mm 用户地址空间
+ */
+void mm_init(struct mm_struct *mm)
+{
+    rb_root_init(&mm->vma_root);
+    list_init(&mm->vma_list);
+    mm->vma_cnt = 0;
+    mm->brk_start = mm->brk = 0;
+}
+
+/**
+ * @brief 查找包含vaddr的区域
+ * @param mm 用户地址空间
+ * @param vaddr 虚拟地址
+ * @return 找到返回区域，否则返回NULL
+ */
+struct vm_area *vma_find(struct mm_struct *mm, uint32_t vaddr)
+{
+    struct rb_node *node = mm->vma_root.node;
+    while (node != NULL)
+    {
+        struct vm_area *vma = rb_entry(struct vm_area, vm_rb, node);
+        if (vaddr < vma->vm_start)
+        {
+            node = node->left;
+        }
+        else if (vaddr >= vma->vm_end)
+        {
+            node = node->right;
+        }
+        else
+        {
+            return vma;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 查找起始地址小于vaddr的最后一个区域
+ * @param mm 用户地址空间
+ * @param vaddr 虚拟地址
+ * @return 找到返回区域，否则返回NULL
+ */
+static struct vm_area *vma_find_prev(struct mm_struct *mm, uint32_t vaddr)
+{
+    struct rb_node *node = mm->vma_root.node;
+    struct vm_area *prev = NULL;
+    while (node != NULL)
+    {
+        struct vm_area *vma = rb_entry(struct vm_area, vm_rb, node);
+        if (vma->vm_start < vaddr)
+        {
+            prev = vma;
+            node = node->right;
+        }
+        else
+        {
+            node = node->left;
+        }
+    }
+    return prev;
+}
+
+/**
+ * @brief 返回按地址顺序的下一个区域
+ * @param mm 用户地址空间
+ * @param vma 当前区域，为NULL时返回第一个区域
+ * @return 下一个区域，没有返回NULL
+ */
+struct vm_area *vma_next(struct mm_struct *mm, struct vm_area *vma)
+{
+    struct list_elem *elem = vma == NULL ? mm->vma_list.head.next : vma->vm_tag.next;
+    if (elem == &mm->vma_list.tail)
+    {
+        return NULL;
+    }
+    return elem2entry(struct vm_area, vm_tag, elem);
+}
+
+/**
+ * @brief 把区域挂入红黑树和链表
+ * @param mm 用户地址空间
+ * @param vma 区域，不能与已有区域重叠
+ */
+static void vma_link(struct mm_struct *mm, struct vm_area *vma)
+{
+    struct rb_node **link = &mm->vma_root.node;
+    struct rb_node *parent = NULL;
+    struct vm_area *prev = NULL;
+    while (*link != NULL)
+    {
+        parent = *link;
+        struct vm_area *cur = rb_entry(struct vm_area, vm_rb, parent);
+        if (vma->vm_start < cur->vm_start)
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            prev = cur;
+            link = &parent->right;
+        }
+    }
+    rb_link_node(&vma->vm_rb, parent, link);
+    rb_insert_color(&vma->vm_rb, &mm->vma_root);
+
+    //链表中紧跟在前一个区域之后
+    if (prev == NULL)
+    {
+        list_push(&mm->vma_list, &vma->vm_tag);
+    }
+    else
+    {
+        list_insert_before(prev->vm_tag.next, &vma->vm_tag);
+    }
+    mm->vma_cnt++;
+}
+
+/**
+ * @brief 把区域从红黑树和链表中摘下并释放
+ * @param mm 用户地址空间
+ * @param vma 区域
+ */
+static void vma_delete(struct mm_struct *mm, struct vm_area *vma)
+{
+    rb_erase(&vma->vm_rb, &mm->vma_root);
+    list_remove(&vma->vm_tag);
+    mm->vma_cnt--;
+    if (vma->vm_file != NULL)
+    {
+        file_map_put(vma->vm_file);
+    }
+    kmem_cache_free(vma_cache, vma);
+}
+
+/**
+ * @brief 判断首尾相接的两个区域能否合并
+ * @param prev 前一个区域
+ * @param next 后一个区域
+ * @return 属性相同，映射同一文件时文件页也连续，返回true
+ */
+static bool vma_mergeable(struct vm_area *prev, struct vm_area *next)
+{
+    return prev->vm_end == next->vm_start && prev->vm_flags == next->vm_flags && prev->vm_file == next->vm_file &&
+           (prev->vm_file == NULL || prev->vm_pgoff + (prev->vm_end - prev->vm_start) / PG_SIZE == next->vm_pgoff);
+}
+
+/**
+ * @brief 在addr处把区域拆成前后两个属性相同的区域
+ * @param mm 用户地址空间
+ * @param vma 区域
+ * @param addr 拆分的地址，页对齐，落在区域内部
+ * @return 成功返回0，内存不足返回-1
+ */
+static int32_t vma_split(struct mm_struct *mm, struct vm_area *vma, uint32_t addr)
+{
+    ASSERT(vma->vm_start < addr && addr < vma->vm_end);
+    struct vm_area *tail = kmem_cache_alloc(vma_cache);
+    if (tail == NULL)
+    {
+        return -1;
+    }
+    tail->vm_start = addr;
+    tail->vm_end = vma->vm_end;
+    tail->vm_flags = vma->vm_flags;
+    tail->vm_file = vma->vm_file;
+    tail->vm_pgoff = vma->vm_pgoff + (addr - vma->vm_start) / PG_SIZE;
+    if (tail->vm_file != NULL)
+    {
+        file_map_dup(tail->vm_file);
+    }
+    vma->vm_end = addr;
+    vma_link(mm, tail);
+    return 0;
+}
+
+/**
+ * @brief 加入区域[start, end)，与相邻且能合并的区域合并
+ * @param mm 用户地址空间
+ * @param start 起始地址
+ * @param end 结束地址
+ * @param flags 属性
+ * @param file 映射的文件，匿名区域为NULL
+ * @param pgoff start对应的文件页号
+ * @return 成功返回0，失败返回-1
+ * @note 成功时接管调用者持有的文件映射引用，失败时由调用者释放
+ */
+static int32_t vma_insert(struct mm_struct *mm, uint32_t start, uint32_t end, uint32_t flags, struct file_map *file, uint32_t pgoff)
+{
+    struct vm_area *prev = vma_find_prev(mm, start);
+    struct vm_area *next = vma_next(mm, prev);
+    ASSERT((prev == NULL || prev->vm_end <= start) && (next == NULL || end <= next->vm_start));
+
+    struct vm_area area;
+    area.vm_start = start;
+    area.vm_end = end;
+    area.vm_flags = flags;
+    area.vm_file = file;
+    area.vm_pgoff = pgoff;
+
+    //能和前一个区域合并
+    if (prev != NULL && vma_mergeable(prev, &area))
+    {
+        prev->vm_end = end;
+        if (next != NULL && vma_mergeable(prev, next))
+        {
+            //正好填上两个区域之间的空隙
+            prev->vm_end = next->vm_end;
+            vma_delete(mm, next);
+        }
+    }
+    else if (next != NULL && vma_mergeable(&area, next))
+    {
+        //能和后一个区域合并，起始地址变小不会改变区域之间的顺序
+        next->vm_start = start;
+        next->vm_pgoff = pgoff;
+    }
+    else
+    {
+        struct vm_area *vma = kmem_cache_alloc(vma_cache);
+        if (vma == NULL)
+        {
+            return -1;
+        }
+        *vma = area;
+        vma_link(mm, vma);
+        return 0;
+    }
+
+    //合并后的区域已经持有文件映射的引用
+    if (file != NULL)
+    {
+        file_map_put(file);
+    }
+    return 0;
+}
+
+/**
+ * @brief 在用户堆中找一段pg_cnt页的空闲虚拟地址
+ * @param mm 用户地址空间
+ * @param pg_cnt 页数
+ * @return 成功返回起始地址，失败返回0
+ * @note 按地址顺序首次适配
+ */
+static uint32_t vma_gap_find(struct mm_struct *mm, uint32_t pg_cnt)
+{
+    uint32_t len = pg_cnt * PG_SIZE;
+    uint32_t gap_start = USER_VADDR_START;
+    struct vm_area *vma = vma_next(mm, NULL);
+
+    //在相邻区域之间找足够大的空隙
+    while (vma != NULL && vma->vm_start < gap_start + len)
+    {
+        if (vma->vm_end > gap_start)
+        {
+            gap_start = vma->vm_end;
+        }
+        vma = vma_next(mm, vma);
+    }
+
+    if (len == 0 || gap_start + len > USER_HEAP_END || gap_start + len < gap_start)
+    {
+        return 0;
+    }
+    return gap_start;
+}
+
+/**
+ * @brief 判断固定地址start开始的pg_cnt页是否在用户空间中且不与已有区域重叠
+ * @param mm 用户地址空间
+ * @param start 起始地址，页对齐
+ * @param pg_cnt 页数
+ * @return 是返回true
+ */
+static bool vma_range_free(struct mm_struct *mm, uint32_t start, uint32_t pg_cnt)
+{
+    uint32_t end = start + pg_cnt * PG_SIZE;
+    ASSERT(start % PG_SIZE == 0);
+    if (pg_cnt == 0 || start < USER_VADDR_START || end > 0xc0000000 || end < start)
+    {
+        return false;
+    }
+    struct vm_area *prev = vma_find_prev(mm, end);
+    return prev == NULL || prev->vm_end <= start;
+}
+
+/**
+ * @brief 在用户堆中找一段pg_cnt页的空闲虚拟地址并加入地址空间
+ * @param mm 用户地址空间
+ * @param pg_cnt 页数
+ * @param flags 属性
+ * @return 成功返回起始地址，失败返回0
+ * @note 按地址顺序首次适配
+ */
+uint32_t vma_alloc(struct mm_struct *mm, uint32_t pg_cnt, uint32_t flags)
+{
+    return vma_mmap(mm, 0, pg_cnt, flags, NULL, 0);
+}
+
+/**
+ * @brief 把固定地址start开始的pg_cnt页加入地址空间
+ * @param mm 用户地址空间
+ * @param start 起始地址，页对齐
+ * @param pg_cnt 页数
+ * @param flags 属性
+ * @return 成功返回0，与已有区域重叠或失败返回-1
+ */
+int32_t vma_map(struct mm_struct *mm, uint32_t start, uint32_t pg_cnt, uint32_t flags)
+{
+    if (!vma_range_free(mm, start, pg_cnt))
+    {
+        return -1;
+    }
+    return vma_insert(mm, start, start + pg_cnt * PG_SIZE, flags, NULL, 0);
+}
+
+/**
+ * @brief 把pg_cnt页加入地址空间，可以映射文件，mmap系统调用使用
+ * @param mm 用户地址空间
+ * @param start 起始地址，页对齐，为0时在用户堆中找一段空闲地址
+ * @param pg_cnt 页数
+ * @param flags 属性
+ * @param file 映射的文件，匿名映射为NULL
+ * @param pgoff start对应的文件页号
+ * @return 成功返回起始地址，与已有区域重叠或失败返回0
+ * @note 成功时接管调用者持有的文件映射引用，失败时由调用者释放
+ */
+uint32_t vma_mmap(struct mm_struct *mm, uint32_t start, uint32_t pg_cnt, uint32_t flags, struct file_map *file, uint32_t pgoff)
+{
+    if (start == 0)
+    {
+        start = vma_gap_find(mm, pg_cnt);
+        if (start == 0)
+        {
+            return 0;
+        }
+    }
+    else if (!vma_range_free(mm, start, pg_cnt))
+    {
+        return 0;
+    }
+    return vma_insert(mm, start, start + pg_cnt * PG_SIZE, flags, file, pgoff) == -1 ? 0 : start;
+}
+
+/**
+ * @brief 把[start, start + pg_cnt * PG_SIZE)从地址空间中去掉，必要时拆分区域
+ * @param mm 用户地址空间
+ * @param start 起始地址，页对齐
+ * @param pg_cnt 页数
+ * @return 成功返回0，拆分区域时内存不足返回-1
+ */
+int32_t vma_unmap(struct mm_struct *mm, uint32_t start, uint32_t pg_cnt)
+{
+    uint32_t end = start + pg_cnt * PG_SIZE;
+    struct vm_area *vma = vma_find(mm, start);
+    if (vma == NULL)
+    {
+        vma = vma_next(mm, vma_find_prev(mm, start));
+    }
+
+    while (vma != NULL && vma->vm_start < end)
+    {
+        struct vm_area *next = vma_next(mm, vma);
+        if (vma->vm_start < start && vma->vm_end > end)
+        {
+            //从中间挖掉一段，拆成两个区域
+            if (vma_split(mm, vma, end) == -1)
+            {
+                return -1;
+            }
+            vma->vm_end = start;
+            break;
+        }
+        else if (vma->vm_start < start)
+        {
+            vma->vm_end = start;
+        }
+        else if (vma->vm_end > end)
+        {
+            vma->vm_pgoff += (end - vma->vm_start) / PG_SIZE;
+            vma->vm_start = end;
+        }
+        else
+        {
+            vma_delete(mm, vma);
+        }
+        vma = next;
+    }
+    return 0;
+}
+
+/**
+ * @brief 把[start, start + pg_cnt * PG_SIZE)的权限改为flags，必要时拆分区域，之后与属性相同的相邻区域合并
+ * @param mm 用户地址空间
+ * @param start 起始地址，页对齐
+ * @param pg_cnt 页数
+ * @param flags 新的权限，VM_READ和VM_WRITE的组合，其他属性保持不变
+ * @return 成功返回0，这段地址没有全部在地址空间中、不允许加上写权限或内存不足返回-1
+ */
+int32_t vma_protect(struct mm_struct *mm, uint32_t start, uint32_t pg_cnt, uint32_t flags)
+{
+    uint32_t end = start + pg_cnt * PG_SIZE;
+    struct vm_area *vma = vma_find(mm, start);
+    if (pg_cnt == 0 || end < start || vma == NULL)
+    {
+        return -1;
+    }
+
+    //整段必须被首尾相接的区域覆盖，中间不能有空隙
+    struct vm_area *cur = vma;
+    uint32_t covered = start;
+    while (cur != NULL && cur->vm_start <= covered && covered < end)
+    {
+        if ((flags & VM_WRITE) && (cur->vm_flags & VM_SHARED) && !(cur->vm_flags & VM_MAYWRITE))
+        {
+            //以只读方式打开的文件不能通过共享映射修改
+            return -1;
+        }
+        covered = cur->vm_end;
+        cur = vma_next(mm, cur);
+    }
+    if (covered < end)
+    {
+        return -1;
+    }
+
+    //先在两端拆分，失败时区域只是没有合并，属性都还没变
+    if (vma->vm_start < start)
+    {
+        if (vma_split(mm, vma, start) == -1)
+        {
+            return -1;
+        }
+        vma = vma_next(mm, vma);
+    }
+    struct vm_area *last = vma_find(mm, end - 1);
+    if (last->vm_end > end && vma_split(mm, last, end) == -1)
+    {
+        return -1;
+    }
+
+    for (cur = vma; cur != NULL && cur->vm_start < end; cur = vma_next(mm, cur))
+    {
+        cur->vm_flags = (cur->vm_flags & ~(VM_READ | VM_WRITE)) | flags;
+    }
+
+    //从前一个区域开始，把能合并的区域合并
+    cur = vma_find_prev(mm, start);
+    if (cur == NULL)
+    {
+        cur = vma;
+    }
+    while (cur != NULL && cur->vm_start < end)
+    {
+        struct vm_area *next = vma_next(mm, cur);
+        if (next != NULL && vma_mergeable(cur, next))
+        {
+            cur->vm_end = next->vm_end;
+            vma_delete(mm, next);
+        }
+        else
+        {
+            cur = next;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief vaddr落在栈区域下方时把栈向下扩展到vaddr所在页
+ * @param mm 用户地址空间
+ * @param vaddr 引起页故障的虚拟地址
+ * @return 扩展成功返回true
+ * @note 栈最多扩展到USER_STACK3_PAGES页，且不能碰到下面的区域
+ */
+bool vma_stack_grow(struct mm_struct *mm, uint32_t vaddr)
+{
+    if (vaddr >= 0xc0000000 || vaddr < 0xc0000000 - USER_STACK3_PAGES * PG_SIZE)
+    {
+        return false;
+    }
+
+    struct vm_area *prev = vma_find_prev(mm, vaddr + 1);
+    struct vm_area *stack = vma_next(mm, prev);
+    if (stack == NULL || !(stack->vm_flags & VM_GROWSDOWN))
+    {
+        return false;
+    }
+    if (prev != NULL && prev->vm_end > (vaddr & 0xfffff000))
+    {
+        return false;
+    }
+    //起始地址变小不会改变区域之间的顺序
+    stack->vm_start = vaddr & 0xfffff000;
+    return true;
+}
+
+/**
+ * @brief 复制地址空间中的所有区域，用于fork
+ * @param dst 目的地址空间，不必初始化
+ * @param src 源地址空间
+ * @return 成功返回0，失败返回-1
+ */
+int32_t mm_copy(struct mm_struct *dst, struct mm_struct *src)
+{
+    mm_init(dst);
+    struct vm_area *vma = vma_next(src, NULL);
+    while (vma != NULL)
+    {
+        struct vm_area *copy = kmem_cache_alloc(vma_cache);
+        if (copy == NULL)
+        {
+            mm_release(dst);
+            return -1;
+        }
+        copy->vm_start = vma->vm_start;
+        copy->vm_end = vma->vm_end;
+        copy->vm_flags = vma->vm_flags;
+        copy->vm_file = vma->vm_file;
+        copy->vm_pgoff = vma->vm_pgoff;
+        if (copy->vm_file != NULL)
+        {
+            file_map_dup(copy->vm_file);
+        }
+        vma_link(dst, copy);
+        vma = vma_next(src, vma);
+    }
+    dst->brk_start = src->brk_start;
+    dst->brk = src->brk;
+    return 0;
+}
+
+/**
+ * @brief 释放地址空间中的所有区域
+ * @param mm 用户地址空间
+ */
+void mm_release(struct mm_struct *mm)
+{
+    struct vm_area *vma = vma_next(mm, NULL);
+    while (vma != NULL)
+    {
+        struct vm_area *next = vma_next(mm, vma);
+        vma_delete(mm, vma);
+        vma = next;
+    }
+}
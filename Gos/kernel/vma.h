@@ -0,0 +1,49 @@
+//用户进程的虚拟内存区域，代替原先覆盖整个用户空间的虚拟地址位图
+#pragma once
+#include "stdint.h"
+#include "list.h"
+#include "rbtree.h"
+
+//虚拟内存区域的权限和属性
+#define VM_READ 1      //可读
+#define VM_WRITE 2     //可写
+#define VM_GROWSDOWN 4 //向下增长的栈
+#define VM_SHARED 8    //共享的文件映射或共享内存段，fork后父子进程继续共享，写入对其他进程可见
+#define VM_MAYWRITE 16 //共享区域可以加上写权限，文件映射要求文件以可写方式打开
+
+struct file_map;
+
+//一段连续的、属性相同的用户虚拟地址[vm_start, vm_end)
+struct vm_area
+{
+    uint32_t vm_start;        //起始地址，页对齐
+    uint32_t vm_end;          //结束地址，不包含，页对齐
+    uint32_t vm_flags;        //权限和属性
+    struct file_map *vm_file; //映射的文件，匿名区域为NULL
+    uint32_t vm_pgoff;        //vm_start对应的文件页号
+    struct rb_node vm_rb;     //在红黑树中的节点，以vm_start为键
+    struct list_elem vm_tag;  //在按地址排序的链表中的节点
+};
+
+//进程的用户地址空间
+struct mm_struct
+{
+    struct rb_root vma_root; //按地址查找区域
+    struct list vma_list;    //按地址顺序遍历区域
+    uint32_t vma_cnt;        //区域数量
+    uint32_t brk_start;      //brk堆的起始地址
+    uint32_t brk;            //brk堆当前的结束地址，不包含
+};
+
+void vma_init(void);
+void mm_init(struct mm_struct *mm);
+struct vm_area *vma_find(struct mm_struct *mm, uint32_t vaddr);
+struct vm_area *vma_next(struct mm_struct *mm, struct vm_area *vma);
+uint32_t vma_alloc(struct mm_struct *mm, uint32_t pg_cnt, uint32_t flags);
+int32_t vma_map(struct mm_struct *mm, uint32_t start, uint32_t pg_cnt, uint32_t flags);
+uint32_t vma_mmap(struct mm_struct *mm, uint32_t start, uint32_t pg_cnt, uint32_t flags, struct file_map *file, uint32_t pgoff);
+int32_t vma_unmap(struct mm_struct *mm, uint32_t start, uint32_t pg_cnt);
+int32_t vma_protect(struct mm_struct *mm, uint32_t start, uint32_t pg_cnt, uint32_t flags);
+bool vma_stack_grow(struct mm_struct *mm, uint32_t vaddr);
+int32_t mm_copy(struct mm_struct *dst, struct mm_struct *src);
+void mm_release(struct mm_struct *mm);
@@ -12,6 +12,10 @@
 void bitmap_init(struct bitmap *btmp)
 {
     memset(btmp->bits, 0, btmp->btmp_bytes_len);
+    if (btmp->summary != NULL)
+    {
+        memset(btmp->summary, 0, BITMAP_SUMMARY_LEN(btmp->btmp_bytes_len) * 4);
+    }
 }
 
 /*
@@ -28,65 +32,220 @@ bool bitmap_scan_test(struct bitmap *btmp, uint32_t bit_idx)
 }
 
 /*
- * @brief 在bitmap中申请连续count个位，成功返回其起始位下标；失败，返回-1
+ * @brief 返回x中最低的为1的位的下标
+ * @param x 不能为0
+ */
+static inline uint32_t bit_first_set(uint32_t x)
+{
+    uint32_t idx;
+    asm volatile("bsfl %1, %0"
+                 : "=r"(idx)
+                 : "rm"(x));
+    return idx;
+}
+
+/*
+ * @brief 返回x中最高的为1的位的下标
+ * @param x 不能为0
+ */
+static inline uint32_t bit_last_set(uint32_t x)
+{
+    uint32_t idx;
+    asm volatile("bsrl %1, %0"
+                 : "=r"(idx)
+                 : "rm"(x));
+    return idx;
+}
+
+/*
+ * @brief 按32位字读取位图，超出位图末尾的位视为已占用
  * @param btmp 结构体bitmap的指针
- * @param cnt 申请的位个数
- * @return 申请的起始下标，如果不够用就返回-1
+ * @param word_idx 字下标
+ * @return 第word_idx个字
  */
-int bitmap_scan(struct bitmap *btmp, uint32_t cnt)
+static uint32_t bitmap_word(struct bitmap *btmp, uint32_t word_idx)
 {
-    uint32_t idx_byte = 0; //记录空闲位所在字节
-    //略过分配过的字节
-    while ((0xff == btmp->bits[idx_byte]) && (idx_byte < btmp->btmp_bytes_len))
+    uint32_t byte_idx = word_idx * 4;
+    if (byte_idx + 4 <= btmp->btmp_bytes_len)
     {
-        idx_byte++;
+        return *(uint32_t *)(btmp->bits + byte_idx);
     }
 
-    //判读是否到末尾了
-    ASSERT(idx_byte < btmp->btmp_bytes_len);
-    if (idx_byte == btmp->btmp_bytes_len)
+    //最后一个不满4字节的字
+    uint32_t word = 0xffffffff;
+    uint32_t byte_off;
+    for (byte_off = 0; byte_idx + byte_off < btmp->btmp_bytes_len; byte_off++)
     {
-        return -1;
+        word &= ~(0xff << (byte_off * 8));
+        word |= btmp->bits[byte_idx + byte_off] << (byte_off * 8);
+    }
+    return word;
+}
+
+/*
+ * @brief 根据第word_idx个字是否全满更新摘要位图
+ * @param btmp 结构体bitmap的指针
+ * @param word_idx 字下标
+ */
+static void bitmap_summary_update(struct bitmap *btmp, uint32_t word_idx)
+{
+    if (btmp->summary == NULL)
+    {
+        return;
+    }
+    if (bitmap_word(btmp, word_idx) == 0xffffffff)
+    {
+        btmp->summary[word_idx / 32] |= (BITMAP_MASK << (word_idx % 32));
+    }
+    else
+    {
+        btmp->summary[word_idx / 32] &= ~(BITMAP_MASK << (word_idx % 32));
+    }
+}
+
+/*
+ * @brief 为位图挂上摘要位图，并根据当前位图内容建立摘要
+ * @param btmp 结构体bitmap的指针
+ * @param summary 摘要位图，至少BITMAP_SUMMARY_LEN(btmp->btmp_bytes_len)个字
+ * @note 摘要位图的每一位对应位图的一个32位字，为1表示该字已全满
+ */
+void bitmap_summary_init(struct bitmap *btmp, uint32_t *summary)
+{
+    uint32_t word_cnt = DIV_ROUND_UP(btmp->btmp_bytes_len, 4);
+    uint32_t word_idx;
+    btmp->summary = summary;
+    memset(summary, 0, BITMAP_SUMMARY_LEN(btmp->btmp_bytes_len) * 4);
+    for (word_idx = 0; word_idx < word_cnt; word_idx++)
+    {
+        bitmap_summary_update(btmp, word_idx);
     }
+}
 
-    int idx_bit = 0;
-    //找这个字节第一个空闲的位
-    while ((uint8_t)(BITMAP_MASK << idx_bit) & btmp->bits[idx_byte])
+/*
+ * @brief 从word_idx开始跳过摘要中标记为全满的字
+ * @param btmp 结构体bitmap的指针
+ * @param word_idx 起始字下标
+ * @param word_cnt 位图总字数
+ * @return 第一个可能有空闲位的字下标，没有则返回word_cnt
+ */
+static uint32_t bitmap_skip_full(struct bitmap *btmp, uint32_t word_idx, uint32_t word_cnt)
+{
+    if (btmp->summary == NULL)
+    {
+        //没有摘要时在这里连续跳过全满的完整字，省去每个字回到bitmap_scan的开销
+        const uint32_t *words = (const uint32_t *)btmp->bits;
+        uint32_t whole_cnt = btmp->btmp_bytes_len / 4;
+        while (word_idx < whole_cnt && words[word_idx] == 0xffffffff)
+        {
+            word_idx++;
+        }
+        return word_idx;
+    }
+    while (word_idx < word_cnt)
     {
-        idx_bit++;
+        //摘要字中word_idx及之后的位
+        uint32_t not_full = ~btmp->summary[word_idx / 32] & (0xffffffff << (word_idx % 32));
+        if (not_full != 0)
+        {
+            word_idx = (word_idx & ~31) + bit_first_set(not_full);
+            break;
+        }
+        //这一整段1024位都已全满
+        word_idx = (word_idx & ~31) + 32;
     }
+    return word_idx < word_cnt ? word_idx : word_cnt;
+}
+
+/*
+ * @brief 在bitmap中申请连续count个位，成功返回其起始位下标；失败，返回-1
+ * @param btmp 结构体bitmap的指针
+ * @param cnt 申请的位个数
+ * @return 申请的起始下标，如果不够用就返回-1
+ * @note 按32位字扫描，全满的字整个跳过，字内用bsf定位空闲段
+ */
+int bitmap_scan(struct bitmap *btmp, uint32_t cnt)
+{
+    uint32_t word_cnt = DIV_ROUND_UP(btmp->btmp_bytes_len, 4);
+    uint32_t word_idx = 0;
+    uint32_t run_start = 0; //当前连续空闲段的起始位
+    uint32_t run_len = 0;   //当前连续空闲段的长度
 
-    //现在定位到bitmap的第idx_byte个字节的第idx_bit位是空闲的
-    int bit_idx_start = idx_byte * 8 + idx_bit; //定位到具体是bitmap的哪一位
-    if (cnt == 1)
+    if (cnt == 0)
     {
-        return bit_idx_start;
+        return -1;
     }
 
-    //记录还有多少位可以判断
-    uint32_t bit_left = (btmp->btmp_bytes_len * 8 - bit_idx_start);
-    uint32_t next_bit = bit_idx_start + 1;
-    uint32_t count = 1; //记录找到的空闲位的个数
-    bit_idx_start = -1;
-    while (bit_left-- > 0)
+    while (word_idx < word_cnt)
     {
-        if (!(bitmap_scan_test(btmp, next_bit)))
+        uint32_t word = bitmap_word(btmp, word_idx);
+        if (word == 0xffffffff)
+        {
+            //全满的字打断连续段，并借助摘要跳过后面全满的字
+            run_len = 0;
+            word_idx = bitmap_skip_full(btmp, word_idx + 1, word_cnt);
+            continue;
+        }
+
+        uint32_t bit_base = word_idx * 32;
+        if (word == 0)
         {
-            count++;
+            //全空的字直接接到连续段上
+            if (run_len == 0)
+            {
+                run_start = bit_base;
+            }
+            run_len += 32;
+            if (run_len >= cnt)
+            {
+                return run_start;
+            }
+            word_idx++;
+            continue;
         }
-        else
+
+        //低位的空闲位和前面的连续段相连
+        uint32_t pos = bit_first_set(word);
+        if (run_len == 0)
         {
-            count = 0;
+            run_start = bit_base;
         }
-        //找到了连续的cnt个空位
-        if (count == cnt)
+        if (run_len + pos >= cnt)
         {
-            bit_idx_start = next_bit - cnt + 1;
-            break;
+            return run_start;
+        }
+
+        //字内部夹在已占用位之间的空闲段，pos和last分别是最低和最高的已占用位
+        uint32_t last = bit_last_set(word);
+        while (pos < last)
+        {
+            uint32_t free_bits = ~word >> pos;
+            if (free_bits == 0)
+            {
+                break;
+            }
+            uint32_t start = pos + bit_first_set(free_bits);
+            if (start > last)
+            {
+                break;
+            }
+            uint32_t len = bit_first_set(word >> start);
+            if (len >= cnt)
+            {
+                return bit_base + start;
+            }
+            pos = start + len;
+        }
+
+        //最高已占用位之上的空闲位，留给下一个字继续接
+        run_start = bit_base + last + 1;
+        run_len = 31 - last;
+        if (run_len > 0 && run_len >= cnt)
+        {
+            return run_start;
         }
-        next_bit++;
+        word_idx++;
     }
-    return bit_idx_start;
+    return -1;
 }
 
 /*
@@ -108,4 +267,5 @@ void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value)
     {
         btmp->bits[byte_idx] &= ~(BITMAP_MASK << bit_odd);
     }
+    bitmap_summary_update(btmp, bit_idx / 32);
 }
\ No newline at end of file
@@ -4,13 +4,18 @@
 
 #define BITMAP_MASK 1       //用于在位图中逐位判断
 
+//字节数为bytes_len的位图所需摘要位图的字数
+#define BITMAP_SUMMARY_LEN(bytes_len) DIV_ROUND_UP(DIV_ROUND_UP(bytes_len, 4), 32)
+
 struct bitmap
 {
     uint32_t btmp_bytes_len;    //位图总共字节大小
     uint8_t *bits;              //位图指针
+    uint32_t *summary;          //可选的摘要位图，每位表示一个32位字是否全满，不用时为NULL
 };
 
 void bitmap_init(struct bitmap *btmp);
 bool bitmap_scan_test(struct bitmap *btmp, uint32_t bit_idx);
 int bitmap_scan(struct bitmap *btmp, uint32_t cnt);
-void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value);
\ No newline at end of file
+void bitmap_set(struct bitmap *btmp, uint32_t bit_idx, int8_t value);
+void bitmap_summary_init(struct bitmap *btmp, uint32_t *summary);
\ No newline at end of file
@@ -0,0 +1,362 @@
+#include "rbtree.h"
+#include "stdint.h"
+#include "global.h"
+
+/*
+ * @brief 初始化一棵空树
+ * @param root 红黑树
+ */
+void rb_root_init(struct rb_root *root)
+{
+    root->node = NULL;
+}
+
+/*
+ * @brief 把node挂到parent的link位置上，link为&parent->left或&parent->right，空树时为&root->node
+ * @param node 新节点
+ * @param parent 父节点
+ * @param link 挂接位置
+ * @note 之后需要调用rb_insert_color重新平衡
+ */
+void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link)
+{
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+}
+
+/*
+ * @brief 用new_node替换old_node在其父节点中的位置
+ */
+static void rb_replace_child(struct rb_node *old_node, struct rb_node *new_node, struct rb_root *root)
+{
+    struct rb_node *parent = old_node->parent;
+    if (parent == NULL)
+    {
+        root->node = new_node;
+    }
+    else if (parent->left == old_node)
+    {
+        parent->left = new_node;
+    }
+    else
+    {
+        parent->right = new_node;
+    }
+    if (new_node != NULL)
+    {
+        new_node->parent = parent;
+    }
+}
+
+/*
+ * @brief 以node为支点左旋
+ */
+static void rb_rotate_left(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *right = node->right;
+    node->right = right->left;
+    if (right->left != NULL)
+    {
+        right->left->parent = node;
+    }
+    rb_replace_child(node, right, root);
+    right->left = node;
+    node->parent = right;
+}
+
+/*
+ * @brief 以node为支点右旋
+ */
+static void rb_rotate_right(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *left = node->left;
+    node->left = left->right;
+    if (left->right != NULL)
+    {
+        left->right->parent = node;
+    }
+    rb_replace_child(node, left, root);
+    left->right = node;
+    node->parent = left;
+}
+
+/*
+ * @brief 插入新节点后重新着色和旋转，恢复红黑树性质
+ * @param node 刚由rb_link_node挂上的节点
+ * @param root 红黑树
+ */
+void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *parent;
+    while ((parent = node->parent) != NULL && parent->color == RB_RED)
+    {
+        //父节点为红，则祖父节点一定存在
+        struct rb_node *gparent = parent->parent;
+        if (parent == gparent->left)
+        {
+            struct rb_node *uncle = gparent->right;
+            if (uncle != NULL && uncle->color == RB_RED)
+            {
+                //叔叔为红，颜色下放，问题上移到祖父
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->right)
+            {
+                //先转成外侧的情况
+                rb_rotate_left(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_right(gparent, root);
+        }
+        else
+        {
+            struct rb_node *uncle = gparent->left;
+            if (uncle != NULL && uncle->color == RB_RED)
+            {
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (node == parent->left)
+            {
+                rb_rotate_right(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_left(gparent, root);
+        }
+    }
+    root->node->color = RB_BLACK;
+}
+
+/*
+ * @brief 删除节点后，从child处开始修复少了一个黑节点的路径
+ * @param child 顶替被删节点的节点，可能为NULL
+ * @param parent child的父节点
+ * @param root 红黑树
+ */
+static void rb_erase_color(struct rb_node *child, struct rb_node *parent, struct rb_root *root)
+{
+    struct rb_node *sibling;
+    while (child != root->node && (child == NULL || child->color == RB_BLACK))
+    {
+        if (child == parent->left)
+        {
+            sibling = parent->right;
+            if (sibling->color == RB_RED)
+            {
+                //兄弟为红，转成兄弟为黑的情况
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(parent, root);
+                sibling = parent->right;
+            }
+            if ((sibling->left == NULL || sibling->left->color == RB_BLACK) &&
+                (sibling->right == NULL || sibling->right->color == RB_BLACK))
+            {
+                //兄弟的孩子都为黑，兄弟变红，问题上移到父节点
+                sibling->color = RB_RED;
+                child = parent;
+                parent = child->parent;
+                continue;
+            }
+            if (sibling->right == NULL || sibling->right->color == RB_BLACK)
+            {
+                //兄弟的近侧孩子为红，先转成远侧孩子为红
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_right(sibling, root);
+                sibling = parent->right;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            rb_rotate_left(parent, root);
+            child = root->node;
+            break;
+        }
+        else
+        {
+            sibling = parent->left;
+            if (sibling->color == RB_RED)
+            {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(parent, root);
+                sibling = parent->left;
+            }
+            if ((sibling->left == NULL || sibling->left->color == RB_BLACK) &&
+                (sibling->right == NULL || sibling->right->color == RB_BLACK))
+            {
+                sibling->color = RB_RED;
+                child = parent;
+                parent = child->parent;
+                continue;
+            }
+            if (sibling->left == NULL || sibling->left->color == RB_BLACK)
+            {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_left(sibling, root);
+                sibling = parent->left;
+            }
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            rb_rotate_right(parent, root);
+            child = root->node;
+            break;
+        }
+    }
+    if (child != NULL)
+    {
+        child->color = RB_BLACK;
+    }
+}
+
+/*
+ * @brief 从红黑树中删除节点
+ * @param node 待删除的节点
+ * @param root 红黑树
+ */
+void rb_erase(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *child;
+    struct rb_node *parent;
+    uint8_t color;
+
+    if (node->left != NULL && node->right != NULL)
+    {
+        //有两个孩子，用后继节点顶替node的位置
+        struct rb_node *succ = node->right;
+        while (succ->left != NULL)
+        {
+            succ = succ->left;
+        }
+        child = succ->right;
+        color = succ->color;
+
+        if (succ->parent == node)
+        {
+            parent = succ;
+        }
+        else
+        {
+            parent = succ->parent;
+            parent->left = child;
+            if (child != NULL)
+            {
+                child->parent = parent;
+            }
+            succ->right = node->right;
+            node->right->parent = succ;
+        }
+
+        rb_replace_child(node, succ, root);
+        succ->left = node->left;
+        node->left->parent = succ;
+        succ->color = node->color;
+    }
+    else
+    {
+        child = node->left != NULL ? node->left : node->right;
+        parent = node->parent;
+        color = node->color;
+        rb_replace_child(node, child, root);
+    }
+
+    //删掉的是黑节点才会破坏黑高
+    if (color == RB_BLACK)
+    {
+        rb_erase_color(child, parent, root);
+    }
+}
+
+/*
+ * @brief 返回树中最小的节点，空树返回NULL
+ */
+struct rb_node *rb_first(struct rb_root *root)
+{
+    struct rb_node *node = root->node;
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    while (node->left != NULL)
+    {
+        node = node->left;
+    }
+    return node;
+}
+
+/*
+ * @brief 返回树中最大的节点，空树返回NULL
+ */
+struct rb_node *rb_last(struct rb_root *root)
+{
+    struct rb_node *node = root->node;
+    if (node == NULL)
+    {
+        return NULL;
+    }
+    while (node->right != NULL)
+    {
+        node = node->right;
+    }
+    return node;
+}
+
+/*
+ * @brief 返回node的中序后继，没有返回NULL
+ */
+struct rb_node *rb_next(struct rb_node *node)
+{
+    if (node->right != NULL)
+    {
+        node = node->right;
+        while (node->left != NULL)
+        {
+            node = node->left;
+        }
+        return node;
+    }
+    while (node->parent != NULL && node == node->parent->right)
+    {
+        node = node->parent;
+    }
+    return node->parent;
+}
+
+/*
+ * @brief 返回node的中序前驱，没有返回NULL
+ */
+struct rb_node *rb_prev(struct rb_node *node)
+{
+    if (node->left != NULL)
+    {
+        node = node->left;
+        while (node->right != NULL)
+        {
+            node = node->right;
+        }
+        return node;
+    }
+    while (node->parent != NULL && node == node->parent->left)
+    {
+        node = node->parent;
+    }
+    return node->parent;
+}
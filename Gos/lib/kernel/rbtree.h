@@ -0,0 +1,35 @@
+//红黑树，节点嵌入在宿主结构中，比较逻辑由使用者在插入和查找时自己完成
+#pragma once
+#include "global.h"
+#include "list.h"
+
+#define RB_RED 0
+#define RB_BLACK 1
+
+//红黑树节点
+struct rb_node
+{
+    struct rb_node *parent; //父节点
+    struct rb_node *left;   //左孩子
+    struct rb_node *right;  //右孩子
+    uint8_t color;          //颜色
+};
+
+//红黑树
+struct rb_root
+{
+    struct rb_node *node; //根节点，空树为NULL
+};
+
+//由红黑树节点得到宿主结构的地址
+#define rb_entry(struct_type, struct_member_name, node_ptr) \
+    elem2entry(struct_type, struct_member_name, node_ptr)
+
+void rb_root_init(struct rb_root *root);
+void rb_link_node(struct rb_node *node, struct rb_node *parent, struct rb_node **link);
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+void rb_erase(struct rb_node *node, struct rb_root *root);
+struct rb_node *rb_first(struct rb_root *root);
+struct rb_node *rb_last(struct rb_root *root);
+struct rb_node *rb_next(struct rb_node *node);
+struct rb_node *rb_prev(struct rb_node *node);
@@ -0,0 +1,255 @@
+#include "syscall.h"
+#include "process.h"
+#include "string.h"
+#include "global.h"
+#include "assert.h"
+
+/*
+ * 用户态的内存分配器，只在堆不够用时才通过brk向内核要内存，平时的malloc/free都不陷入内核。
+ * lib/user和内核链接在一起，全局变量是所有进程共享的，所以分配器的状态放在每个进程自己的堆的第一页，
+ * 进程都是单线程的，这些空闲链表也就是线程私有的，存取不需要加锁
+ */
+
+#define UHEAP_CLASS_CNT 8           //16~2048字节的小规格，每种规格按2的幂递增
+#define UHEAP_MIN_BLOCK 16u         //最小规格的大小
+#define UHEAP_LARGE UHEAP_CLASS_CNT //头部中表示大内存块的规格号
+#define UHEAP_GROW_PAGES 16         //堆不够时每次至少向内核扩展的页数
+#define UHEAP ((struct uheap *)USER_BRK_START)
+#define UHEAP_LIMIT (USER_STACK3_VADDR - USER_STACK3_PAGES * PG_SIZE) //堆最多增长到用户栈的下边界
+
+//每个内存块之前的头部，8字节，保证返回的地址8字节对齐
+struct uheap_head
+{
+    uint32_t class_idx; //规格号，UHEAP_LARGE表示按页分配的大内存块
+    uint32_t pg_cnt;    //大内存块占用的页数
+};
+
+//小规格空闲块，复用内存块头部的位置
+struct uheap_block
+{
+    struct uheap_block *next;
+};
+
+//空闲的连续页，放在这段页的开头
+struct uheap_run
+{
+    struct uheap_run *next; //按地址排序的下一段
+    uint32_t pg_cnt;        //页数
+};
+
+//分配器的状态，放在堆的第一页
+struct uheap
+{
+    uint32_t cur;                                   //还没分出去的页的起始地址，页对齐
+    uint32_t end;                                   //堆的结束地址，为0表示还没有初始化
+    struct uheap_block *free_list[UHEAP_CLASS_CNT]; //各规格的空闲块
+    struct uheap_run *runs;                         //还回来的空闲页，按地址排序
+};
+
+/**
+ * @brief 第一次使用时初始化分配器，堆的第一页在进程创建时就有了，内容为0
+ * @param heap 分配器的状态
+ */
+static void uheap_init(struct uheap *heap)
+{
+    heap->cur = USER_BRK_START + PG_SIZE;
+    heap->end = (uint32_t)sbrk(0);
+    assert(heap->cur == heap->end);
+}
+
+/**
+ * @brief 从堆中分配pg_cnt个连续页，先找还回来的空闲页，不够再从未分出去的部分切，仍不够就扩展堆
+ * @param heap 分配器的状态
+ * @param pg_cnt 页数
+ * @param fresh 返回这段页是否刚从内核扩展来、还没被用过，这样的页内容为0
+ * @return 成功返回起始地址，失败返回NULL
+ */
+static void *uheap_page_alloc(struct uheap *heap, uint32_t pg_cnt, bool *fresh)
+{
+    *fresh = false;
+    //首次适配
+    struct uheap_run **link = &heap->runs;
+    while (*link != NULL)
+    {
+        struct uheap_run *run = *link;
+        if (run->pg_cnt == pg_cnt)
+        {
+            *link = run->next;
+            return run;
+        }
+        if (run->pg_cnt > pg_cnt)
+        {
+            //从尾部切，剩下的部分留在原处
+            run->pg_cnt -= pg_cnt;
+            return (void *)((uint32_t)run + run->pg_cnt * PG_SIZE);
+        }
+        link = &run->next;
+    }
+
+    //先按页数比较，避免地址相加越过4GB回绕
+    if (pg_cnt > (UHEAP_LIMIT - heap->cur) / PG_SIZE)
+    {
+        return NULL;
+    }
+    if (heap->cur + pg_cnt * PG_SIZE > heap->end)
+    {
+        uint32_t grow_pages = (heap->cur + pg_cnt * PG_SIZE - heap->end) / PG_SIZE;
+        if (grow_pages < UHEAP_GROW_PAGES)
+        {
+            grow_pages = UHEAP_GROW_PAGES;
+        }
+        if (sbrk(grow_pages * PG_SIZE) == (void *)-1)
+        {
+            return NULL;
+        }
+        heap->end += grow_pages * PG_SIZE;
+    }
+    void *page = (void *)heap->cur;
+    heap->cur += pg_cnt * PG_SIZE;
+    *fresh = true;
+    return page;
+}
+
+/**
+ * @brief 把pg_cnt个连续页还给堆，按地址插入空闲页链表并与前后相邻的合并
+ * @param heap 分配器的状态
+ * @param page 起始地址
+ * @param pg_cnt 页数
+ */
+static void uheap_page_free(struct uheap *heap, void *page, uint32_t pg_cnt)
+{
+    struct uheap_run *run = page;
+    struct uheap_run *prev = NULL;
+    struct uheap_run *next = heap->runs;
+    while (next != NULL && (uint32_t)next < (uint32_t)run)
+    {
+        prev = next;
+        next = next->next;
+    }
+
+    run->pg_cnt = pg_cnt;
+    run->next = next;
+    if (next != NULL && (uint32_t)run + pg_cnt * PG_SIZE == (uint32_t)next)
+    {
+        run->pg_cnt += next->pg_cnt;
+        run->next = next->next;
+    }
+    if (prev != NULL && (uint32_t)prev + prev->pg_cnt * PG_SIZE == (uint32_t)run)
+    {
+        prev->pg_cnt += run->pg_cnt;
+        prev->next = run->next;
+    }
+    else if (prev != NULL)
+    {
+        prev->next = run;
+    }
+    else
+    {
+        heap->runs = run;
+    }
+}
+
+/**
+ * @brief 申请size字节的内存
+ * @param size 申请的内存的大小
+ * @return 申请的内存的起始地址，内容为0，失败返回NULL
+ */
+void *malloc(uint32_t size)
+{
+    struct uheap *heap = UHEAP;
+    if (size == 0)
+    {
+        return NULL;
+    }
+    if (heap->end == 0)
+    {
+        uheap_init(heap);
+    }
+
+    //超过堆能覆盖的地址范围的一定失败，先拒绝，下面加头部和按页取整就不会回绕
+    if (size > UHEAP_LIMIT - USER_BRK_START)
+    {
+        return NULL;
+    }
+    uint32_t total = size + sizeof(struct uheap_head);
+    struct uheap_head *head;
+    bool fresh;
+    if (total > (UHEAP_MIN_BLOCK << (UHEAP_CLASS_CNT - 1)))
+    {
+        //大内存块直接按页分配
+        uint32_t pg_cnt = DIV_ROUND_UP(total, PG_SIZE);
+        head = uheap_page_alloc(heap, pg_cnt, &fresh);
+        if (head == NULL)
+        {
+            return NULL;
+        }
+        head->class_idx = UHEAP_LARGE;
+        head->pg_cnt = pg_cnt;
+        //刚扩展来的页还没访问过，内容本来就是0，清零反而会让每一页都立刻分配页框
+        if (!fresh)
+        {
+            memset(head + 1, 0, pg_cnt * PG_SIZE - sizeof(struct uheap_head));
+        }
+        return head + 1;
+    }
+
+    uint32_t class_idx = 0;
+    while ((UHEAP_MIN_BLOCK << class_idx) < total)
+    {
+        class_idx++;
+    }
+    uint32_t block_size = UHEAP_MIN_BLOCK << class_idx;
+
+    //空闲链表为空时切一页补充
+    if (heap->free_list[class_idx] == NULL)
+    {
+        uint32_t page = (uint32_t)uheap_page_alloc(heap, 1, &fresh);
+        if (page == 0)
+        {
+            return NULL;
+        }
+        uint32_t offset;
+        for (offset = PG_SIZE; offset >= block_size; offset -= block_size)
+        {
+            struct uheap_block *block = (struct uheap_block *)(page + offset - block_size);
+            block->next = heap->free_list[class_idx];
+            heap->free_list[class_idx] = block;
+        }
+    }
+
+    struct uheap_block *block = heap->free_list[class_idx];
+    heap->free_list[class_idx] = block->next;
+    head = (struct uheap_head *)block;
+    head->class_idx = class_idx;
+    head->pg_cnt = 0;
+    memset(head + 1, 0, block_size - sizeof(struct uheap_head));
+    return head + 1;
+}
+
+/**
+ * @brief 释放ptr指向的内存空间
+ * @param ptr 待释放的内存空间的指针，可以为NULL
+ */
+void free(void *ptr)
+{
+    struct uheap *heap = UHEAP;
+    if (ptr == NULL)
+    {
+        return;
+    }
+    assert((uint32_t)ptr > USER_BRK_START + PG_SIZE && (uint32_t)ptr < heap->cur);
+
+    struct uheap_head *head = (struct uheap_head *)ptr - 1;
+    if (head->class_idx == UHEAP_LARGE)
+    {
+        uheap_page_free(heap, head, head->pg_cnt);
+        return;
+    }
+
+    //空闲块的next会覆盖头部，先取出规格号
+    uint32_t class_idx = head->class_idx;
+    assert(class_idx < UHEAP_CLASS_CNT);
+    struct uheap_block *block = (struct uheap_block *)head;
+    block->next = heap->free_list[class_idx];
+    heap->free_list[class_idx] = block;
+}
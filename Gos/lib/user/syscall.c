@@ -79,24 +79,6 @@ uint32_t getpid()
     return _syscall0(SYS_GETPID);
 }
 
-/**
- * @brief 申请size字节的内存
- * @param size 申请的内存的大小
- * @return 申请的内存的起始地址
- */
-void *malloc(uint32_t size)
-{
-    return (void *)_syscall1(SYS_MALLOC, size);
-}
-
-/**
- * @brief 释放ptr指向的内存空间
- * @param ptr 待释放的内存空间的指针
- */
-void free(void *ptr)
-{
-    _syscall1(SYS_FREE, ptr);
-}
 /**
  * @brief 把buf中的count个字符写入fd中
  * 
@@ -293,3 +275,160 @@ void ps(void)
 {
     _syscall0(SYS_PS);
 }
+
+/**
+ * @brief 得到内存使用情况的统计
+ * @param info 输出的统计信息
+ */
+void meminfo(struct mem_info *info)
+{
+    _syscall1(SYS_MEMINFO, info);
+}
+
+/**
+ * @brief 把进程brk堆的结束地址设为end
+ * @param end 新的结束地址
+ * @return 成功返回0，失败返回-1
+ */
+int32_t brk(void *end)
+{
+    return (uint32_t)_syscall1(SYS_BRK, end) == (uint32_t)end ? 0 : -1;
+}
+
+/**
+ * @brief 把进程brk堆扩大或缩小increment字节
+ * @param increment 变化的字节数，为0时只查询
+ * @return 成功返回原来的结束地址，失败返回(void *)-1
+ */
+void *sbrk(int32_t increment)
+{
+    uint32_t old_brk = _syscall1(SYS_BRK, 0);
+    if (increment == 0)
+    {
+        return (void *)old_brk;
+    }
+    if ((uint32_t)_syscall1(SYS_BRK, old_brk + increment) != old_brk + increment)
+    {
+        return (void *)-1;
+    }
+    return (void *)old_brk;
+}
+
+/**
+ * @brief 把文件或匿名内存映射到进程的地址空间
+ * @param addr 希望映射到的地址，为NULL时由内核选择
+ * @param len 字节数
+ * @param prot 访问权限，PROT_*的组合
+ * @param flags MAP_*的组合
+ * @param fd 映射的文件，匿名映射时为-1
+ * @param offset 文件中的偏移
+ * @return 成功返回映射的起始地址，失败返回MAP_FAILED
+ */
+void *mmap(void *addr, uint32_t len, uint32_t prot, uint32_t flags, int32_t fd, uint32_t offset)
+{
+    struct mmap_args args = {(uint32_t)addr, len, prot, flags, fd, offset};
+    return (void *)_syscall1(SYS_MMAP, &args);
+}
+
+/**
+ * @brief 解除[addr, addr + len)的映射
+ * @param addr 起始地址，页对齐
+ * @param len 字节数
+ * @return 成功返回0，失败返回-1
+ */
+int32_t munmap(void *addr, uint32_t len)
+{
+    return _syscall2(SYS_MUNMAP, addr, len);
+}
+
+/**
+ * @brief 修改[addr, addr + len)的访问权限
+ * @param addr 起始地址，页对齐
+ * @param len 字节数
+ * @param prot 新的权限，PROT_*的组合
+ * @return 成功返回0，失败返回-1
+ */
+int32_t mprotect(void *addr, uint32_t len, uint32_t prot)
+{
+    return _syscall3(SYS_MPROTECT, addr, len, prot);
+}
+
+/**
+ * @brief 把[addr, addr + len)中共享文件映射的修改写回文件
+ * @param addr 起始地址，页对齐
+ * @param len 字节数
+ * @return 成功返回0，失败返回-1
+ */
+int32_t msync(void *addr, uint32_t len)
+{
+    return _syscall2(SYS_MSYNC, addr, len);
+}
+
+/**
+ * @brief 打开名为name的共享内存段，不存在时创建
+ * @param name 名称
+ * @param size 字节数
+ * @return 成功返回共享内存段的编号，失败返回-1
+ */
+int32_t shm_open(const char *name, uint32_t size)
+{
+    return _syscall2(SYS_SHM_OPEN, name, size);
+}
+
+/**
+ * @brief 把共享内存段映射到进程的地址空间
+ * @param shm_id 共享内存段的编号
+ * @return 成功返回映射的起始地址，失败返回MAP_FAILED
+ */
+void *shm_map(int32_t shm_id)
+{
+    return (void *)_syscall1(SYS_SHM_MAP, shm_id);
+}
+
+/**
+ * @brief 关闭共享内存段，最后一次关闭时删除它
+ * @param shm_id 共享内存段的编号
+ * @return 成功返回0，失败返回-1
+ */
+int32_t shm_close(int32_t shm_id)
+{
+    return _syscall1(SYS_SHM_CLOSE, shm_id);
+}
+
+/**
+ * @brief 结束当前进程
+ * @param status 退出状态，由父进程通过wait取得
+ */
+void exit(int32_t status)
+{
+    _syscall1(SYS_EXIT, status);
+}
+
+/**
+ * @brief 等待子进程退出并回收它
+ * @param status 输出子进程的退出状态，可以为NULL
+ * @return 成功返回子进程的pid，没有子进程时返回-1
+ */
+pid_t wait(int32_t *status)
+{
+    return _syscall1(SYS_WAIT, status);
+}
+
+/**
+ * @brief 运行内核中名为name的微基准测试，结果由内核直接输出
+ * @param name 测试名称，为NULL时列出所有测试
+ * @param arg 测试的参数，为0时使用默认值
+ * @return 测试的返回值，找不到测试时返回-1
+ */
+int32_t bench(const char *name, uint32_t arg)
+{
+    return _syscall2(SYS_BENCH, name, arg);
+}
+
+/**
+ * @brief 让出CPU，让其他就绪的任务运行
+ */
+void yield(void)
+{
+    _syscall0(SYS_YIELD);
+}
@@ -26,7 +26,20 @@ enum SYSCALL_NR
     SYS_READDIR,
     SYS_REWINDDIR,
     SYS_STAT,
-    SYS_PS
+    SYS_PS,
+    SYS_MEMINFO,
+    SYS_BRK,
+    SYS_MMAP,
+    SYS_MUNMAP,
+    SYS_MPROTECT,
+    SYS_MSYNC,
+    SYS_SHM_OPEN,
+    SYS_SHM_MAP,
+    SYS_SHM_CLOSE,
+    SYS_EXIT,
+    SYS_WAIT,
+    SYS_BENCH,
+    SYS_YIELD
 };
 
 uint32_t getpid(void);
@@ -50,4 +63,18 @@ struct dir_entry *readdir(struct dir *dir);
 void rewinddir(struct dir *dir);
 int32_t state(const char *path, struct stat *stat_buf);
 int32_t chdir(const char *path);
-void ps(void);
\ No newline at end of file
+void ps(void);
+void meminfo(struct mem_info *info);
+int32_t brk(void *end);
+void *sbrk(int32_t increment);
+void *mmap(void *addr, uint32_t len, uint32_t prot, uint32_t flags, int32_t fd, uint32_t offset);
+int32_t munmap(void *addr, uint32_t len);
+int32_t mprotect(void *addr, uint32_t len, uint32_t prot);
+int32_t msync(void *addr, uint32_t len);
+int32_t shm_open(const char *name, uint32_t size);
+void *shm_map(int32_t shm_id);
+int32_t shm_close(int32_t shm_id);
+void exit(int32_t status);
+pid_t wait(int32_t *status);
+int32_t bench(const char *name, uint32_t arg);
+void yield(void);
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "dir.h"
 #include "shell.h"
 #include "assert.h"
+#include "bench.h"
 
 /**
  * @brief 将old_abs_path中的.和..转换为实际路径存入new_abs_path,比如说/home/ik 下的..就会被转换为/home
@@ -467,4 +468,459 @@ int32_t in_rm(uint32_t argc, char **argv)
         }
     }
     return ret;
-}
\ No newline at end of file
+}
+/**
+ * @brief free命令，显示内核和用户内存池的使用情况，以KB为单位
+ * 
+ * @param argc 输入参数的个数
+ * @param argv 输入的参数
+ */
+void in_free(uint32_t argc, char **argv UNUSED)
+{
+    if (argc != 1)
+    {
+        printf("(Gos)free: too much argument!\n");
+        return;
+    }
+    struct mem_info info;
+    meminfo(&info);
+
+    printf("        total     used      free      peak\n");
+    printf("kernel  %d  %d  %d  %d\n", info.kernel_pool.total_pages * 4,
+           (info.kernel_pool.total_pages - info.kernel_pool.free_pages - info.kernel_pool.zero_pages) * 4,
+           (info.kernel_pool.free_pages + info.kernel_pool.zero_pages) * 4, info.kernel_pool.peak_used * 4);
+    printf("user    %d  %d  %d  %d\n", info.user_pool.total_pages * 4,
+           (info.user_pool.total_pages - info.user_pool.free_pages - info.user_pool.zero_pages) * 4,
+           (info.user_pool.free_pages + info.user_pool.zero_pages) * 4, info.user_pool.peak_used * 4);
+    printf("swap    %d  %d  %d\n", info.swap_total_pages * 4, (info.swap_total_pages - info.swap_free_pages) * 4,
+           info.swap_free_pages * 4);
+}
+
+/**
+ * @brief 打印各内存块规格的arena使用情况
+ * 
+ * @param title 标题
+ * @param desc 各规格的统计
+ */
+static void print_desc_info(char *title, struct mem_desc_info *desc)
+{
+    printf("%s size  arenas  empty  free  cached  wasted(B)  hits  misses\n", title);
+    uint32_t desc_idx;
+    for (desc_idx = 0; desc_idx < MEM_DESC_CNT; desc_idx++)
+    {
+        if (desc[desc_idx].arena_cnt == 0)
+        {
+            continue;
+        }
+        //arena中空闲块占着的内存就是浪费的部分
+        printf("    %d  %d  %d  %d  %d  %d  %d  %d\n", desc[desc_idx].block_size, desc[desc_idx].arena_cnt,
+               desc[desc_idx].empty_arenas, desc[desc_idx].free_blocks, desc[desc_idx].cached_blocks,
+               desc[desc_idx].free_blocks * desc[desc_idx].block_size, desc[desc_idx].mag_hits,
+               desc[desc_idx].mag_misses);
+    }
+}
+
+/**
+ * @brief meminfo命令，显示内存池、arena和内核虚拟地址的详细统计
+ * 
+ * @param argc 输入参数的个数
+ * @param argv 输入的参数
+ */
+void in_meminfo(uint32_t argc, char **argv UNUSED)
+{
+    if (argc != 1)
+    {
+        printf("(Gos)meminfo: too much argument!\n");
+        return;
+    }
+    struct mem_info info;
+    meminfo(&info);
+
+    printf("pool    pages  free  zeroed  peak  reserve  borrowed  large  large_pages  zero_hit  zero_miss\n");
+    printf("kernel  %d  %d  %d  %d  %d  %d  %d  %d  %d  %d\n", info.kernel_pool.total_pages, info.kernel_pool.free_pages,
+           info.kernel_pool.zero_pages, info.kernel_pool.peak_used, info.kernel_pool.reserve_pages,
+           info.kernel_pool.borrow_cnt, info.kernel_pool.large_cnt, info.kernel_pool.large_pages,
+           info.kernel_pool.zero_hit, info.kernel_pool.zero_miss);
+    printf("user    %d  %d  %d  %d  %d  %d  %d  %d  %d  %d\n", info.user_pool.total_pages, info.user_pool.free_pages,
+           info.user_pool.zero_pages, info.user_pool.peak_used, info.user_pool.reserve_pages,
+           info.user_pool.borrow_cnt, info.user_pool.large_cnt, info.user_pool.large_pages,
+           info.user_pool.zero_hit, info.user_pool.zero_miss);
+    print_desc_info("kernel heap", info.kernel_descs);
+    print_desc_info("shell heap", info.user_descs);
+    printf("kernel vaddr: free pages %d, extents %d, largest %d\n",
+           info.kva_free_pages, info.kva_extent_cnt, info.kva_largest_pages);
+    printf("swap: pages %d, free %d, swapped out %d, swapped in %d\n",
+           info.swap_total_pages, info.swap_free_pages, info.swap_out_cnt, info.swap_in_cnt);
+    printf("task switch: cr3 loads %d, skipped %d\n", info.cr3_load_cnt, info.cr3_skip_cnt);
+    printf("cache  obj_size  active  total  free_slabs\n");
+    uint32_t cache_idx;
+    for (cache_idx = 0; cache_idx < info.cache_cnt; cache_idx++)
+    {
+        printf("    %s  %d  %d  %d  %d\n", info.caches[cache_idx].name, info.caches[cache_idx].obj_size,
+               info.caches[cache_idx].active_objs, info.caches[cache_idx].total_objs,
+               info.caches[cache_idx].free_slabs);
+    }
+}
+
+/**
+ * @brief 把十进制数字串转换为整数
+ * 
+ * @param str 数字串
+ * @return uint32_t 转换结果，遇到非数字字符时返回0
+ */
+static uint32_t str2num(const char *str)
+{
+    uint32_t num = 0;
+    while (*str != 0)
+    {
+        if (*str < '0' || *str > '9')
+        {
+            return 0;
+        }
+        num = num * 10 + (*str++ - '0');
+    }
+    return num;
+}
+
+/**
+ * @brief 把时钟周期数换算成微秒
+ * 
+ * @param cycles 时钟周期数
+ * @param khz 时间戳计数器的频率，单位kHz
+ * @return uint32_t 微秒数
+ */
+static uint32_t cycles2us(uint64_t cycles, uint32_t khz)
+{
+    return khz == 0 ? 0 : div64_32(cycles * 1000, khz);
+}
+
+/**
+ * @brief 按当前的fork复制方式依次测试各种情况
+ * 
+ * @param rounds 每种情况重复的次数
+ * @param khz 时间戳计数器的频率，单位kHz
+ * @return bool 映射内存或fork失败时返回false
+ */
+static bool bench_fork_cases(uint32_t rounds, uint32_t khz)
+{
+    //每种情况映射的页数和其中写过的页数
+    static const uint32_t fork_cases[][2] = {{1, 1}, {16, 16}, {256, 256}, {16384, 1}};
+    uint32_t case_idx;
+    for (case_idx = 0; case_idx < sizeof(fork_cases) / sizeof(fork_cases[0]); case_idx++)
+    {
+        uint32_t map_pages = fork_cases[case_idx][0];
+        uint32_t touch_pages = fork_cases[case_idx][1];
+        uint8_t *buf = mmap(NULL, map_pages * PG_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED)
+        {
+            printf("(Gos)bench fork: mmap %d pages failed!\n", map_pages);
+            return false;
+        }
+        uint32_t pg_idx;
+        for (pg_idx = 0; pg_idx < touch_pages; pg_idx++)
+        {
+            buf[pg_idx * PG_SIZE] = 1;
+        }
+
+        uint64_t total = 0;
+        uint32_t kernel_pages = 0;
+        uint32_t round;
+        struct mem_info before, after;
+        for (round = 0; round < rounds; round++)
+        {
+            meminfo(&before);
+            uint64_t start = rdtsc();
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                exit(0);
+            }
+            total += rdtsc() - start;
+            if (pid == -1)
+            {
+                printf("(Gos)bench fork: fork failed!\n");
+                break;
+            }
+            meminfo(&after);
+            kernel_pages += before.kernel_pool.free_pages - after.kernel_pool.free_pages;
+            wait(NULL);
+        }
+        munmap(buf, map_pages * PG_SIZE);
+        if (round == 0)
+        {
+            return false;
+        }
+        printf("fork with %d mapped, %d touched pages: %d us, %d cycles, child kernel pages %d\n", map_pages,
+               touch_pages, cycles2us(total, khz) / round, div64_32(total, round), kernel_pages / round);
+    }
+    return true;
+}
+
+/**
+ * @brief fork测试，先写过1、16、256页私有内存，再映射64MB只写1页，测量shell自己fork的延迟和每个子进程占用的内核页
+ * 
+ * @param rounds 每种情况重复的次数，为0时取8
+ * @note 延迟从调用fork到父进程返回；内核页数是fork前后内核内存池空闲页的差，此时子进程还没有运行
+ * @note 最后一种情况映射得多、用得少，fork的开销和占用的内核页应当与只用1页时相近
+ * @note 先用写时复制测一遍，再让内核在fork时立即复制私有页测一遍，作为写时复制之前的基准
+ */
+static void bench_fork(uint32_t rounds)
+{
+    uint32_t khz = bench("hz", 0);
+    rounds = rounds == 0 ? 8 : rounds;
+
+    uint32_t eager;
+    for (eager = 0; eager <= 1; eager++)
+    {
+        bench("forkcopy", eager);
+        if (!bench_fork_cases(rounds, khz))
+        {
+            break;
+        }
+    }
+    bench("forkcopy", 0);
+}
+
+#define RING_SLOTS 64    //环形缓冲区的消息槽数
+#define RING_MSG_SIZE 64 //每条消息的字节数
+
+//放在共享内存中的单生产者单消费者环形缓冲区，head和tail只增不减，槽号取模得到
+struct bench_ring
+{
+    volatile uint32_t head;                  //生产者写入的消息数
+    volatile uint32_t tail;                  //消费者取走的消息数
+    uint8_t msgs[RING_SLOTS][RING_MSG_SIZE]; //消息槽
+};
+
+/**
+ * @brief ring测试，fork出的子进程通过共享内存中的环形缓冲区向shell发送消息，测量吞吐量
+ * 
+ * @param msg_cnt 消息数，为0时取10000
+ * @note 缓冲区满或空时让出CPU，计时从shell收到第一条消息开始；每条消息的内容都是序号，收到时逐条校验
+ */
+static void bench_ring(uint32_t msg_cnt)
+{
+    uint32_t khz = bench("hz", 0);
+    msg_cnt = msg_cnt == 0 ? 10000 : msg_cnt;
+    uint32_t ring_len = DIV_ROUND_UP(sizeof(struct bench_ring), PG_SIZE) * PG_SIZE;
+    int32_t shm_id = shm_open("bench_ring", ring_len);
+    if (shm_id == -1)
+    {
+        printf("(Gos)bench ring: shm_open failed!\n");
+        return;
+    }
+    struct bench_ring *ring = shm_map(shm_id);
+    if (ring == MAP_FAILED)
+    {
+        printf("(Gos)bench ring: shm_map failed!\n");
+        shm_close(shm_id);
+        return;
+    }
+    ring->head = ring->tail = 0;
+
+    uint32_t seq, word_idx;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        //子进程是生产者
+        for (seq = 0; seq < msg_cnt; seq++)
+        {
+            while (ring->head - ring->tail == RING_SLOTS)
+            {
+                yield();
+            }
+            uint32_t *msg = (uint32_t *)ring->msgs[ring->head % RING_SLOTS];
+            for (word_idx = 0; word_idx < RING_MSG_SIZE / sizeof(uint32_t); word_idx++)
+            {
+                msg[word_idx] = seq;
+            }
+            ring->head++;
+        }
+        exit(0);
+    }
+    if (pid == -1)
+    {
+        printf("(Gos)bench ring: fork failed!\n");
+        munmap(ring, ring_len);
+        shm_close(shm_id);
+        return;
+    }
+
+    uint64_t start = 0;
+    uint32_t bad_cnt = 0;
+    for (seq = 0; seq < msg_cnt; seq++)
+    {
+        while (ring->head == ring->tail)
+        {
+            yield();
+        }
+        if (seq == 0)
+        {
+            start = rdtsc();
+        }
+        uint32_t *msg = (uint32_t *)ring->msgs[ring->tail % RING_SLOTS];
+        for (word_idx = 0; word_idx < RING_MSG_SIZE / sizeof(uint32_t); word_idx++)
+        {
+            if (msg[word_idx] != seq)
+            {
+                bad_cnt++;
+                break;
+            }
+        }
+        ring->tail++;
+    }
+    uint32_t us = cycles2us(rdtsc() - start, khz);
+    wait(NULL);
+    munmap(ring, ring_len);
+    shm_close(shm_id);
+
+    us = us == 0 ? 1 : us;
+    printf("ring: %d messages of %d bytes, %d us, %d msgs/s, %d KB/s, %d corrupted\n", msg_cnt, RING_MSG_SIZE, us,
+           div64_32((uint64_t)msg_cnt * 1000000, us), div64_32(((uint64_t)msg_cnt * RING_MSG_SIZE * 1000000) >> 10, us),
+           bad_cnt);
+}
+
+/**
+ * @brief pswitch测试，shell和fork出的子进程各自让出CPU rounds次，测量进程之间切换的开销
+ * 
+ * @param rounds 每个进程让出CPU的次数，为0时取10000
+ * @note 两个进程的页目录不同，每次切换都要重新加载CR3，用meminfo中的计数核对；内核页是全局页，重新加载后仍留在TLB中
+ */
+static void bench_pswitch(uint32_t rounds)
+{
+    uint32_t khz = bench("hz", 0);
+    rounds = rounds == 0 ? 10000 : rounds;
+    struct mem_info before, after;
+    meminfo(&before);
+
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        printf("(Gos)bench pswitch: fork failed!\n");
+        return;
+    }
+    uint32_t round;
+    uint64_t start = rdtsc();
+    for (round = 0; round < rounds; round++)
+    {
+        yield();
+    }
+    uint64_t cycles = rdtsc() - start;
+    if (pid == 0)
+    {
+        printf("pswitch child: %d yields, %d cycles/switch\n", rounds, div64_32(cycles, rounds * 2));
+        exit(0);
+    }
+    wait(NULL);
+    meminfo(&after);
+
+    //两个进程交替运行，自己的每次让出之间还包含对方的一次切换
+    printf("pswitch parent: %d yields, %d cycles/switch, %d us total\n", rounds, div64_32(cycles, rounds * 2),
+           cycles2us(cycles, khz));
+    printf("cr3 loads %d, skips %d\n", after.cr3_load_cnt - before.cr3_load_cnt,
+           after.cr3_skip_cnt - before.cr3_skip_cnt);
+}
+
+/**
+ * @brief bench命令，运行内核中的微基准测试，不带参数时列出所有测试
+ * @note fork、ring和pswitch测试在shell中完成
+ * 
+ * @param argc 输入参数的个数
+ * @param argv 输入的参数，argv[1]是测试名称，argv[2]是可选的数量参数
+ */
+void in_bench(uint32_t argc, char **argv)
+{
+    if (argc > 3)
+    {
+        printf("(Gos)bench: too much argument!\n");
+        return;
+    }
+    if (argc == 1)
+    {
+        bench(NULL, 0);
+        printf("    fork  [rounds] fork latency and kernel pages per child\n");
+        printf("    ring  [msgs] shared memory ring throughput between two processes\n");
+        printf("    pswitch  [rounds] context switch between two processes\n");
+        return;
+    }
+    uint32_t arg = argc == 3 ? str2num(argv[2]) : 0;
+    //需要fork子进程的测试在shell中完成
+    if (!strcmp(argv[1], "fork"))
+    {
+        bench_fork(arg);
+        return;
+    }
+    if (!strcmp(argv[1], "ring"))
+    {
+        bench_ring(arg);
+        return;
+    }
+    if (!strcmp(argv[1], "pswitch"))
+    {
+        bench_pswitch(arg);
+        return;
+    }
+    bench(argv[1], arg);
+}
+
+/**
+ * @brief forkloop命令，反复fork出子进程并回收，比较前后的空闲内存，检查退出时是否完整回收了地址空间
+ * 
+ * @param argc 输入参数的个数
+ * @param argv 输入的参数，argv[1]是可选的循环次数，默认100
+ * @note 子进程写过一些堆和匿名映射的页才退出；先预热一轮，让对象缓存和页表等一次性的开销不计入差值
+ */
+void in_forkloop(uint32_t argc, char **argv)
+{
+    if (argc > 2)
+    {
+        printf("(Gos)forkloop: too much argument!\n");
+        return;
+    }
+    uint32_t loops = argc == 2 ? str2num(argv[1]) : 0;
+    loops = loops == 0 ? 100 : loops;
+
+    struct mem_info before, after;
+    uint32_t loop;
+    for (loop = 0; loop <= loops; loop++)
+    {
+        if (loop == 1)
+        {
+            meminfo(&before);
+        }
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            uint8_t *heap = malloc(4 * PG_SIZE);
+            uint8_t *anon = mmap(NULL, 4 * PG_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            uint32_t pg_idx;
+            for (pg_idx = 0; pg_idx < 4; pg_idx++)
+            {
+                if (heap != NULL)
+                {
+                    heap[pg_idx * PG_SIZE] = 1;
+                }
+                if (anon != MAP_FAILED)
+                {
+                    anon[pg_idx * PG_SIZE] = 1;
+                }
+            }
+            exit(0);
+        }
+        if (pid == -1)
+        {
+            printf("(Gos)forkloop: fork failed at loop %d!\n", loop);
+            return;
+        }
+        wait(NULL);
+    }
+    meminfo(&after);
+
+    printf("forkloop: %d children\n", loops);
+    printf("kernel free pages %d -> %d, leaked %d\n", before.kernel_pool.free_pages, after.kernel_pool.free_pages,
+           before.kernel_pool.free_pages - after.kernel_pool.free_pages);
+    printf("user free pages %d -> %d, leaked %d\n", before.user_pool.free_pages, after.user_pool.free_pages,
+           before.user_pool.free_pages - after.user_pool.free_pages);
+    printf("kernel vaddr free pages %d -> %d, leaked %d\n", before.kva_free_pages, after.kva_free_pages,
+           before.kva_free_pages - after.kva_free_pages);
+}
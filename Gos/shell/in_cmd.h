@@ -11,4 +11,8 @@ void in_clear(uint32_t argc, char **argv);
 int32_t in_mkdir(uint32_t argc, char **argv);
 int32_t in_rmdir(uint32_t argc, char **argv);
 int32_t in_mkfile(uint32_t argc, char **argv);
-int32_t in_rm(uint32_t argc, char **argv);
\ No newline at end of file
+int32_t in_rm(uint32_t argc, char **argv);
+void in_free(uint32_t argc, char **argv);
+void in_meminfo(uint32_t argc, char **argv);
+void in_bench(uint32_t argc, char **argv);
+void in_forkloop(uint32_t argc, char **argv);
\ No newline at end of file
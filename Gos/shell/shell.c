@@ -205,6 +205,22 @@ void my_shell(void)
         {
             in_rm(argc, argv);
         }
+        else if (!strcmp("free", argv[0]))
+        {
+            in_free(argc, argv);
+        }
+        else if (!strcmp("meminfo", argv[0]))
+        {
+            in_meminfo(argc, argv);
+        }
+        else if (!strcmp("bench", argv[0]))
+        {
+            in_bench(argc, argv);
+        }
+        else if (!strcmp("forkloop", argv[0]))
+        {
+            in_forkloop(argc, argv);
+        }
     }
     panic("my_shell: should not be here");
 }
@@ -95,6 +95,25 @@ void get_lock(struct lock *plock)
     }
 }
 
+/*
+ * @brief 尝试获得锁plock的所有权，锁被其他线程持有时不等待
+ * @param plock 待操作的锁
+ * @return 获得锁返回true
+ * @note 供idle这类不能阻塞的线程使用
+ */
+bool try_get_lock(struct lock *plock)
+{
+    enum intr_status old_status = intr_disable();
+    bool available = plock->holder == running_thread() || plock->sema.value > 0;
+    if (available)
+    {
+        //信号量可用，get_lock不会阻塞
+        get_lock(plock);
+    }
+    intr_set_status(old_status);
+    return available;
+}
+
 /*
  * @brief 锁的持有者放弃plock的所有权
  * @param plock 待操作的锁
@@ -23,4 +23,5 @@ void sema_down(struct semaphore *psema);
 void sema_up(struct semaphore *psema);
 void lock_init(struct lock *plock);
 void get_lock(struct lock *plock);
+bool try_get_lock(struct lock *plock);
 void abandon_lock(struct lock *plock);
\ No newline at end of file
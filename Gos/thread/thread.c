@@ -11,6 +11,7 @@
 #include "stdio.h"
 #include "fs.h"
 #include "file.h"
+#include "slab.h"
 extern void init(void);
 
 #define PG_SIZE 4096
@@ -22,6 +23,8 @@ static struct list_elem *thread_tag; //用于保存队列中的线程节点
 
 struct lock pid_lock;
 
+struct kmem_cache *task_cache; //pcb缓存，每个对象是pcb加内核栈所在的一整页
+
 struct task_struct *idle_thread; //idle线程,用于thread_ready_list队列中没有线程运行的时候，默认运行这个线程
 
 /*
@@ -147,8 +150,8 @@ void init_thread(struct task_struct *pthread, char *name, int pthread_priority)
  */
 struct task_struct *thread_start(char *name, int priority, thread_func function, void *func_arg)
 {
-    //申请一页的内核空间
-    struct task_struct *thread = get_kernel_pages(1);
+    //从pcb缓存申请一页的内核空间
+    struct task_struct *thread = kmem_cache_alloc(task_cache);
     init_thread(thread, name, priority);
     thread_create(thread, function, func_arg);
 
@@ -225,8 +228,22 @@ static void idle(void *arg UNUSED)
     {
         //阻塞线程
         thread_block(TASK_BLOCKED);
-        asm volatile("sti;hlt" ::
-                         : "memory");
+
+        //被唤醒说明没有其他线程可运行，趁空闲补充清零的页框，一旦有线程就绪就停下
+        while (list_empty(&thread_ready_list) && zero_stock_refill())
+            ;
+
+        //检查和hlt之间关中断，sti的下一条指令执行完才响应中断，不会错过唤醒
+        intr_disable();
+        if (list_empty(&thread_ready_list))
+        {
+            asm volatile("sti;hlt" ::
+                             : "memory");
+        }
+        else
+        {
+            intr_enable();
+        }
     }
 }
 
@@ -299,6 +316,7 @@ void thread_init(void)
     list_init(&thread_all_list);
 
     lock_init(&pid_lock);
+    task_cache = kmem_cache_create("task_struct", PG_SIZE, NULL);
 
     //创建第一个用户进程
     create_process(init, "init");
@@ -424,4 +442,34 @@ void sys_ps(void)
 pid_t fork_pid(void)
 {
     return allocate_pid();
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 回调函数，判断任务的pid是否为pid
+ * 
+ * @param pelem 任务在thread_all_list中的节点
+ * @param pid 要找的pid
+ * @return true 找到返回true，停止遍历
+ * @return false 
+ */
+static bool check_pid(struct list_elem *pelem, int pid)
+{
+    struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+    return pthread->pid == pid;
+}
+
+/**
+ * @brief 根据pid找到任务的pcb
+ * 
+ * @param pid 任务的pid
+ * @return struct task_struct* 找到返回pcb，否则返回NULL
+ */
+struct task_struct *pid2thread(pid_t pid)
+{
+    struct list_elem *pelem = list_traversal(&thread_all_list, check_pid, pid);
+    if (pelem == NULL)
+    {
+        return NULL;
+    }
+    return elem2entry(struct task_struct, all_list_tag, pelem);
+}
@@ -2,6 +2,7 @@
 #include "stdint.h"
 #include "list.h"
 #include "memory.h"
+#include "vma.h"
 #include "global.h"
 
 #define MAX_FILES_OPEN_PER_PROC 8
@@ -92,18 +93,22 @@ struct task_struct
     struct list_elem all_list_tag; //作用于线程队列thread_all_list中的节点
 
     uint32_t *pgdir;                                  //进程页表的虚拟地址
-    struct virtual_addr userprog_vaddr;               //用户进程的虚拟地址
+    struct mm_struct mm;                              //用户进程的虚拟内存区域
     struct mem_block_desc u_block_desc[MEM_DESC_CNT]; //进程的内存管理模块
+    struct mem_magazine mem_mag[MEM_SMALL_DESC_CNT];  //各小规格内存块的私有缓存
 
     int32_t fd_table[MAX_FILES_OPEN_PER_PROC]; //文件描述符数组
+    uint16_t shm_opened;                       //打开的共享内存段，第i位对应编号为i的段
 
     uint32_t cwd_inode_no; //进程所在的工作目录的inode编号
     uint16_t parent_pid;   //父进程的pid
+    int8_t exit_status;    //进程退出时的状态，由父进程通过wait取得
     uint32_t stack_magic;  //栈的边界标记，用于检测栈溢出
 };
 
 extern struct list thread_ready_list;
 extern struct list thread_all_list;
+extern struct kmem_cache *task_cache;
 
 void thread_create(struct task_struct *pthread, thread_func function, void *func_arg);
 void init_thread(struct task_struct *pthread, char *name, int prio);
@@ -115,4 +120,5 @@ void thread_block(enum task_status stat);
 void thread_unblock(struct task_struct *pthread);
 void thread_yield(void);
 pid_t fork_pid(void);
+struct task_struct *pid2thread(pid_t pid);
 void sys_ps(void);
\ No newline at end of file
@@ -0,0 +1,151 @@
+/*
+ * 在宿主机上比较位图扫描的速度：原来逐字节跳过、逐位测试的扫描，按32位字的扫描，以及加上摘要位图的扫描。
+ * 位图按128MB内存、每位一页计算，共32768位，分别在0%、50%、90%、99%的占用率下测试。
+ * 用make bitmap_bench编译运行，lib/kernel/bitmap.c和内核一样不开优化原样编译，debug.h换成本目录下的版本，用时间戳计数器计时
+ */
+#include "bitmap.h"
+#include "debug.h"
+#include "bench.h"
+#include <stdio.h>
+
+#define BENCH_MEM_BYTES (128 * 1024 * 1024)           //位图对应的内存大小
+#define BENCH_BITS (BENCH_MEM_BYTES / PG_SIZE)         //每位一页
+#define BENCH_BYTES (BENCH_BITS / 8)                   //位图字节数
+#define BENCH_ROUNDS 2000                              //每项扫描重复的次数
+
+static uint8_t bits[BENCH_BYTES];
+static uint32_t summary[BITMAP_SUMMARY_LEN(BENCH_BYTES)];
+
+/*
+ * @brief 原来的bitmap_scan，逐字节跳过全满的字节，再逐位测试，用作比较的基准
+ * @param btmp 结构体bitmap的指针
+ * @param cnt 申请的位个数
+ * @return 申请的起始下标，如果不够用就返回-1
+ */
+static int byte_bit_scan(struct bitmap *btmp, uint32_t cnt)
+{
+    uint32_t idx_byte = 0; //记录空闲位所在字节
+    //略过分配过的字节
+    while ((idx_byte < btmp->btmp_bytes_len) && (0xff == btmp->bits[idx_byte]))
+    {
+        idx_byte++;
+    }
+    if (idx_byte == btmp->btmp_bytes_len)
+    {
+        return -1;
+    }
+
+    int idx_bit = 0;
+    //找这个字节第一个空闲的位
+    while ((uint8_t)(BITMAP_MASK << idx_bit) & btmp->bits[idx_byte])
+    {
+        idx_bit++;
+    }
+
+    int bit_idx_start = idx_byte * 8 + idx_bit;
+    if (cnt == 1)
+    {
+        return bit_idx_start;
+    }
+
+    //记录还有多少位可以判断
+    uint32_t bit_left = (btmp->btmp_bytes_len * 8 - bit_idx_start - 1);
+    uint32_t next_bit = bit_idx_start + 1;
+    uint32_t count = 1; //记录找到的空闲位的个数
+    bit_idx_start = -1;
+    while (bit_left-- > 0)
+    {
+        if (!(bitmap_scan_test(btmp, next_bit)))
+        {
+            count++;
+        }
+        else
+        {
+            count = 0;
+        }
+        //找到了连续的cnt个空位
+        if (count == cnt)
+        {
+            bit_idx_start = next_bit - cnt + 1;
+            break;
+        }
+        next_bit++;
+    }
+    return bit_idx_start;
+}
+
+/*
+ * @brief 按占用率填充位图
+ * @param btmp 结构体bitmap的指针
+ * @param fill 占用率，百分数
+ * @param scattered 为0时前fill%的位连续占用，即首次适配一直分配的样子；
+ *        否则每100位中占用前fill位，空洞分散在整个位图中
+ */
+static void bench_fill(struct bitmap *btmp, uint32_t fill, int scattered)
+{
+    uint32_t bit_idx;
+    for (bit_idx = 0; bit_idx < BENCH_BITS; bit_idx++)
+    {
+        int used = scattered ? bit_idx % 100 < fill : bit_idx < BENCH_BITS / 100 * fill;
+        bitmap_set(btmp, bit_idx, used);
+    }
+}
+
+/*
+ * @brief 重复扫描BENCH_ROUNDS次，得到每次扫描的平均时钟周期数
+ * @param btmp 结构体bitmap的指针
+ * @param cnt 申请的位个数
+ * @param old 为1时使用原来的扫描
+ * @param result 输出扫描结果
+ * @return 每次扫描的时钟周期数
+ */
+static uint32_t bench_time(struct bitmap *btmp, uint32_t cnt, int old, int *result)
+{
+    volatile int ret = 0;
+    uint32_t round;
+    uint64_t start = rdtsc();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        ret = old ? byte_bit_scan(btmp, cnt) : bitmap_scan(btmp, cnt);
+    }
+    uint64_t cycles = rdtsc() - start;
+    *result = ret;
+    return div64_32(cycles, BENCH_ROUNDS);
+}
+
+int main(void)
+{
+    static const uint32_t fills[] = {0, 50, 90, 99};
+    static const uint32_t cnts[] = {1, 16};
+    struct bitmap btmp;
+    btmp.btmp_bytes_len = BENCH_BYTES;
+    btmp.bits = bits;
+    btmp.summary = NULL;
+
+    printf("%u bits (%u MB of 4KB pages), cycles per scan\n", BENCH_BITS, BENCH_MEM_BYTES / 1024 / 1024);
+    printf("layout     fill  cnt  byte/bit     word  summary\n");
+    int scattered;
+    for (scattered = 0; scattered <= 1; scattered++)
+    {
+        uint32_t fill_idx;
+        for (fill_idx = 0; fill_idx < sizeof(fills) / sizeof(fills[0]); fill_idx++)
+        {
+            btmp.summary = NULL;
+            bench_fill(&btmp, fills[fill_idx], scattered);
+            uint32_t cnt_idx;
+            for (cnt_idx = 0; cnt_idx < sizeof(cnts) / sizeof(cnts[0]); cnt_idx++)
+            {
+                int old_ret, word_ret, summary_ret;
+                btmp.summary = NULL;
+                uint32_t old_cycles = bench_time(&btmp, cnts[cnt_idx], 1, &old_ret);
+                uint32_t word_cycles = bench_time(&btmp, cnts[cnt_idx], 0, &word_ret);
+                bitmap_summary_init(&btmp, summary);
+                uint32_t summary_cycles = bench_time(&btmp, cnts[cnt_idx], 0, &summary_ret);
+                printf("%-9s  %3u%%  %3u  %8u  %7u  %7u%s\n", scattered ? "scattered" : "packed", fills[fill_idx],
+                       cnts[cnt_idx], old_cycles, word_cycles, summary_cycles,
+                       old_ret == word_ret && word_ret == summary_ret ? "" : "  results differ!");
+            }
+        }
+    }
+    return 0;
+}
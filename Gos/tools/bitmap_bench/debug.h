@@ -0,0 +1,6 @@
+//在宿主机上编译lib/kernel/bitmap.c时代替kernel/debug.h，断言失败时直接退出
+#pragma once
+#include <assert.h>
+
+#define PANIC(...) assert(!"PANIC")
+#define ASSERT(CONDITION) assert(CONDITION)
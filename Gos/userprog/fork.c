@@ -6,9 +6,14 @@
 #include "thread.h"
 #include "string.h"
 #include "file.h"
+#include "slab.h"
+#include "swap.h"
+#include "shm.h"
 
 extern void intr_exit(void);
 
+bool fork_eager_copy = false; //为true时fork立即为子进程复制所有私有页，不用写时复制，只用来和写时复制对比
+
 /**
  * @brief 将父进程的pcb拷贝给子进程
  * 
@@ -31,68 +36,108 @@ static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct *child_thread, str
     child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
 
     block_desc_init(child_thread->u_block_desc);
+    magazine_init(child_thread->mem_mag);
 
-    //# 2.复制父进程虚拟地址池的位图
-    uint32_t bitmap_page_count = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
-    //此时子进程的child_thread->userprog_vaddr.vaddr_bitmap.bits指向的还是父进程的位图地址，需要自己也整一个
-    void *vaddr_bitmap = get_kernel_pages(bitmap_page_count);
-    memcpy(vaddr_bitmap, child_thread->userprog_vaddr.vaddr_bitmap.bits, bitmap_page_count * PG_SIZE);
+    //# 2.复制父进程的虚拟内存区域
+    //此时子进程的child_thread->mm指向的还是父进程的区域，需要自己也整一份
+    if (mm_copy(&child_thread->mm, &parent_thread->mm) == -1)
+    {
+        return -1;
+    }
     ASSERT(strlen(child_thread->name) < 11);
     strcat(child_thread->name, "_fork"); //子进程为父进程名称的拷贝
     return 0;
 }
 
 /**
- * @brief 复制子进程的进程体以及用户栈
+ * @brief 以写时复制的方式让子进程共享父进程的进程体以及用户栈
  * 
  * @param child_thread 子进程
- * @param parent_thraed 父进程
- * @param buf_page 页缓冲,此为内核页
+ * @param parent_thread 父进程，即当前进程
+ * @return int32_t 成功返回0，失败返回-1
+ * @note 只为子进程复制页表，双方可写的私有页都改为只读并标记PG_COW，写的时候再由页故障复制
+ * @note 换出的页复制交换项，交换槽由父子进程共享
+ * @note 子进程页表通过临时窗口访问，不切换CR3，最后只刷新一次父进程的TLB
+ * @note 只遍历父进程的虚拟内存区域，耗时与已使用的区域成正比
+ * @note fork_eager_copy为true时私有页当场复制一份给子进程，父进程的页表项不变，即原来复制整个进程体的做法；
+ *       换出的页仍然共享交换项
  */
-static void copy_body_stack3(struct task_struct *child_thread, struct task_struct *parent_thraed, void *buf_page)
+static int32_t share_body_stack3(struct task_struct *child_thread, struct task_struct *parent_thread)
 {
-    //获取父进程的位图信息
-    uint8_t *vaddr_btmp = parent_thraed->userprog_vaddr.vaddr_bitmap.bits;
-    uint32_t btmp_bytes_len = parent_thraed->userprog_vaddr.vaddr_bitmap.btmp_bytes_len;
-
-    uint32_t vaddr_start = parent_thraed->userprog_vaddr.vaddr_start;
-    uint32_t idx_byte = 0;
-    uint32_t idx_bit = 0;
-    uint32_t prog_vaddr = 0;
-
-    //* 父进程的用户空间中查找已有数据的页,之后进行每个位拷贝
-    while (idx_byte < btmp_bytes_len)
+    struct vm_area *vma = vma_next(&parent_thread->mm, NULL);
+    while (vma != NULL)
     {
-        if (vaddr_btmp[idx_byte])
+        //区域覆盖到的每个页目录项，页表整张复制
+        uint32_t vaddr;
+        for (vaddr = vma->vm_start & 0xffc00000; vaddr < vma->vm_end; vaddr += 0x400000)
         {
-            //此时这个字节中的位图代表的空间有数据
-            //字节有8位，判断哪一位有数据
-            idx_bit = 0;
-            while (idx_bit < 8)
+            uint32_t pde_idx = vaddr >> 22;
+            if (!(*pde_ptr(vaddr) & PG_P_1) || (child_thread->pgdir[pde_idx] & PG_P_1))
             {
-                if ((BITMAP_MASK << idx_bit) & vaddr_btmp[idx_byte])
-                {
-                    //得到这个位代表的内存空间地址
-                    prog_vaddr = (idx_byte * 8 + idx_bit) * PG_SIZE + vaddr_start;
-                    //# 1.先把这个数据拷贝到内核空间中做中转，之后拷贝到子进程自己的空间
-                    memcpy(buf_page, (void *)prog_vaddr, PG_SIZE);
-
-                    //# 2.将页表切换到子进程，避免在父进程中申请内存
-                    page_dir_activate(child_thread);
-                    //# 3.申请虚拟地址
-                    get_one_page_without_operate_vaddr_bitmap(PF_USER, prog_vaddr);
+                //父进程还没有这张页表，或者已经随前一个区域复制过
+                continue;
+            }
 
-                    //# 4.将内核缓冲区中父进程的数据复制到子进程的用户空间之中
-                    memcpy((void *)prog_vaddr, buf_page, PG_SIZE);
+            //为子进程申请一个页表
+            uint32_t pt_phyaddr = (uint32_t)palloc_order(PF_KERNEL, 0);
+            if (pt_phyaddr == 0)
+            {
+                page_dir_activate(parent_thread);
+                return -1;
+            }
 
-                    //# 5.恢复父进程的页表
-                    page_dir_activate(parent_thraed);
+            uint32_t *parent_pt = pte_ptr(vaddr);
+            uint32_t *child_pt = kmap(KMAP_PGTABLE, pt_phyaddr);
+            uint32_t pte_idx;
+            for (pte_idx = 0; pte_idx < 1024; pte_idx++)
+            {
+                uint32_t pte = parent_pt[pte_idx];
+                if (pte & PG_P_1)
+                {
+                    //共享文件映射的页在父子进程之间继续共享，其余可写的页改为写时复制
+                    uint32_t pg_vaddr = vaddr + pte_idx * PG_SIZE;
+                    struct vm_area *pte_vma = pte & (PG_RW_W | PG_COW) ? vma_find(&parent_thread->mm, pg_vaddr) : NULL;
+                    bool private = (pte & (PG_RW_W | PG_COW)) && (pte_vma == NULL || !(pte_vma->vm_flags & VM_SHARED));
+                    //写时复制的页只在区域可写时复制，mprotect去掉写权限的页仍然共享
+                    bool writable = (pte & PG_RW_W) || (pte_vma != NULL && (pte_vma->vm_flags & VM_WRITE));
+                    if (private && writable && fork_eager_copy)
+                    {
+                        uint32_t copy_phyaddr = user_frame_fill((void *)pg_vaddr);
+                        if (copy_phyaddr == 0)
+                        {
+                            //剩下的页表项清零，挂上页表后由调用者连同已复制的页一起释放
+                            memset(&child_pt[pte_idx], 0, (1024 - pte_idx) * sizeof(uint32_t));
+                            kunmap(KMAP_PGTABLE);
+                            child_thread->pgdir[pde_idx] = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
+                            page_dir_activate(parent_thread);
+                            return -1;
+                        }
+                        child_pt[pte_idx] = copy_phyaddr | (pte & 0xfff & ~PG_COW) | PG_RW_W;
+                        continue;
+                    }
+                    if ((pte & PG_RW_W) && private)
+                    {
+                        pte = (pte & ~PG_RW_W) | PG_COW;
+                        parent_pt[pte_idx] = pte;
+                    }
+                    page_frame_ref(pte & 0xfffff000);
+                }
+                else if (pte & PG_SWAP)
+                {
+                    //换出的页由父子进程各自换入
+                    swap_entry_dup(pte);
                 }
-                idx_bit++; //继续判断下一个位
+                child_pt[pte_idx] = pte;
             }
+            kunmap(KMAP_PGTABLE);
+            child_thread->pgdir[pde_idx] = pt_phyaddr | PG_US_U | PG_RW_W | PG_P_1;
         }
-        idx_byte++; //继续判断下一个字节
+        vma = vma_next(&parent_thread->mm, vma);
     }
+
+    //父进程的页表项已改为只读，重新加载CR3使其生效
+    page_dir_activate(parent_thread);
+    return 0;
 }
 
 /**
@@ -157,17 +202,12 @@ static void update_inode_open_cnts(struct task_struct *thread)
  * @param child_thread 子进程指针
  * @param parent_thread 父进程指针
  * @return uint32_t 成功返回0，失败返回-1 
+ * @note 失败时已经为子进程建立的区域、页表和页目录都已释放，pcb由调用者释放
  */
 static uint32_t copy_process(struct task_struct *child_thread, struct task_struct *parent_thread)
 {
-    //内核缓冲区
-    void *buf_page = get_kernel_pages(1);
-    if (buf_page == NULL)
-    {
-        return -1;
-    }
-
     //# 1.复制父进程的pcb、虚拟地址位图、内核栈
+    //mm_copy失败时自己释放已经复制的区域
     if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1)
     {
         //这种情况基本没有
@@ -178,18 +218,27 @@ static uint32_t copy_process(struct task_struct *child_thread, struct task_struc
     child_thread->pgdir = create_page_dir();
     if (child_thread->pgdir == NULL)
     {
+        mm_release(&child_thread->mm);
         return -1;
     }
 
-    //# 3.复制父进程的进程体给子进程
-    copy_body_stack3(child_thread, parent_thread, buf_page);
+    //# 3.子进程以写时复制的方式共享父进程的进程体
+    if (share_body_stack3(child_thread, parent_thread) == -1)
+    {
+        //放下已经复制的页表对父进程页框的引用，再释放页表、区域和页目录
+        user_pgdir_release(child_thread->pgdir);
+        mm_release(&child_thread->mm);
+        kernel_pde_drop(child_thread->pgdir);
+        free_kernel_pages(child_thread->pgdir, 1);
+        return -1;
+    }
 
     //# 4.构建子进程thread_stack和修改返回值
     build_child_stack(child_thread);
 
-    //# 5.更新文件的inode打开数
+    //# 5.更新文件的inode打开数和共享内存段的打开次数
     update_inode_open_cnts(child_thread);
-    mfree_page(PF_KERNEL, buf_page, 1);
+    shm_task_dup(child_thread);
     return 0;
 }
 
@@ -202,7 +251,7 @@ pid_t sys_fork(void)
 {
     struct task_struct *parent_thread = running_thread();
     //为进程创建pcb
-    struct task_struct *child_thread = get_kernel_pages(1);
+    struct task_struct *child_thread = kmem_cache_alloc(task_cache);
     if (child_thread == NULL)
     {
         return -1;
@@ -211,6 +260,7 @@ pid_t sys_fork(void)
     ASSERT(INTR_OFF == intr_get_status() && parent_thread->pgdir != NULL);
     if (copy_process(child_thread, parent_thread) == -1)
     {
+        kmem_cache_free(task_cache, child_thread);
         return -1;
     }
 
@@ -1,4 +1,6 @@
 #pragma once
 
 #include "thread.h"
+extern bool fork_eager_copy;
+
 pid_t sys_fork(void);
@@ -9,6 +9,7 @@
 #include "interrupt.h"
 #include "list.h"
 #include "stdio.h"
+#include "slab.h"
 
 #define PG_SIZE 4096
 //此函数定义在kernel.S
@@ -46,19 +47,23 @@ void start_process(void *filename_)
     proc_stack->eip = function;
     proc_stack->cs = SELECTOR_U_CODE;
     proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
-    //分配特权级3下的栈
-    proc_stack->esp = (void *)((uint32_t)get_a_page(PF_USER, USER_STACK3_VADDR) + PG_SIZE);
+    //特权级3下的栈已在虚拟地址位图中保留，第一次压栈时由页故障分配
+    proc_stack->esp = (void *)(USER_STACK3_VADDR + PG_SIZE);
     proc_stack->ss = SELECTOR_U_DATA;
     asm volatile("movl %0,%%esp; jmp intr_exit" ::"g"(proc_stack)
                  : "memory");
 }
 
+static uint32_t cr3_load_cnt = 0; //切换任务时重新加载CR3的次数
+static uint32_t cr3_skip_cnt = 0; //切换任务时页目录不变、省去重新加载CR3的次数
+
 /*
- * @brief 激活页表
- * @param pthread 待激活的进程
+ * @brief 得到任务使用的页目录的物理地址
+ * @param pthread 任务
+ * @return 页目录的物理地址
  * @note 如果是内核线程默认地址是0x100000，用户进程就需要进行其虚拟地址到物理地址的转换获得物理地址
  */
-void page_dir_activate(struct task_struct *pthread)
+static uint32_t page_dir_phyaddr(struct task_struct *pthread)
 {
     uint32_t pagedir_phyaddr = 0x100000; //此为内核使用的页表的物理地址
     if (pthread->pgdir != NULL)
@@ -66,20 +71,63 @@ void page_dir_activate(struct task_struct *pthread)
         //代表其实是用户进程，获得其物理地址
         pagedir_phyaddr = addr_v2p((uint32_t)pthread->pgdir);
     }
+    return pagedir_phyaddr;
+}
 
+/*
+ * @brief 得到CR3中当前加载的页目录的物理地址
+ * @return 页目录的物理地址
+ */
+static inline uint32_t cr3_read(void)
+{
+    uint32_t cr3;
+    asm volatile("movl %%cr3, %0"
+                 : "=r"(cr3));
+    return cr3;
+}
+
+/*
+ * @brief 激活页表
+ * @param pthread 待激活的进程
+ * @note 总是重新加载CR3，也用于在修改了当前页目录的用户页表项之后刷新TLB
+ */
+void page_dir_activate(struct task_struct *pthread)
+{
     //重新激活页表
-    asm volatile("movl %0,%%cr3" ::"r"(pagedir_phyaddr)
+    asm volatile("movl %0,%%cr3" ::"r"(page_dir_phyaddr(pthread))
                  : "memory");
 }
 
+/*
+ * @brief 判断pthread的页目录是否正加载在CR3中
+ * @param pthread 进程
+ * @return 是返回true
+ * @note 内核线程沿用上一个任务的页目录，所以正在运行的不一定是页目录的主人
+ */
+bool page_dir_loaded(struct task_struct *pthread)
+{
+    return pthread->pgdir != NULL && page_dir_phyaddr(pthread) == cr3_read();
+}
+
 /*
  * @brief 激活线程或者进程的页表，更新tss中的esp0为进程的特权级0的栈
  * @param pthread 待激活的进程或者线程
+ * @note 内核线程只访问内核空间，所有页目录的内核部分都相同，沿用上一个任务的页目录即可；
+ *       进程的页目录已经在CR3中时也不重新加载，TLB中它的用户页仍然有效，内核页是全局页本来就不会被刷新
+ * @note 进程退出后页目录由父进程在自己的上下文中释放，那时CR3中是父进程的页目录，沿用的页目录不会被提前释放
  */
 void process_activate(struct task_struct *pthread)
 {
     ASSERT(pthread != NULL);
-    page_dir_activate(pthread);
+    if (pthread->pgdir != NULL && !page_dir_loaded(pthread))
+    {
+        page_dir_activate(pthread);
+        cr3_load_cnt++;
+    }
+    else
+    {
+        cr3_skip_cnt++;
+    }
 
     if (pthread->pgdir)
     {
@@ -88,6 +136,17 @@ void process_activate(struct task_struct *pthread)
     }
 }
 
+/**
+ * @brief 得到切换任务时重新加载和省去加载CR3的次数
+ * @param load_cnt 输出重新加载的次数
+ * @param skip_cnt 输出省去的次数
+ */
+void page_dir_switch_stat(uint32_t *load_cnt, uint32_t *skip_cnt)
+{
+    *load_cnt = cr3_load_cnt;
+    *skip_cnt = cr3_skip_cnt;
+}
+
 /*
  * @brief 创建页目录表，将当前页表的内核空间的pde复制
  * @return 成功返回页目录的虚拟地址，失败返回NULL
@@ -102,9 +161,9 @@ uint32_t *create_page_dir(void)
     }
 
     //1.复制内核页目录表的镜像到用户进程页目录表768~1024的位置
-    //0x300代表768，也就是内核空间的开始位置,总共256项，每项4字节，所以要复制1024个
-    //0xfffff000 表示内核页目录表的基地址
-    memcpy((uint32_t *)((uint32_t)page_dir_vaddr + 0x300 * 4), (uint32_t *)(0xfffff000 + 0x300 * 4), 1024);
+    //0x300代表768，也就是内核空间的开始位置,总共256项
+    //内核空间的页目录项映射大页时会同步到登记过的页目录
+    kernel_pde_copy(page_dir_vaddr);
 
     //2.更新页目录地址
     uint32_t new_page_dir_phyaddr = addr_v2p((uint32_t)page_dir_vaddr);
@@ -114,21 +173,26 @@ uint32_t *create_page_dir(void)
 }
 
 /*
- * @brief 创建用户进程的位图信息
+ * @brief 初始化用户进程的虚拟内存区域
  * @param user_prog 待创建信息的进程地址
+ * @note 开始时只有栈顶一页的栈区域，栈访问到哪一页再由页故障向下扩展
  */
-void create_user_vaddr_bitmap(struct task_struct *user_prog)
+void create_user_vm(struct task_struct *user_prog)
 {
-    //代码段起始位置，也是linux程序入口地址
-    user_prog->userprog_vaddr.vaddr_start = USER_VADDR_START;
-
-    //得到用来表示内存所需要的位图需要几个页
-    uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8, PG_SIZE);
+    mm_init(&user_prog->mm);
+    if (vma_map(&user_prog->mm, USER_STACK3_VADDR, 1, VM_READ | VM_WRITE | VM_GROWSDOWN) == -1)
+    {
+        PANIC("create_user_vm: alloc stack vma failed!");
+    }
 
-    //创建位图信息
-    user_prog->userprog_vaddr.vaddr_bitmap.bits = get_kernel_pages(bitmap_pg_cnt);
-    user_prog->userprog_vaddr.vaddr_bitmap.btmp_bytes_len = (0xc0000000 - USER_VADDR_START) / PG_SIZE / 8;
-    bitmap_init(&user_prog->userprog_vaddr.vaddr_bitmap);
+    //lib/user和内核链接在一起，它的全局变量是所有进程共享的，
+    //所以用户态分配器的状态放在每个进程自己的堆的第一页，进程一开始就有这一页
+    if (vma_map(&user_prog->mm, USER_BRK_START, 1, VM_READ | VM_WRITE) == -1)
+    {
+        PANIC("create_user_vm: alloc brk vma failed!");
+    }
+    user_prog->mm.brk_start = USER_BRK_START;
+    user_prog->mm.brk = USER_BRK_START + PG_SIZE;
 }
 
 /*
@@ -139,10 +203,10 @@ void create_user_vaddr_bitmap(struct task_struct *user_prog)
 void create_process(void *filename, char *name)
 {
     //分配内存进程实体
-    struct task_struct *thread = get_kernel_pages(1);
+    struct task_struct *thread = kmem_cache_alloc(task_cache);
     init_thread(thread, name, default_prio);
-    //创建进程位图信息
-    create_user_vaddr_bitmap(thread);
+    //创建进程的虚拟内存区域
+    create_user_vm(thread);
     //进程作为线程的执行函数
     thread_create(thread, start_process, filename);
     thread->pgdir = create_page_dir();
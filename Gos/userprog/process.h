@@ -5,10 +5,14 @@
 #define default_prio 31
 #define USER_STACK3_VADDR (0xc0000000 - 0x1000)
 #define USER_VADDR_START 0x8048000
+#define USER_STACK3_PAGES 2048 //用户栈最多8MB，自USER_STACK3_VADDR向下按需增长，堆不会分配到这里
+#define USER_BRK_START 0x40000000 //brk堆的起始地址，第一页留给lib/user中的分配器存放状态
 
 void create_process(void *filename, char *name);
-void create_user_vaddr_bitmap(struct task_struct *user_prog);
+void create_user_vm(struct task_struct *user_prog);
 uint32_t *create_page_dir(void);
 void process_activate(struct task_struct *pthread);
 void page_dir_activate(struct task_struct *pthread);
+bool page_dir_loaded(struct task_struct *pthread);
+void page_dir_switch_stat(uint32_t *load_cnt, uint32_t *skip_cnt);
 void start_process(void *filename_);
\ No newline at end of file
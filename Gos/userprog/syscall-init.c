@@ -6,12 +6,15 @@
 #include "string.h"
 #include "fs.h"
 #include "fork.h"
+#include "shm.h"
+#include "wait_exit.h"
+#include "bench.h"
 
-#define syscall_nr 32
+#define syscall_nr 40
 
 typedef void *syscall;
 
-syscall syscall_table[syscall_nr]; //定义总共32个中断处理函数
+syscall syscall_table[syscall_nr]; //定义总共40个中断处理函数
 
 /**
  * @brief 得到当前运行线程的pid
@@ -50,5 +53,18 @@ void syscall_init(void)
     syscall_table[SYS_REWINDDIR] = sys_rewinddir;
     syscall_table[SYS_STAT] = sys_stat;
     syscall_table[SYS_PS] = sys_ps;
+    syscall_table[SYS_MEMINFO] = sys_meminfo;
+    syscall_table[SYS_BRK] = sys_brk;
+    syscall_table[SYS_MMAP] = sys_mmap;
+    syscall_table[SYS_MUNMAP] = sys_munmap;
+    syscall_table[SYS_MPROTECT] = sys_mprotect;
+    syscall_table[SYS_MSYNC] = sys_msync;
+    syscall_table[SYS_SHM_OPEN] = sys_shm_open;
+    syscall_table[SYS_SHM_MAP] = sys_shm_map;
+    syscall_table[SYS_SHM_CLOSE] = sys_shm_close;
+    syscall_table[SYS_EXIT] = sys_exit;
+    syscall_table[SYS_WAIT] = sys_wait;
+    syscall_table[SYS_BENCH] = sys_bench;
+    syscall_table[SYS_YIELD] = thread_yield;
     put_str("syscall init done!\n");
 }
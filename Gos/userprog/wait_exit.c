@@ -0,0 +1,206 @@
+#include "wait_exit.h"
+#include "thread.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "debug.h"
+#include "global.h"
+#include "fs.h"
+#include "file.h"
+#include "inode.h"
+#include "slab.h"
+#include "shm.h"
+
+/**
+ * @brief 回调函数，判断全局文件表下标为global_fd的文件是否还被其他任务打开
+ * 
+ * @param pelem 任务在thread_all_list中的节点
+ * @param global_fd 全局文件表下标
+ * @return true 其他任务的文件描述符表中有它时返回true，停止遍历
+ * @return false 
+ */
+static bool file_shared(struct list_elem *pelem, int global_fd)
+{
+    struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+    if (pthread == running_thread())
+    {
+        return false;
+    }
+    int32_t local_fd;
+    for (local_fd = 3; local_fd < MAX_FILES_OPEN_PER_PROC; local_fd++)
+    {
+        if (pthread->fd_table[local_fd] == global_fd)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 关闭当前进程打开的所有文件
+ * 
+ * @param cur 当前进程
+ * @note fork出来的进程和父进程共用全局文件表中的项，还有别的进程在用时只减少inode的打开数
+ */
+static void release_files(struct task_struct *cur)
+{
+    int32_t local_fd;
+    for (local_fd = 3; local_fd < MAX_FILES_OPEN_PER_PROC; local_fd++)
+    {
+        int32_t global_fd = cur->fd_table[local_fd];
+        if (global_fd == -1)
+        {
+            continue;
+        }
+        if (list_traversal(&thread_all_list, file_shared, global_fd) != NULL)
+        {
+            inode_close(file_table[global_fd].fd_inode);
+            cur->fd_table[local_fd] = -1;
+        }
+        else
+        {
+            sys_close(local_fd);
+        }
+    }
+}
+
+/**
+ * @brief 回调函数，把当前进程的子进程过继给init进程
+ * 
+ * @param pelem 任务在thread_all_list中的节点
+ * @param parent_pid 当前进程的pid
+ * @return false 总是返回false，遍历所有任务
+ */
+static bool child_reparent(struct list_elem *pelem, int parent_pid)
+{
+    struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+    if (pthread->parent_pid == parent_pid)
+    {
+        pthread->parent_pid = INIT_PID;
+    }
+    return false;
+}
+
+/**
+ * @brief 回调函数，查找当前进程已经退出、等待回收的子进程
+ * 
+ * @param pelem 任务在thread_all_list中的节点
+ * @param parent_pid 当前进程的pid
+ * @return true 找到返回true，停止遍历
+ * @return false 
+ */
+static bool find_hanging_child(struct list_elem *pelem, int parent_pid)
+{
+    struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+    return pthread->parent_pid == parent_pid && pthread->task_status == TASK_HANGING;
+}
+
+/**
+ * @brief 回调函数，查找当前进程的任意一个子进程
+ * 
+ * @param pelem 任务在thread_all_list中的节点
+ * @param parent_pid 当前进程的pid
+ * @return true 找到返回true，停止遍历
+ * @return false 
+ */
+static bool find_child(struct list_elem *pelem, int parent_pid)
+{
+    struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
+    return pthread->parent_pid == parent_pid;
+}
+
+/**
+ * @brief 回收已经退出的子进程剩下的页目录和pcb
+ * 
+ * @param child 子进程
+ * @note 子进程退出时仍在使用这两页，只能由父进程释放
+ */
+static void child_reap(struct task_struct *child)
+{
+    enum intr_status old_status = intr_disable();
+    list_remove(&child->all_list_tag);
+    intr_set_status(old_status);
+
+    kernel_pde_drop(child->pgdir);
+    free_kernel_pages(child->pgdir, 1);
+    kmem_cache_free(task_cache, child);
+}
+
+/**
+ * @brief 结束当前进程，exit系统调用的实现
+ * 
+ * @param status 退出状态，由父进程通过wait取得
+ * @note 地址空间和打开的文件在这里释放，之后进程以挂起状态等待父进程回收，不会再被调度
+ */
+void sys_exit(int32_t status)
+{
+    struct task_struct *cur = running_thread();
+    ASSERT(cur->pgdir != NULL && cur->pid != INIT_PID);
+    cur->exit_status = status;
+
+    //# 1.释放用户页框、页表和虚拟内存区域
+    user_vm_release();
+
+    //# 2.关闭打开的文件和共享内存段
+    release_files(cur);
+    shm_task_release(cur);
+
+    //# 3.子进程过继给init，从这里到挂起之间不能被打断，否则可能错过父进程的wait
+    intr_disable();
+    list_traversal(&thread_all_list, child_reparent, cur->pid);
+    struct task_struct *init_task = pid2thread(INIT_PID);
+    if (init_task->task_status == TASK_WAITING &&
+        list_traversal(&thread_all_list, find_hanging_child, INIT_PID) != NULL)
+    {
+        //过继的子进程中有已经退出的，叫醒init回收
+        thread_unblock(init_task);
+    }
+
+    //# 4.唤醒等待中的父进程，然后挂起等待回收
+    struct task_struct *parent = pid2thread(cur->parent_pid);
+    if (parent != NULL && parent->task_status == TASK_WAITING)
+    {
+        thread_unblock(parent);
+    }
+    thread_block(TASK_HANGING);
+    PANIC("sys_exit: hanging process was scheduled");
+}
+
+/**
+ * @brief 等待子进程退出并回收它，wait系统调用的实现
+ * 
+ * @param status 输出子进程的退出状态，可以为NULL
+ * @return pid_t 成功返回子进程的pid，没有子进程时返回-1
+ * @note 已经有子进程退出时立即返回，否则阻塞到某个子进程退出
+ */
+pid_t sys_wait(int32_t *status)
+{
+    struct task_struct *cur = running_thread();
+    while (1)
+    {
+        enum intr_status old_status = intr_disable();
+        struct list_elem *child_elem = list_traversal(&thread_all_list, find_hanging_child, cur->pid);
+        if (child_elem != NULL)
+        {
+            intr_set_status(old_status);
+            struct task_struct *child = elem2entry(struct task_struct, all_list_tag, child_elem);
+            pid_t child_pid = child->pid;
+            if (status != NULL)
+            {
+                *status = child->exit_status;
+            }
+            child_reap(child);
+            return child_pid;
+        }
+
+        if (list_traversal(&thread_all_list, find_child, cur->pid) == NULL)
+        {
+            intr_set_status(old_status);
+            return -1;
+        }
+
+        //子进程退出时会唤醒等待状态的父进程
+        thread_block(TASK_WAITING);
+        intr_set_status(old_status);
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "thread.h"
+
+#define INIT_PID 1 //init进程的pid，它是第一个创建的任务
+
+void sys_exit(int32_t status);
+pid_t sys_wait(int32_t *status);